@@ -0,0 +1,293 @@
+// Benchmark cases and the entry point. The command line (semihosting)
+// is "bench <case> <iterations>", or "bench list" for the case names.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "usb_fifo_copy.h"
+#include "fmt.h"
+#include "rice.h"
+
+volatile uint32_t bench_sink;
+
+/* FIFO copy loops (usb_fifo_copy.h). A RAM word stands in for the DFIFO
+ * window: QEMU has no OTG core, and the loop is what is measured. */
+
+static volatile uint32_t fifo[4];
+static uint32_t packet_words[768 / 4 + 1];
+
+static void fifo_write_64(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_write(fifo, (const uint8_t*)packet_words, 64);
+	}
+}
+
+static void fifo_write_64_unaligned(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_write(fifo, (const uint8_t*)packet_words + 1, 64);
+	}
+}
+
+static void fifo_read_64(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_read(fifo, (uint8_t*)packet_words, 64);
+	}
+}
+
+static void fifo_read_64_unaligned(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_read(fifo, (uint8_t*)packet_words + 1, 64);
+	}
+}
+
+static void fifo_write_768(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_write(fifo, (const uint8_t*)packet_words, 768);
+	}
+}
+
+static void fifo_read_768(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		usb_fifo_read(fifo, (uint8_t*)packet_words, 768);
+	}
+}
+
+/* The loops of USB_WritePacket/USB_ReadPacket before usb_fifo_copy.h, the
+ * reference for the fifo_* cases: hal_<case> runs the same copy. */
+
+static void hal_write(volatile uint32_t *fifo, const uint8_t *src, uint16_t len) {
+	uint32_t count32b = ((uint32_t)len + 3U) / 4U;
+
+	for (uint32_t i = 0U; i < count32b; i++) {
+		*fifo = USB_FIFO_UNALIGNED_READ(src);
+		src++;
+		src++;
+		src++;
+		src++;
+	}
+}
+
+static void hal_read(volatile uint32_t *fifo, uint8_t *dest, uint16_t len) {
+	uint32_t count32b = (uint32_t)len >> 2U;
+	uint16_t remaining_bytes = len % 4U;
+
+	for (uint32_t i = 0U; i < count32b; i++) {
+		USB_FIFO_UNALIGNED_WRITE(dest, *fifo);
+		dest++;
+		dest++;
+		dest++;
+		dest++;
+	}
+	if (remaining_bytes != 0U) {
+		uint32_t data = *fifo;
+
+		for (uint32_t i = 0U; remaining_bytes != 0U; i++, remaining_bytes--) {
+			*dest++ = (uint8_t)(data >> (8U * i));
+		}
+	}
+}
+
+static void hal_fifo_write_64(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_write(fifo, (const uint8_t*)packet_words, 64);
+	}
+}
+
+static void hal_fifo_write_64_unaligned(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_write(fifo, (const uint8_t*)packet_words + 1, 64);
+	}
+}
+
+static void hal_fifo_read_64(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_read(fifo, (uint8_t*)packet_words, 64);
+	}
+}
+
+static void hal_fifo_read_64_unaligned(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_read(fifo, (uint8_t*)packet_words + 1, 64);
+	}
+}
+
+static void hal_fifo_write_768(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_write(fifo, (const uint8_t*)packet_words, 768);
+	}
+}
+
+static void hal_fifo_read_768(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		hal_read(fifo, (uint8_t*)packet_words, 768);
+	}
+}
+
+/* Formatter (fmt.c), the format strings the firmware logs */
+
+static char text[128];
+
+static void fmt_text(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_sink += fmt_snprintf(text, sizeof(text), "Setup stage\n");
+	}
+}
+
+static void fmt_setup(uint32_t iterations) {
+	for (unsigned i = 0; i < iterations; i++) {
+		bench_sink += fmt_snprintf(text, sizeof(text), "0x%02X 0x%02X 0x%02X 0x%02X ", i, i >> 1, i >> 2, i >> 3);
+	}
+}
+
+static void fmt_decimal(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_sink += fmt_snprintf(text, sizeof(text), "Control OUT request with value %i, %i bytes\n", (int)i, -1234);
+	}
+}
+
+static void fmt_padding(uint32_t iterations) {
+	for (unsigned i = 0; i < iterations; i++) {
+		bench_sink += fmt_snprintf(text, sizeof(text), "%-8s|%8i|%08X|%5u\n", "perf", -(int)i, i, i);
+	}
+}
+
+/* newlib-nano snprintf with the same formats, what fmt.c replaced. Only
+ * the benchmark links it, the firmware must not (map_report.sh). */
+
+static void newlib_text(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_sink += snprintf(text, sizeof(text), "Setup stage\n");
+	}
+}
+
+static void newlib_setup(uint32_t iterations) {
+	for (unsigned i = 0; i < iterations; i++) {
+		bench_sink += snprintf(text, sizeof(text), "0x%02X 0x%02X 0x%02X 0x%02X ", i, i >> 1, i >> 2, i >> 3);
+	}
+}
+
+static void newlib_decimal(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		bench_sink += snprintf(text, sizeof(text), "Control OUT request with value %i, %i bytes\n", (int)i, -1234);
+	}
+}
+
+static void newlib_padding(uint32_t iterations) {
+	for (unsigned i = 0; i < iterations; i++) {
+		bench_sink += snprintf(text, sizeof(text), "%-8s|%8i|%08X|%5u\n", "perf", -(int)i, i, i);
+	}
+}
+
+/* Rice coder (rice.c), a block of RICE_BLOCK samples per iteration: divide
+ * by 32 for instructions per sample. The input cycles through 32 blocks. */
+
+#define RICE_INPUT 1024
+
+static uint16_t rice_input[RICE_INPUT] __attribute__((aligned(4)));
+static uint8_t rice_output[RICE_MAX_BYTES];
+static uint32_t lcg = 1;
+
+static uint32_t next_random(void) {
+	lcg = lcg * 1664525 + 1013904223;
+	return lcg >> 16;
+}
+
+static void rice_run(uint32_t iterations) {
+	for (uint32_t i = 0; i < iterations; i++) {
+		uint32_t offset = (i * RICE_BLOCK) % RICE_INPUT;
+
+		bench_sink += rice_encode_block(rice_input + offset, rice_input[(offset - 1) % RICE_INPUT], rice_output);
+	}
+}
+
+// The board's test stream
+static void rice_ramp(uint32_t iterations) {
+	for (int i = 0; i < RICE_INPUT; i++) {
+		rice_input[i] = i;
+	}
+	rice_run(iterations);
+}
+
+// 12-bit tone with 3 bits of noise, no libm: a rotation by 1/64 rad
+static void rice_tone(uint32_t iterations) {
+	int32_t x = 1800 << 8, y = 0;
+
+	for (int i = 0; i < RICE_INPUT; i++) {
+		x -= y / 64;
+		y += x / 64;
+		rice_input[i] = 2048 + (y >> 8) + (int)(next_random() % 17) - 8;
+	}
+	rice_run(iterations);
+}
+
+// 16-bit white noise, every block goes raw
+static void rice_noise(uint32_t iterations) {
+	for (int i = 0; i < RICE_INPUT; i++) {
+		rice_input[i] = next_random();
+	}
+	rice_run(iterations);
+}
+
+static const bench_case_t cases[] = {
+	{ "fifo_write_64", fifo_write_64 },
+	{ "fifo_write_64_unaligned", fifo_write_64_unaligned },
+	{ "fifo_read_64", fifo_read_64 },
+	{ "fifo_read_64_unaligned", fifo_read_64_unaligned },
+	{ "fifo_write_768", fifo_write_768 },
+	{ "fifo_read_768", fifo_read_768 },
+	{ "hal_fifo_write_64", hal_fifo_write_64 },
+	{ "hal_fifo_write_64_unaligned", hal_fifo_write_64_unaligned },
+	{ "hal_fifo_read_64", hal_fifo_read_64 },
+	{ "hal_fifo_read_64_unaligned", hal_fifo_read_64_unaligned },
+	{ "hal_fifo_write_768", hal_fifo_write_768 },
+	{ "hal_fifo_read_768", hal_fifo_read_768 },
+	{ "fmt_text", fmt_text },
+	{ "fmt_setup", fmt_setup },
+	{ "fmt_decimal", fmt_decimal },
+	{ "fmt_padding", fmt_padding },
+	{ "newlib_text", newlib_text },
+	{ "newlib_setup", newlib_setup },
+	{ "newlib_decimal", newlib_decimal },
+	{ "newlib_padding", newlib_padding },
+	{ "rice_ramp", rice_ramp },
+	{ "rice_tone", rice_tone },
+	{ "rice_noise", rice_noise },
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+int main(void) {
+	char cmdline[128];
+	char *argv[4] = { 0 };
+	int argc = 0;
+
+	if (bench_cmdline(cmdline, sizeof(cmdline)) != 0) {
+		bench_puts("No command line, run with -semihosting-config enable=on,arg=...\n");
+		return 1;
+	}
+	for (char *token = strtok(cmdline, " "); token && argc < 4; token = strtok(0, " ")) {
+		argv[argc++] = token;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "list")) {
+		for (int i = 0; i < NUM_CASES; i++) {
+			bench_puts(cases[i].name);
+			bench_puts("\n");
+		}
+		return 0;
+	}
+	if (argc != 3) {
+		bench_puts("Usage: bench list | bench <case> <iterations>\n");
+		return 1;
+	}
+	for (int i = 0; i < NUM_CASES; i++) {
+		if (!strcmp(argv[1], cases[i].name)) {
+			cases[i].run(strtoul(argv[2], 0, 10));
+			return 0;
+		}
+	}
+	bench_puts("Unknown case\n");
+	return 1;
+}
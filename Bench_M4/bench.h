@@ -0,0 +1,28 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+
+/*
+ * Firmware routines run on QEMU (netduinoplus2, a Cortex-M4 STM32F405)
+ * and counted in instructions, see run_bench.sh.
+ *
+ * QEMU reports the instructions of the whole run. Each case runs its
+ * routine the given number of times; the script runs it with N and with
+ * 0 iterations and divides the difference by N, which leaves out the
+ * startup and the case setup.
+ */
+typedef struct {
+	const char *name;
+	void (*run)(uint32_t iterations);
+} bench_case_t;
+
+// Keeps results alive, so the compiler cannot drop the work
+extern volatile uint32_t bench_sink;
+
+// Semihosting (startup.c)
+void bench_puts(const char *s);
+int bench_cmdline(char *buff, int size);
+void bench_exit(int status) __attribute__((noreturn));
+
+#endif /* __BENCH_H */
@@ -0,0 +1,106 @@
+#!/bin/sh
+# Runs the benchmark cases of bench.elf on QEMU and prints the instructions
+# per iteration, with a cycle estimate for the board.
+#
+#   ./run_bench.sh [-b baseline] [-w baseline] [case...]
+#
+#   -b	compare with a baseline file, exit 1 if a case needs more than
+#	TOLERANCE percent (1) more instructions than there
+#   -w	write the results as the new baseline
+#
+# Environment:
+#   QEMU_INSN_PLUGIN	path to libinsn.so from the QEMU build (contrib/plugins
+#			or tests/plugin, depending on the version), required
+#   QEMU		qemu-system-arm
+#   ITERATIONS		runs per case (1000)
+#   CPI		cycles per instruction for the estimate (1.3)
+#
+# QEMU counts instructions, it does not model the pipeline, the flash
+# wait states or the bus. The cycle column is instructions times CPI;
+# measure CPI for a case on the board with the DWT cycle counter when
+# the estimate matters. Instruction counts are exact and repeatable,
+# which is what the regression check needs.
+#
+# A case with a hal_<case> reference (the FIFO copy loops against the
+# original HAL loops) gets a "vs hal" column: the reference instructions
+# over its own, above 1 means fewer instructions than the HAL.
+
+ELF=${ELF:-bench.elf}
+QEMU=${QEMU:-qemu-system-arm}
+ITERATIONS=${ITERATIONS:-1000}
+CPI=${CPI:-1.3}
+TOLERANCE=${TOLERANCE:-1}
+
+BASELINE=
+WRITE=
+while getopts b:w: opt; do
+	case $opt in
+	b) BASELINE=$OPTARG ;;
+	w) WRITE=$OPTARG ;;
+	*) sed -n '4,9p' "$0" >&2; exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ -z "$QEMU_INSN_PLUGIN" ] || [ ! -r "$QEMU_INSN_PLUGIN" ]; then
+	echo "Set QEMU_INSN_PLUGIN to the path of libinsn.so" >&2
+	exit 2
+fi
+
+LOG=$(mktemp)
+trap 'rm -f "$LOG"' EXIT
+
+# qemu <args of the bench command line...>: runs bench.elf, prints its output
+qemu() {
+	args=$(printf ',arg=%s' bench "$@")
+	"$QEMU" -M netduinoplus2 -display none -monitor none -serial null \
+		-semihosting-config enable=on,target=native$args \
+		-kernel "$ELF" -plugin "$QEMU_INSN_PLUGIN" -d plugin -D "$LOG"
+}
+
+# count <case> <iterations>: instructions of the whole run
+count() {
+	if ! qemu "$1" "$2" >/dev/null; then
+		echo "$1 failed" >&2
+		exit 1
+	fi
+	sed -n 's/^insns: //p' "$LOG" | tail -n 1
+}
+
+CASES=${*:-$(qemu list)}
+RESULTS=$(for name in $CASES; do
+	base=$(count "$name" 0) || exit 1
+	total=$(count "$name" "$ITERATIONS") || exit 1
+	echo "$name $(( (total - base) / ITERATIONS ))"
+done) || exit 1
+
+[ -n "$WRITE" ] && echo "$RESULTS" > "$WRITE"
+
+echo "$RESULTS" | awk -v cpi="$CPI" -v tolerance="$TOLERANCE" -v baseline="$BASELINE" '
+BEGIN {
+	if (baseline != "") while ((getline line < baseline) > 0) {
+		split(line, field, " ")
+		old[field[1]] = field[2]
+	}
+	printf "%-28s %12s %12s %8s", "case", "insns/iter", "cycles est", "vs hal"
+	if (baseline != "") printf " %12s %8s", "baseline", "change"
+	printf "\n"
+}
+# All results first: a reference may come after its case
+{ name[NR] = $1; insns[$1] = $2 }
+END {
+	for (i = 1; i <= NR; i++) {
+		n = name[i]
+		printf "%-28s %12d %12d", n, insns[n], insns[n] * cpi + 0.5
+		ref = "hal_" n
+		if ((ref in insns) && insns[n]) printf " %7.2fx", insns[ref] / insns[n]
+		else printf " %8s", ""
+		if (baseline != "" && (n in old)) {
+			change = old[n] ? 100 * (insns[n] - old[n]) / old[n] : 0
+			printf " %12d %+7.1f%%", old[n], change
+			if (change > tolerance) { printf "  REGRESSION"; failed = 1 }
+		}
+		printf "\n"
+	}
+	exit failed
+}'
@@ -0,0 +1,78 @@
+// Vector table, reset and semihosting for running the benchmarks on QEMU.
+// No HAL: the cases only use the CPU and memory.
+
+#include <stdint.h>
+#include <string.h>
+#include "bench.h"
+
+extern uint32_t _sidata, _sdata, _edata, _sbss, _ebss, _estack;
+int main(void);
+
+#define SYS_WRITEC 0x03
+#define SYS_WRITE0 0x04
+#define SYS_GET_CMDLINE 0x15
+#define SYS_EXIT 0x18
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+#define ADP_STOPPED_RUNTIME_ERROR 0x20023
+
+static int semihost(int op, const void *arg) {
+	register int r0 __asm__("r0") = op;
+	register const void *r1 __asm__("r1") = arg;
+
+	__asm__ volatile("bkpt 0xAB" : "+r"(r0) : "r"(r1) : "memory");
+	return r0;
+}
+
+void bench_puts(const char *s) {
+	semihost(SYS_WRITE0, s);
+}
+
+// Arguments given with -semihosting-config arg=..., space separated
+int bench_cmdline(char *buff, int size) {
+	struct {
+		char *buff;
+		int size;
+	} block = { buff, size };
+
+	return semihost(SYS_GET_CMDLINE, &block);
+}
+
+void bench_exit(int status) {
+	// The 32-bit call has no exit code: QEMU exits with 0 for the
+	// application exit reason and 1 for any other
+	semihost(SYS_EXIT, (const void*)(status ? ADP_STOPPED_RUNTIME_ERROR : ADP_STOPPED_APPLICATION_EXIT));
+	for (;;);
+}
+
+// fmt_printf output
+int _write(int file, char *ptr, int len) {
+	for (int i = 0; i < len; i++) {
+		semihost(SYS_WRITEC, &ptr[i]);
+	}
+	return len;
+}
+
+void Reset_Handler(void) {
+	memcpy(&_sdata, &_sidata, (char*)&_edata - (char*)&_sdata);
+	memset(&_sbss, 0, (char*)&_ebss - (char*)&_sbss);
+	// FPU access, the code is built for the hard-float ABI
+	*(volatile uint32_t*)0xE000ED88 |= 0xF << 20;
+	__asm__ volatile("dsb\n\tisb");
+	bench_exit(main());
+}
+
+static void Fault_Handler(void) {
+	bench_puts("Fault\n");
+	bench_exit(1);
+}
+
+__attribute__((section(".isr_vector"), used))
+static const void *vectors[16] = {
+	&_estack,
+	Reset_Handler,
+	Fault_Handler,	// NMI
+	Fault_Handler,	// HardFault
+	Fault_Handler,	// MemManage
+	Fault_Handler,	// BusFault
+	Fault_Handler,	// UsageFault
+};
@@ -0,0 +1,28 @@
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Runtime clock profiles. SystemClock_Config starts the PLL at 168 MHz with
+ * the 48 MHz USB clock on PLLQ; the profiles only change the AHB/APB
+ * prescalers, the flash wait states and the ART prefetch. The PLL keeps
+ * running, so the USB clock is never touched by a switch; the OTG
+ * turnaround time follows HCLK. The host switches with VENDOR_CLOCK
+ * (command.h).
+ */
+typedef enum {
+	CLOCK_PROFILE_PERFORMANCE,	// HCLK 168 MHz, 5 wait states, prefetch on
+	CLOCK_PROFILE_LOW_POWER,	// HCLK 21 MHz, 0 wait states, prefetch off
+	CLOCK_PROFILE_COUNT
+} clock_profile_t;
+
+// Switches to the profile and verifies the flash settings.
+// Call from thread mode only: the HAL waits on SysTick during the switch.
+HAL_StatusTypeDef clock_set_profile(clock_profile_t profile);
+clock_profile_t clock_get_profile(void);
+
+// Prints HCLK, wait states and the cycle budget per USB interrupt under each profile
+void clock_report(void);
+
+#endif /* __CLOCK_H */
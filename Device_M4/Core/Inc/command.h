@@ -0,0 +1,30 @@
+#ifndef __COMMAND_H
+#define __COMMAND_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Vendor OUT requests (bmRequestType 0x40) run in the command task, in
+ * thread mode. usb.c hands a request over once its data stage is
+ * complete and holds back the status stage until the task is done, so
+ * the host sees the request complete only after the command ran.
+ *
+ *   VENDOR_STREAM	wValue STREAM_RAW, _FRAMED or _COMPRESSED starts the sample stream (stream.h), 0 stops it
+ *   VENDOR_LOOPBACK	wValue is a loopback_mode_t (loopback.h)
+ *   VENDOR_PATTERN	pattern_config_t starts the pattern generator (pattern.h), no data stops it
+ *   VENDOR_CLOCK	wValue is a clock_profile_t (clock.h)
+ *   anything else	logged, the data stays readable with VENDOR_READ_BACK
+ */
+#define VENDOR_STREAM 0x20
+#define VENDOR_LOOPBACK 0x21
+#define VENDOR_PATTERN 0x22
+#define VENDOR_CLOCK 0x23
+
+// Registers the command task
+void command_init(void);
+
+// USB bottom half, one request at a time. data stays untouched until
+// usb_command_done(tag), unless the host gives up on the request.
+void command_post(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, uint8_t tag);
+
+#endif /* __COMMAND_H */
@@ -0,0 +1,33 @@
+#ifndef __FMT_H
+#define __FMT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+ * Small printf replacement for the firmware. No heap, no locale, no
+ * floating point, no newlib stdio behind it. Run time is linear in the
+ * output: widths above FMT_MAX_WIDTH are cut to it.
+ *
+ *   %d %i %u %x %X %c %s %p %%
+ *   flags '-' (left align) and '0' (zero pad), a decimal width,
+ *   'l' is accepted and ignored (int and long are both 32 bit)
+ *
+ * Anything else is copied to the output as it is. fmt_printf formats
+ * into FMT_CHUNK bytes of stack and hands each chunk to _write (log.c);
+ * plain text and literal runs longer than a chunk go to _write directly.
+ * Depends on nothing but the compiler headers, so the host benchmark
+ * builds the same file (Host_Tools/fmt_bench.c).
+ */
+#define FMT_MAX_WIDTH 32
+#define FMT_CHUNK 64
+
+// Returns the number of characters produced
+int fmt_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Like snprintf: always terminates if size > 0, returns the length the
+// whole output would have had
+int fmt_snprintf(char *buff, size_t size, const char *format, ...) __attribute__((format(printf, 3, 4)));
+int fmt_vsnprintf(char *buff, size_t size, const char *format, va_list args);
+
+#endif /* __FMT_H */
@@ -0,0 +1,42 @@
+#ifndef __FRAME_H
+#define __FRAME_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Framing for bulk IN data, so the host can tell lost or damaged data
+ * from good data (Host_Tools/frame_decode.h). A frame is a header and
+ * the payload right after it:
+ *
+ *   frame_header_t, then length bytes of payload
+ *
+ * crc covers the header words before it and the payload, computed by the
+ * CRC unit (hw_crc.h) on little-endian words, hence the payload length
+ * is a multiple of 4. seq numbers the frames of a stream from 0, the
+ * first one has FRAME_FLAG_START; a gap in seq is lost data. After
+ * damage, the host finds the next frame by FRAME_SYNC and the CRC.
+ *
+ * With a frame per pool block, the header takes 16 of 1024 bytes (1.6%).
+ */
+#define FRAME_SYNC 0xF7A5
+
+// frame_header_t flags
+#define FRAME_FLAG_START 0x0001	// First frame since the stream started
+#define FRAME_FLAG_RICE 0x0002	// Payload is a rice_header_t and Rice blocks (rice.h)
+
+typedef struct {
+	uint16_t sync;		// FRAME_SYNC
+	uint16_t length;	// Payload bytes
+	uint32_t seq;
+	uint16_t usb_frame;	// USB frame number when the frame was sealed
+	uint16_t flags;
+	uint32_t crc;
+} frame_header_t;
+
+_Static_assert(sizeof(frame_header_t) == 16, "frame_header_t layout changed");
+
+// Thread mode. The payload is already at buff + sizeof(frame_header_t);
+// writes the header, returns the frame length.
+uint32_t frame_seal(uint8_t *buff, uint16_t length, uint32_t seq, uint16_t flags);
+
+#endif /* __FRAME_H */
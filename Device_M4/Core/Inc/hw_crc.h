@@ -0,0 +1,25 @@
+#ifndef __HW_CRC_H
+#define __HW_CRC_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * CRC calculation unit, driven through its registers: the HAL CRC driver
+ * is not part of the tree.
+ *
+ * CRC-32 with polynomial 0x04C11DB7, initial value 0xFFFFFFFF, MSB first,
+ * no reflection and no final XOR, over 32-bit words (CRC-32/MPEG-2 of
+ * each word's bytes in big-endian order). The unit takes a word every
+ * 4 AHB cycles. One user at a time: thread mode only.
+ */
+
+// Enables the clock of the unit
+void hw_crc_init(void);
+
+// Starts over from the initial value
+void hw_crc_reset(void);
+
+// Adds words to the CRC, returns the CRC so far
+uint32_t hw_crc_feed(const uint32_t *words, uint32_t count);
+
+#endif /* __HW_CRC_H */
@@ -0,0 +1,63 @@
+#ifndef __IRQ_STATS_H
+#define __IRQ_STATS_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Cycle counts of the OTG_FS interrupt, taken with the DWT cycle counter
+ * around HAL_PCD_IRQHandler. GINTSTS is sampled on entry and the whole
+ * invocation is booked on one source: the first pending one in the order
+ * of irq_source_t. Invocations that found more than one GINTSTS bit
+ * pending are also counted in irq_stats_t.multi.
+ *
+ * The host reads the block with the IRQ_STATS vendor request (usb.c).
+ * The layout is little-endian and fixed; bump IRQ_STATS_VERSION on change.
+ */
+#define IRQ_STATS_VERSION 1
+
+typedef enum {
+	IRQ_SRC_RESET,		// USBRST, ENUMDNE
+	IRQ_SRC_RXFLVL,		// Rx FIFO not empty: OUT data and SETUP packets
+	IRQ_SRC_OEPINT,		// OUT endpoint interrupts: transfer and setup done
+	IRQ_SRC_IEPINT,		// IN endpoint interrupts: transfer done, Tx FIFO empty
+	IRQ_SRC_SOF,		// Start of frame
+	IRQ_SRC_OTHER,		// Suspend, wakeup, incomplete iso, ...
+	IRQ_SRC_COUNT
+} irq_source_t;
+
+typedef struct {
+	uint64_t total;		// Sum of cycles
+	uint32_t count;		// Invocations
+	uint32_t min;		// 0xFFFFFFFF until the first invocation
+	uint32_t max;
+	uint32_t last;
+} irq_stat_t;
+
+typedef struct {
+	uint8_t version;	// IRQ_STATS_VERSION
+	uint8_t num_sources;	// IRQ_SRC_COUNT
+	uint8_t entry_size;	// sizeof(irq_stat_t)
+	uint8_t reserved;
+	uint32_t cpu_hz;	// HCLK when the block was read
+	uint32_t multi;		// Invocations with more than one GINTSTS bit pending
+	uint32_t overhead;	// Cycles between two back-to-back counter reads
+	irq_stat_t source[IRQ_SRC_COUNT];
+} irq_stats_t;
+
+_Static_assert(sizeof(irq_stat_t) == 24, "irq_stat_t layout changed");
+_Static_assert(sizeof(irq_stats_t) == 16 + 24 * IRQ_SRC_COUNT, "irq_stats_t layout changed");
+
+// Starts the DWT cycle counter and clears the block. Call before HAL_PCD_Start.
+void irq_stats_init(void);
+void irq_stats_reset(void);
+
+// Brackets HAL_PCD_IRQHandler in OTG_FS_IRQHandler
+static inline uint32_t irq_stats_start(void) {
+	return DWT->CYCCNT;
+}
+void irq_stats_record(uint32_t gintsts, uint32_t start);
+
+// Consistent copy of the block, optionally clearing it in the same step
+void irq_stats_snapshot(irq_stats_t *dest, int reset);
+
+#endif /* __IRQ_STATS_H */
@@ -0,0 +1,21 @@
+#ifndef __LOG_H
+#define __LOG_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * fmt_printf output goes through _write into a ring buffer, which the log
+ * task drains to the ITM (SWO) from the main loop. A fmt_printf in an
+ * interrupt only costs the formatting and the copy. Output that does
+ * not fit is dropped and counted, never waited for.
+ */
+#define LOG_BUFF_SIZE 2048	// Power of 2
+#define LOG_DRAIN_CHUNK 128	// Characters per task run, keeps the run short
+
+// Registers the log task. Output written before is kept.
+void log_init(void);
+
+// Characters dropped because the ring was full
+uint32_t log_dropped(void);
+
+#endif /* __LOG_H */
@@ -0,0 +1,45 @@
+#ifndef __LOOPBACK_H
+#define __LOOPBACK_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Echo of the interrupt OUT endpoint for round-trip measurements
+ * (Host_Tools/loop_latency). While on, every packet received on
+ * LOOPBACK_OUT_EP goes back on the selected IN endpoint behind a header
+ * stamped when the bottom half handled it:
+ *
+ *   loopback_header_t, then the payload as received
+ *
+ * Started and stopped with VENDOR_LOOPBACK (command.h). The packet
+ * buffers go from the OUT queue to the IN queue and back without a copy;
+ * with all of them in flight the OUT endpoint NAKs.
+ * Echoing on the bulk endpoint stops the sample stream. A bus reset or
+ * configuration change ends the loopback.
+ */
+#define LOOPBACK_OUT_EP 0x01
+#define LOOPBACK_INTR_EP 0x81
+#define LOOPBACK_BULK_EP 0x82
+#define LOOPBACK_BUFFERS 4
+#define LOOPBACK_PAYLOAD 48	// Max packet size of LOOPBACK_OUT_EP
+
+// VENDOR_LOOPBACK wValue
+typedef enum {
+	LOOPBACK_OFF,
+	LOOPBACK_INTR,		// Echo on LOOPBACK_INTR_EP
+	LOOPBACK_BULK,		// Echo on LOOPBACK_BULK_EP
+} loopback_mode_t;
+
+typedef struct {
+	uint32_t cycles;	// DWT cycle counter
+	uint16_t frame;		// USB frame number
+	uint16_t length;	// Payload bytes that follow
+} loopback_header_t;
+
+_Static_assert(sizeof(loopback_header_t) == 8, "loopback_header_t layout changed");
+
+// Thread mode. Packets still queued when stopped are dropped.
+void loopback_start(loopback_mode_t mode);
+void loopback_stop(void);
+
+#endif /* __LOOPBACK_H */
@@ -41,11 +41,33 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
+/*
+ * Interrupt priorities, NVIC_PRIORITYGROUP_4 (16 preemption levels, 0 is the highest).
+ * The values in stm32f4xx_hal_msp.c and Device_M4.ioc have to match.
+ *
+ *   0..4  Time-critical sampling (timers, ADC). Preempts all USB work.
+ *         Must not call the HAL PCD, usb_queue_submit or usb_pool_submit:
+ *         fill pool blocks and leave the submit to thread mode or PendSV.
+ *   5     OTG_FS, top half. Moves FIFO data, re-arms queued endpoints,
+ *         records events for the bottom half (usb_event.h).
+ *   15    PendSV, bottom half. Control requests, completion hooks, logging.
+ *         SysTick shares the level, neither preempts the other.
+ *
+ * The bottom half masks the top half with BASEPRI while it calls the
+ * HAL PCD, which is not reentrant. Sampling interrupts stay enabled.
+ */
+#define IRQ_PRIORITY_SAMPLING 0
+#define IRQ_PRIORITY_USB 5
+#define IRQ_PRIORITY_DEFERRED 15
 
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
 /* USER CODE BEGIN EM */
+// Code executed from SRAM, copied there by the startup code (see the linker script)
+#define RAMFUNC __attribute__((section(".RamFunc"), noinline))
+// Zero-initialized data in CCM RAM. CPU only: not reachable by DMA.
+#define CCMRAM __attribute__((section(".ccmbss")))
 
 /* USER CODE END EM */
 
@@ -0,0 +1,72 @@
+#ifndef __PATTERN_H
+#define __PATTERN_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_desc.h"
+
+/*
+ * Test pattern generator on the bulk and iso IN endpoints, for checking
+ * hubs, cables and host controllers (Host_Tools/pattern_check).
+ *
+ * Each endpoint sends records of a fixed size, numbered from 0:
+ *
+ *   pattern_record_t, then byte i of the record is (uint8_t)(seq + i)
+ *
+ * Bulk transfers carry as many whole records as fit in a pool block, iso
+ * transfers one record per frame. A gap in the numbers is a lost record,
+ * a repeated or lower number a duplicated or reordered one.
+ *
+ * VENDOR_PATTERN (command.h) with a pattern_config_t starts the generator,
+ * without data it stops. It replaces the sample stream and the bulk
+ * loopback. The iso endpoint needs an alternate setting whose packets
+ * hold a record. VENDOR_PATTERN_STATUS (usb.c) reads pattern_status_t.
+ */
+#define PATTERN_BULK_EP 0x82
+#define PATTERN_ISO_EP USB_ISO_EP
+#define PATTERN_STATUS_VERSION 1
+
+// pattern_config_t endpoints
+#define PATTERN_BULK 0x01
+#define PATTERN_ISO 0x02
+
+typedef struct {
+	uint8_t endpoints;	// PATTERN_BULK | PATTERN_ISO
+	uint8_t reserved;
+	uint16_t record_size;	// Header included, multiple of 4
+	uint32_t rate;		// Records per second and endpoint, 0 for as fast as the host reads
+} pattern_config_t;
+
+typedef struct {
+	uint32_t seq;
+	uint16_t record_size;
+	uint8_t ep_addr;
+	uint8_t reserved;
+} pattern_record_t;
+
+typedef struct {
+	uint8_t version;	// PATTERN_STATUS_VERSION
+	uint8_t endpoints;	// Still running
+	uint16_t record_size;
+	uint32_t rate;
+	uint32_t sent[2];	// Records in completed transfers, bulk and iso
+	uint32_t rejected;	// Configurations refused since power-up
+} pattern_status_t;
+
+_Static_assert(sizeof(pattern_config_t) == 8, "pattern_config_t layout changed");
+_Static_assert(sizeof(pattern_record_t) == 8, "pattern_record_t layout changed");
+_Static_assert(sizeof(pattern_status_t) == 20, "pattern_status_t layout changed");
+
+// Registers the pattern task
+void pattern_init(void);
+
+// Thread mode. Restarts the numbering; returns -1 and keeps the
+// generator stopped if the configuration does not fit.
+int pattern_start(const pattern_config_t *config);
+void pattern_stop(void);
+
+// SysTick, paces the generator when a rate is set
+void pattern_tick(void);
+
+void pattern_status(pattern_status_t *dest);
+
+#endif /* __PATTERN_H */
@@ -0,0 +1,47 @@
+#ifndef __RICE_H
+#define __RICE_H
+
+#include <stdint.h>
+
+/*
+ * Lossless compression of 16-bit samples for the bulk stream: delta
+ * coding, then Rice coding with the parameter picked per block of
+ * RICE_BLOCK samples. The stream uses it in STREAM_COMPRESSED format
+ * (stream.h); Host_Tools/rice_decode.c decodes it.
+ *
+ * Each sample becomes its difference to the one before, wrapping at 16
+ * bits, mapped to unsigned by zigzag (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...).
+ * A block is a byte k, then:
+ *
+ *   k = 0..15	the low k bits of the 32 values, packed LSB first (4k bytes),
+ *		then value >> k of each in unary: that many 0 bits and a 1,
+ *		LSB first, the last byte padded with 0 bits
+ *   RICE_RAW	the 32 values as 16-bit little-endian
+ *
+ * The low bits are apart from the unary parts so the host can unpack
+ * them without following the unary code. k comes from the mean of the
+ * block; a block that would not come out smaller than raw goes raw, so
+ * none takes more than RICE_MAX_BYTES.
+ *
+ * On the Cortex-M4 the deltas and zigzag run on two samples per word
+ * with the SIMD32 instructions (USUB16). Depends on nothing but the
+ * compiler headers, so the host benchmark builds the same file
+ * (Host_Tools/rice_bench.c).
+ */
+#define RICE_BLOCK 32
+#define RICE_MAX_K 15
+#define RICE_RAW 0xFF
+#define RICE_MAX_BYTES (1 + RICE_BLOCK * 2)
+
+// Payload of a frame with FRAME_FLAG_RICE (frame.h): this header, then
+// count / RICE_BLOCK blocks, then 0 bytes up to a multiple of 4
+typedef struct {
+	uint16_t count;		// Samples, a multiple of RICE_BLOCK
+	uint16_t prev;		// Sample before the first one, the base of the first delta
+} rice_header_t;
+
+// Encodes RICE_BLOCK samples that follow prev into out, returns the
+// bytes written. samples must be word-aligned.
+uint32_t rice_encode_block(const uint16_t *samples, uint16_t prev, uint8_t *out);
+
+#endif /* __RICE_H */
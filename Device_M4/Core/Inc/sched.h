@@ -0,0 +1,67 @@
+#ifndef __SCHED_H
+#define __SCHED_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Run-to-completion scheduler for the main loop.
+ *
+ * A task is a function that runs until it returns. sched_signal sets
+ * event flags of a task and makes it ready; the task gets the flags
+ * collected since its last run as its argument. Ready tasks run in the
+ * order they were signalled. With nothing ready, the CPU sleeps in WFI
+ * until an interrupt comes in.
+ *
+ *   static int my_task;
+ *   my_task = sched_add("name", task_fn);	// Before the main loop
+ *   sched_signal(my_task, EVENT_X);	// From anywhere, interrupts included
+ *
+ * The main loop cycles (DWT) are booked on the task that ran, on idle
+ * (WFI), or neither: interrupts between tasks and the scheduler itself.
+ * Interrupts that preempt a task count as part of the task.
+ * The host reads the block with the SCHED_STATS vendor request (usb.c).
+ * The layout is little-endian and fixed; bump SCHED_STATS_VERSION on change.
+ */
+#define SCHED_STATS_VERSION 1
+#define SCHED_MAX_TASKS 8	// Power of two, see sched.c
+#define SCHED_NAME_LENGTH 8
+
+typedef void (*sched_task_t)(uint32_t events);
+
+typedef struct {
+	char name[SCHED_NAME_LENGTH];	// Zero padded, not terminated at full length
+	uint64_t cycles;	// Sum of run times
+	uint32_t runs;
+	uint32_t max;		// Longest run, cycles
+} sched_task_stat_t;
+
+typedef struct {
+	uint8_t version;	// SCHED_STATS_VERSION
+	uint8_t num_tasks;	// Tasks added, entries past it are zero
+	uint8_t entry_size;	// sizeof(sched_task_stat_t)
+	uint8_t reserved;
+	uint32_t cpu_hz;	// HCLK when the block was read
+	uint64_t elapsed;	// Cycles since the last reset
+	uint64_t idle;		// Cycles asleep in WFI
+	sched_task_stat_t task[SCHED_MAX_TASKS];
+} sched_stats_t;
+
+_Static_assert(sizeof(sched_task_stat_t) == 24, "sched_task_stat_t layout changed");
+_Static_assert(sizeof(sched_stats_t) == 24 + 24 * SCHED_MAX_TASKS, "sched_stats_t layout changed");
+
+// Needs the DWT cycle counter, call after irq_stats_init
+void sched_init(void);
+
+// Returns the task id, -1 if the table is full
+int sched_add(const char *name, sched_task_t task);
+
+// Sets event flags and makes the task ready. Any context, invalid ids are ignored.
+void sched_signal(int task, uint32_t events);
+
+// Runs the next ready task, or sleeps until an interrupt. Call from the main loop.
+void sched_dispatch(void);
+
+// Consistent copy of the block, optionally clearing it in the same step
+void sched_stats_snapshot(sched_stats_t *dest, int reset);
+
+#endif /* __SCHED_H */
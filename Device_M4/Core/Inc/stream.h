@@ -0,0 +1,38 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_pool.h"
+
+/*
+ * Sample stream on the bulk IN endpoint. The stream task fills pool
+ * blocks with 16-bit samples and keeps the endpoint queue full while the
+ * host has the stream enabled (VENDOR_STREAM, command.h). Every block
+ * is a whole number of packets, so the host may read in any multiple of
+ * the max packet size.
+ *
+ * STREAM_RAW sends the bare samples. STREAM_FRAMED puts each block in a
+ * frame (frame.h), at the cost of a header per block. STREAM_COMPRESSED
+ * sends frames of Rice coded samples (rice.h), as many as fit a block;
+ * these end with a short packet, so the host has to read in transfers
+ * of at least a block.
+ *
+ * The samples are a 16-bit ramp until a sample source is attached.
+ * A bus reset or configuration change stops the stream.
+ */
+#define STREAM_EP 0x82
+
+// VENDOR_STREAM wValue
+#define STREAM_OFF 0
+#define STREAM_RAW 1
+#define STREAM_FRAMED 2
+#define STREAM_COMPRESSED 3
+
+// Registers the stream task
+void stream_init(void);
+
+// Thread mode
+void stream_start(uint8_t format);
+void stream_stop(void);
+
+#endif /* __STREAM_H */
@@ -0,0 +1,22 @@
+#ifndef __USB_H
+#define __USB_H
+
+#include "stm32f4xx_hal.h"
+
+// What usb.c offers to the rest of the firmware, besides the HAL callbacks
+
+// The host has selected the configuration, the data endpoints are open
+int usb_is_configured(void);
+
+// Max packet size of the iso endpoint, 0 while alternate setting 0 is selected
+uint16_t usb_iso_packet_size(void);
+
+// Frame number of the last SOF. Any context.
+uint16_t usb_frame(void);
+
+// Ends the vendor OUT request handed to command_post with its status
+// stage. Requests the host has replaced with a new SETUP are ignored.
+// Thread mode.
+void usb_command_done(uint8_t tag);
+
+#endif /* __USB_H */
@@ -0,0 +1,145 @@
+#ifndef __USB_DESC_H
+#define __USB_DESC_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Single source of truth for the data endpoints (everything except EP0).
+ * The configuration descriptor, the HAL_PCD_EP_Open calls and the
+ * compile-time checks below are all generated from these tables.
+ *
+ * Endpoints present in every alternate setting of interface 0:
+ *
+ *   EP(address, HAL type, extra bmAttributes bits, max packet size, bInterval)
+ *
+ * The HAL EP_TYPE_* values equal the USB transfer type bits of bmAttributes,
+ * the extra bits carry the iso synchronization type.
+ */
+#define USB_ENDPOINTS(EP) \
+	EP(0x01, EP_TYPE_INTR, 0x00,  48, 3)	/* Interrupt OUT 1 */ \
+	EP(0x81, EP_TYPE_INTR, 0x00,  64, 1)	/* Interrupt IN 1 */ \
+	EP(0x82, EP_TYPE_BULK, 0x00,  64, 3)	/* Bulk IN 2 */
+
+/*
+ * The iso IN endpoint only exists in the alternate settings above 0,
+ * so an idle device reserves no iso bandwidth. Each setting has its own
+ * max packet size; the host picks one with SET_INTERFACE.
+ *
+ *   ALT(alternate setting, iso max packet size)
+ *
+ * Settings are numbered 1..USB_NUM_ISO_ALTS. The largest packet is
+ * limited by the FIFO RAM (see usb_fifo.h), not by the 1023 bytes
+ * allowed for full speed.
+ */
+#define USB_ISO_EP 0x83			// Iso IN 3
+#define USB_ISO_ATTR 0x0C		// Synchronous with SOF
+#define USB_ISO_INTERVAL 1		// Request data every frame
+#define USB_ISO_MPS_MAX 768
+#define USB_ISO_ALT_SETTINGS(ALT) \
+	ALT(1, 128) \
+	ALT(2, 280) \
+	ALT(3, 512) \
+	ALT(4, USB_ISO_MPS_MAX)
+
+#define USB_EP0_SIZE 64
+#define USB_MAX_POWER_MA 50
+
+// Number of endpoints and settings, resulting descriptor length
+#define USB_EP_COUNT_ONE(addr, type, attr, mps, interval) + 1
+#define USB_NUM_ENDPOINTS (0 USB_ENDPOINTS(USB_EP_COUNT_ONE))
+#define USB_ALT_COUNT_ONE(alt, mps) + 1
+#define USB_NUM_ISO_ALTS (0 USB_ISO_ALT_SETTINGS(USB_ALT_COUNT_ONE))
+#define USB_CONFIG_DESC_LENGTH (9 + (9 + 7 * USB_NUM_ENDPOINTS) + \
+	USB_NUM_ISO_ALTS * (9 + 7 * (USB_NUM_ENDPOINTS + 1)))
+
+// Descriptor bytes of one endpoint
+#define USB_EP_DESCRIPTOR(addr, type, attr, mps, interval) \
+	0x07, 0x05, (addr), (type) | (attr), (mps) & 0xff, (mps) >> 8, (interval),
+
+// Descriptor bytes of one interface, vendor-specific class
+#define USB_INTERFACE_DESCRIPTOR(alt, num_endpoints) \
+	0x09, 0x04, 0x00, (alt), (num_endpoints), 0xff, 0xff, 0xff, 0x00,
+
+// Descriptor bytes of one iso alternate setting
+#define USB_ALT_DESCRIPTOR(alt, mps) \
+	USB_INTERFACE_DESCRIPTOR(alt, USB_NUM_ENDPOINTS + 1) \
+	USB_ENDPOINTS(USB_EP_DESCRIPTOR) \
+	USB_EP_DESCRIPTOR(USB_ISO_EP, EP_TYPE_ISOC, USB_ISO_ATTR, mps, USB_ISO_INTERVAL)
+
+// Runtime view of the same table, used to open and close the endpoints
+typedef struct {
+	uint8_t addr;
+	uint8_t type;
+	uint16_t mps;
+} usb_endpoint_t;
+
+#define USB_EP_ENTRY(addr, type, attr, mps, interval) { (addr), (type), (mps) },
+#define USB_ALT_MPS_ENTRY(alt, mps) [alt] = (mps),
+
+/*
+ * Static budget checks
+ */
+
+// OTG FS has endpoints 0..3 in each direction
+#define USB_MAX_EP_NUM 3
+
+// Full-speed frame is 1500 bytes, periodic transfers may take 90% of it.
+// Per-transaction protocol overhead from the USB 2.0 spec, 5.6.3 and 5.7.3.
+#define USB_FRAME_BYTES 1500
+#define USB_PERIODIC_BUDGET (USB_FRAME_BYTES * 90 / 100)
+#define USB_ISO_OVERHEAD 9
+#define USB_INTR_OVERHEAD 13
+
+// Worst case: every periodic endpoint is scheduled in the same frame,
+// with the largest iso setting selected
+#define USB_EP_PERIODIC_BYTES(addr, type, attr, mps, interval) \
+	+ ((type) == EP_TYPE_ISOC ? (mps) + USB_ISO_OVERHEAD : \
+	   (type) == EP_TYPE_INTR ? (mps) + USB_INTR_OVERHEAD : 0)
+#define USB_PERIODIC_BYTES (0 USB_ENDPOINTS(USB_EP_PERIODIC_BYTES) + USB_ISO_MPS_MAX + USB_ISO_OVERHEAD)
+
+#define USB_EP_MPS_VALID(type, mps) \
+	((type) == EP_TYPE_ISOC ? (mps) <= 1023 : \
+	 (type) == EP_TYPE_BULK ? ((mps) == 8 || (mps) == 16 || (mps) == 32 || (mps) == 64) : \
+	 (mps) > 0 && (mps) <= 64)
+
+#define USB_EP_CHECK(addr, type, attr, mps, interval) \
+	_Static_assert(((addr) & 0x0F) >= 1 && ((addr) & 0x0F) <= USB_MAX_EP_NUM, \
+			"Endpoint " #addr ": number out of range"); \
+	_Static_assert(((addr) & 0x70) == 0, "Endpoint " #addr ": reserved address bits set"); \
+	_Static_assert(USB_EP_MPS_VALID(type, mps), "Endpoint " #addr ": invalid max packet size"); \
+	_Static_assert((type) == EP_TYPE_BULK || ((interval) >= 1 && (interval) <= 255), \
+			"Endpoint " #addr ": invalid interval"); \
+	_Static_assert((type) == EP_TYPE_ISOC || (attr) == 0, \
+			"Endpoint " #addr ": sync bits on a non-iso endpoint");
+
+USB_ENDPOINTS(USB_EP_CHECK)
+USB_EP_CHECK(USB_ISO_EP, EP_TYPE_ISOC, USB_ISO_ATTR, USB_ISO_MPS_MAX, USB_ISO_INTERVAL)
+
+#define USB_ALT_CHECK(alt, mps) \
+	_Static_assert((mps) > 0 && (mps) <= USB_ISO_MPS_MAX, "Setting " #alt ": invalid iso packet size");
+
+USB_ISO_ALT_SETTINGS(USB_ALT_CHECK)
+
+// Each address may appear once: with duplicates the sum of the bits differs from their OR
+#define USB_EP_BIT(addr) (1UL << (((addr) & 0x0F) + ((addr) & 0x80 ? 16 : 0)))
+#define USB_EP_BIT_SUM(addr, type, attr, mps, interval) + USB_EP_BIT(addr)
+#define USB_EP_BIT_OR(addr, type, attr, mps, interval) | USB_EP_BIT(addr)
+
+// Same for the alternate settings, which also have to cover 1..USB_NUM_ISO_ALTS
+#define USB_ALT_BIT_SUM(alt, mps) + (1UL << (alt))
+#define USB_ALT_BIT_OR(alt, mps) | (1UL << (alt))
+#define USB_ALT_IS_MAX(alt, mps) + ((mps) == USB_ISO_MPS_MAX)
+
+_Static_assert(USB_NUM_ENDPOINTS + 1 <= 2 * USB_MAX_EP_NUM, "Too many endpoints");
+_Static_assert((0 USB_ENDPOINTS(USB_EP_BIT_SUM) + USB_EP_BIT(USB_ISO_EP)) ==
+		(0 USB_ENDPOINTS(USB_EP_BIT_OR) | USB_EP_BIT(USB_ISO_EP)), "Duplicate endpoint address");
+_Static_assert((0 USB_ISO_ALT_SETTINGS(USB_ALT_BIT_SUM)) == (0 USB_ISO_ALT_SETTINGS(USB_ALT_BIT_OR)),
+		"Duplicate alternate setting");
+_Static_assert((0 USB_ISO_ALT_SETTINGS(USB_ALT_BIT_OR)) == (1UL << (USB_NUM_ISO_ALTS + 1)) - 2,
+		"Alternate settings must be numbered 1..USB_NUM_ISO_ALTS");
+_Static_assert((0 USB_ISO_ALT_SETTINGS(USB_ALT_IS_MAX)) >= 1, "No setting uses USB_ISO_MPS_MAX");
+_Static_assert(USB_PERIODIC_BYTES <= USB_PERIODIC_BUDGET, "Periodic endpoints exceed the frame budget");
+_Static_assert(USB_CONFIG_DESC_LENGTH <= 0xFFFF, "Configuration descriptor too long");
+_Static_assert(USB_MAX_POWER_MA <= 500, "Max power over the USB limit");
+
+#endif /* __USB_DESC_H */
@@ -0,0 +1,56 @@
+#ifndef __USB_EVENT_H
+#define __USB_EVENT_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_queue.h"
+
+/*
+ * Deferred USB work. The OTG_FS interrupt (top half) only moves FIFO
+ * data, re-arms queued endpoints and records what happened here.
+ * Recording pends PendSV, whose handler (bottom half) runs the protocol
+ * handling and the completion hooks at the lowest priority, see the
+ * priority plan in main.h.
+ *
+ * The ring has one producer (the top half) and one consumer (PendSV),
+ * so it needs no locking.
+ */
+#define USB_EVENT_RING_SIZE 64	// Power of 2. Every queue entry of every endpoint fits.
+
+typedef enum {
+	USB_EVENT_RESET,
+	USB_EVENT_SETUP,	// setup holds the SETUP packet
+	USB_EVENT_DATA_OUT,	// EP0 OUT packet, length bytes received
+	USB_EVENT_DATA_IN,	// EP0 IN packet sent
+	USB_EVENT_XFER_DONE,	// Queued transfer finished, done(ep_addr, buff, length, status)
+} usb_event_type_t;
+
+typedef struct {
+	uint8_t type;
+	uint8_t ep_addr;
+	uint8_t status;
+	uint8_t setup[8];
+	uint32_t length;
+	uint8_t *buff;
+	usb_xfer_done_t done;
+} usb_event_t;
+
+// Top half: queues the event and pends PendSV. 0 if the ring is full.
+int usb_event_post(const usb_event_t *event);
+
+// Bottom half, called from PendSV_Handler. Runs all pending events.
+void usb_event_run(void);
+
+// Keeps the top half and PendSV out while the caller uses the HAL PCD.
+// The return value goes back to usb_unlock.
+uint32_t usb_lock(void);
+void usb_unlock(uint32_t key);
+
+// Implemented by usb.c: everything but USB_EVENT_XFER_DONE.
+// Called with the top half masked.
+void usb_handle_event(const usb_event_t *event);
+
+// Events lost to a full ring, and the highest number of pending events
+uint32_t usb_event_overflows(void);
+uint32_t usb_event_max_pending(void);
+
+#endif /* __USB_EVENT_H */
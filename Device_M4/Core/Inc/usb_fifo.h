@@ -0,0 +1,100 @@
+#ifndef __USB_FIFO_H
+#define __USB_FIFO_H
+
+#include "usb_desc.h"
+
+/*
+ * OTG FS FIFO partitioning, derived from USB_ENDPOINTS at compile time.
+ * All sizes are in 4-byte words, as HAL_PCDEx_SetRxFiFo/SetTxFiFo expect.
+ *
+ * 1. Every FIFO gets room for one max-size packet (at least 16 words).
+ *    The shared RX FIFO is sized as recommended in RM0090, 34.11:
+ *    (5 * control EPs + 8) + (largest OUT packet / 4 + 1) + 2 * OUT EPs + 1
+ * 2. If that does not fit into the FIFO RAM, the build fails.
+ * 3. The spare space double-buffers the streaming (bulk and iso IN)
+ *    endpoints in endpoint order, then the RX FIFO, as long as it fits.
+ *    A second packet lets PCD_WriteEmptyTxFifo load the next packet
+ *    while the previous one is still waiting for the IN token.
+ *
+ * The iso endpoint is planned for its largest alternate setting. Its FIFO
+ * is the last one, so SET_INTERFACE can resize it to USB_FIFO_ISO_WORDS
+ * for the selected setting without moving the other FIFOs.
+ */
+
+#define USB_FIFO_TOTAL_WORDS 320	// 1.25 KB of FIFO RAM on OTG FS
+#define USB_FIFO_MIN_WORDS 16		// Minimum Tx FIFO depth, also for unused FIFOs
+#define USB_FIFO_TX_COUNT (USB_MAX_EP_NUM + 1)
+
+#define USB_WORDS(bytes) (((bytes) + 3) / 4)
+#define USB_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// Max packet size of IN / OUT endpoint n, 0 if it is not in the table
+#define USB_IN_MPS_1(addr, type, attr, mps, interval) + ((addr) == 0x81 ? (mps) : 0)
+#define USB_IN_MPS_2(addr, type, attr, mps, interval) + ((addr) == 0x82 ? (mps) : 0)
+#define USB_IN_MPS_3(addr, type, attr, mps, interval) + ((addr) == 0x83 ? (mps) : 0)
+#define USB_IN_MPS(n) (0 USB_ENDPOINTS(USB_IN_MPS_##n) + \
+	((USB_ISO_EP & 0x0F) == (n) ? USB_ISO_MPS_MAX : 0))
+
+#define USB_OUT_MPS_1(addr, type, attr, mps, interval) + ((addr) == 0x01 ? (mps) : 0)
+#define USB_OUT_MPS_2(addr, type, attr, mps, interval) + ((addr) == 0x02 ? (mps) : 0)
+#define USB_OUT_MPS_3(addr, type, attr, mps, interval) + ((addr) == 0x03 ? (mps) : 0)
+#define USB_OUT_MPS(n) (0 USB_ENDPOINTS(USB_OUT_MPS_##n))
+
+// Streaming endpoints are the ones worth a second packet of FIFO space
+#define USB_IN_STREAM_1(addr, type, attr, mps, interval) + ((addr) == 0x81 && (type) != EP_TYPE_INTR)
+#define USB_IN_STREAM_2(addr, type, attr, mps, interval) + ((addr) == 0x82 && (type) != EP_TYPE_INTR)
+#define USB_IN_STREAM_3(addr, type, attr, mps, interval) + ((addr) == 0x83 && (type) != EP_TYPE_INTR)
+#define USB_IN_STREAM(n) (0 USB_ENDPOINTS(USB_IN_STREAM_##n) + ((USB_ISO_EP & 0x0F) == (n)))
+
+#define USB_EP_OUT_COUNT_ONE(addr, type, attr, mps, interval) + (((addr) & 0x80) == 0)
+#define USB_NUM_OUT_EPS (1 USB_ENDPOINTS(USB_EP_OUT_COUNT_ONE))	// Including EP0
+
+#define USB_OUT_MPS_MAX \
+	USB_MAX(USB_EP0_SIZE, USB_MAX(USB_OUT_MPS(1), USB_MAX(USB_OUT_MPS(2), USB_OUT_MPS(3))))
+
+// Step 1: one packet per FIFO
+#define USB_FIFO_RX_PACKET (USB_WORDS(USB_OUT_MPS_MAX) + 1)	// Packet plus status word
+#define USB_FIFO_RX_BASE ((5 * 1 + 8) + USB_FIFO_RX_PACKET + 2 * USB_NUM_OUT_EPS + 1)
+#define USB_FIFO_TX0_BASE USB_MAX(USB_FIFO_MIN_WORDS, USB_WORDS(USB_EP0_SIZE))
+#define USB_FIFO_TX_BASE(n) USB_MAX(USB_FIFO_MIN_WORDS, USB_WORDS(USB_IN_MPS(n)))
+
+#define USB_FIFO_BASE_WORDS (USB_FIFO_RX_BASE + USB_FIFO_TX0_BASE + \
+	USB_FIFO_TX_BASE(1) + USB_FIFO_TX_BASE(2) + USB_FIFO_TX_BASE(3))
+
+// Step 3: double buffering, greedy in endpoint order
+#define USB_FIFO_TX_EXTRA(n) (USB_IN_STREAM(n) ? USB_WORDS(USB_IN_MPS(n)) : 0)
+
+#define USB_FIFO_SPARE0 (USB_FIFO_TOTAL_WORDS - USB_FIFO_BASE_WORDS)
+#define USB_FIFO_DB1 (USB_FIFO_TX_EXTRA(1) <= USB_FIFO_SPARE0)
+#define USB_FIFO_SPARE1 (USB_FIFO_SPARE0 - USB_FIFO_DB1 * USB_FIFO_TX_EXTRA(1))
+#define USB_FIFO_DB2 (USB_FIFO_TX_EXTRA(2) <= USB_FIFO_SPARE1)
+#define USB_FIFO_SPARE2 (USB_FIFO_SPARE1 - USB_FIFO_DB2 * USB_FIFO_TX_EXTRA(2))
+#define USB_FIFO_DB3 (USB_FIFO_TX_EXTRA(3) <= USB_FIFO_SPARE2)
+#define USB_FIFO_SPARE3 (USB_FIFO_SPARE2 - USB_FIFO_DB3 * USB_FIFO_TX_EXTRA(3))
+#define USB_FIFO_DB_RX (USB_FIFO_RX_PACKET <= USB_FIFO_SPARE3)
+
+// Resulting plan
+#define USB_FIFO_RX_WORDS (USB_FIFO_RX_BASE + USB_FIFO_DB_RX * USB_FIFO_RX_PACKET)
+#define USB_FIFO_TX0_WORDS USB_FIFO_TX0_BASE
+#define USB_FIFO_TX_WORDS(n) (USB_FIFO_TX_BASE(n) + USB_FIFO_DB##n * USB_FIFO_TX_EXTRA(n))
+
+#define USB_FIFO_USED_WORDS (USB_FIFO_RX_WORDS + USB_FIFO_TX0_WORDS + \
+	USB_FIFO_TX_WORDS(1) + USB_FIFO_TX_WORDS(2) + USB_FIFO_TX_WORDS(3))
+#define USB_FIFO_FREE_WORDS (USB_FIFO_TOTAL_WORDS - USB_FIFO_USED_WORDS)
+
+// Room for the iso FIFO at runtime: everything the other FIFOs leave over.
+// A setting gets two packets if they fit, one otherwise.
+#define USB_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define USB_FIFO_ISO_MAX_WORDS (USB_FIFO_TOTAL_WORDS - USB_FIFO_RX_WORDS - USB_FIFO_TX0_WORDS - \
+	USB_FIFO_TX_WORDS(1) - USB_FIFO_TX_WORDS(2))
+#define USB_FIFO_ISO_WORDS(mps) \
+	USB_MIN(USB_FIFO_ISO_MAX_WORDS, USB_MAX(USB_FIFO_MIN_WORDS, 2 * USB_WORDS(mps)))
+
+_Static_assert(USB_FIFO_TX_COUNT == 4, "Planner expects Tx FIFOs 0..3");
+_Static_assert((USB_ISO_EP & 0x0F) == USB_FIFO_TX_COUNT - 1, "Iso endpoint must use the last Tx FIFO to be resizable");
+_Static_assert(USB_FIFO_BASE_WORDS <= USB_FIFO_TOTAL_WORDS, "Endpoints do not fit into the OTG FS FIFO RAM");
+_Static_assert(USB_FIFO_USED_WORDS <= USB_FIFO_TOTAL_WORDS, "FIFO plan overflows the OTG FS FIFO RAM");
+_Static_assert(USB_FIFO_ISO_WORDS(USB_ISO_MPS_MAX) >= USB_WORDS(USB_ISO_MPS_MAX), "Largest iso setting does not fit");
+_Static_assert(USB_FIFO_RX_WORDS <= 0xFFFF && USB_FIFO_TX_WORDS(3) <= 0xFFFF, "FIFO depth out of range");
+
+#endif /* __USB_FIFO_H */
@@ -0,0 +1,137 @@
+#ifndef __USB_FIFO_COPY_H
+#define __USB_FIFO_COPY_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Copy loops between packet buffers and the OTG FS data FIFO, used by
+ * USB_WritePacket and USB_ReadPacket in stm32f4xx_ll_usb.c.
+ *
+ * Every address of the 4 KB DFIFO window of an endpoint pushes to (or pops
+ * from) the same FIFO, so a word-aligned buffer can be moved with LDM/STM
+ * bursts of 4 words: one burst on each side instead of 4 single transfers.
+ * Unaligned buffers run the original HAL loop as it was, until Cortex-M4
+ * counts (Bench_M4, fifo_* against hal_fifo_*) show that another loop gains
+ * there. The bursts leave out r7, the Thumb frame pointer at -O0 (Debug
+ * build), and use r8 instead.
+ *
+ * Header-only so the host benchmark (Host_Tools/fifo_bench) builds the same
+ * code; off target the bursts fall back to plain C.
+ */
+
+#if defined (__GNUC__) && defined (__ARM_ARCH_7EM__)
+#define USB_FIFO_COPY_ASM 1
+#else
+#define USB_FIFO_COPY_ASM 0
+#endif
+
+#ifdef __UNALIGNED_UINT32_READ
+#define USB_FIFO_UNALIGNED_READ(p) __UNALIGNED_UINT32_READ(p)
+#define USB_FIFO_UNALIGNED_WRITE(p, v) __UNALIGNED_UINT32_WRITE(p, v)
+#else
+static inline uint32_t USB_FIFO_UNALIGNED_READ(const void *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+#define USB_FIFO_UNALIGNED_WRITE(p, v) do { uint32_t v_ = (v); memcpy((p), &v_, 4); } while (0)
+#endif
+
+// Writes len bytes to the Tx FIFO. The last word is padded from the
+// buffer, as the original HAL loop did: up to 3 bytes past len are read.
+static inline void usb_fifo_write(volatile uint32_t *fifo, const uint8_t *src, uint32_t len)
+{
+  uint32_t count32b = (len + 3U) / 4U;
+
+  if (((uintptr_t)src & 3U) == 0U)
+  {
+    const uint32_t *pSrc = (const uint32_t *)src;
+
+    for (; count32b >= 4U; count32b -= 4U)
+    {
+#if USB_FIFO_COPY_ASM
+      __asm volatile ("ldmia %0!, {r4-r6, r8}\n\t"
+                      "stmia %1, {r4-r6, r8}"
+                      : "+r" (pSrc) : "r" (fifo) : "r4", "r5", "r6", "r8", "memory");
+#else
+      fifo[0] = pSrc[0];
+      fifo[1] = pSrc[1];
+      fifo[2] = pSrc[2];
+      fifo[3] = pSrc[3];
+      pSrc += 4;
+#endif
+    }
+    while (count32b-- != 0U)
+    {
+      *fifo = *pSrc++;
+    }
+    return;
+  }
+
+  // Original HAL loop
+  for (uint32_t i = 0U; i < count32b; i++)
+  {
+    *fifo = USB_FIFO_UNALIGNED_READ(src);
+    src++;
+    src++;
+    src++;
+    src++;
+  }
+}
+
+// Reads len bytes from the Rx FIFO. Returns the pointer past the last byte.
+static inline uint8_t *usb_fifo_read(volatile uint32_t *fifo, uint8_t *dest, uint32_t len)
+{
+  uint32_t count32b = len >> 2U;
+  uint32_t remaining_bytes = len & 3U;
+
+  if (((uintptr_t)dest & 3U) == 0U)
+  {
+    uint32_t *pDest = (uint32_t *)dest;
+
+    for (; count32b >= 4U; count32b -= 4U)
+    {
+#if USB_FIFO_COPY_ASM
+      __asm volatile ("ldmia %1, {r4-r6, r8}\n\t"
+                      "stmia %0!, {r4-r6, r8}"
+                      : "+r" (pDest) : "r" (fifo) : "r4", "r5", "r6", "r8", "memory");
+#else
+      pDest[0] = fifo[0];
+      pDest[1] = fifo[1];
+      pDest[2] = fifo[2];
+      pDest[3] = fifo[3];
+      pDest += 4;
+#endif
+    }
+    while (count32b-- != 0U)
+    {
+      *pDest++ = *fifo;
+    }
+    dest = (uint8_t *)pDest;
+  }
+  else
+  {
+    // Original HAL loop
+    for (uint32_t i = 0U; i < count32b; i++)
+    {
+      USB_FIFO_UNALIGNED_WRITE(dest, *fifo);
+      dest++;
+      dest++;
+      dest++;
+      dest++;
+    }
+  }
+
+  // The FIFO is word based: the last bytes come from one more word
+  if (remaining_bytes != 0U)
+  {
+    uint32_t pData = *fifo;
+
+    do
+    {
+      *dest++ = (uint8_t)pData;
+      pData >>= 8U;
+    } while (--remaining_bytes != 0U);
+  }
+
+  return dest;
+}
+
+#endif /* __USB_FIFO_COPY_H */
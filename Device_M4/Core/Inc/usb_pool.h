@@ -0,0 +1,38 @@
+#ifndef __USB_POOL_H
+#define __USB_POOL_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_queue.h"
+
+/*
+ * Fixed-size, word-aligned blocks that are handed to the USB endpoints
+ * without copying:
+ *
+ *   uint8_t *block = usb_pool_acquire();	// Producer owns the block
+ *   ... fill it ...
+ *   usb_pool_submit(0x82, block, length, NULL);	// The endpoint owns it
+ *   // back in the pool once the transfer has completed
+ *
+ * With a hook, the hook gets the block instead (received data on OUT
+ * endpoints) and has to release it. Blocks are word-aligned and a
+ * multiple of 4 bytes, so usb_fifo_write/read take the burst path.
+ * acquire and release may be called from any context, submit follows
+ * the rules of usb_queue_submit.
+ */
+#define USB_POOL_BLOCK_SIZE 1024	// Largest iso packet (768) or 16 bulk packets
+#define USB_POOL_BLOCKS 16
+
+// NULL if the pool is empty
+uint8_t *usb_pool_acquire(void);
+void usb_pool_release(uint8_t *block);
+
+// Queues the block on the endpoint. On HAL_BUSY/HAL_ERROR the caller still owns it.
+HAL_StatusTypeDef usb_pool_submit(uint8_t ep_addr, uint8_t *block, uint32_t length, usb_xfer_done_t done);
+
+uint32_t usb_pool_free(void);
+// Lowest number of free blocks since the start, to size USB_POOL_BLOCKS
+uint32_t usb_pool_min_free(void);
+// Releases of blocks that were already free, ignored. Non-zero is a bug.
+uint32_t usb_pool_double_releases(void);
+
+#endif /* __USB_POOL_H */
@@ -0,0 +1,54 @@
+#ifndef __USB_QUEUE_H
+#define __USB_QUEUE_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_desc.h"
+
+/*
+ * Per-endpoint transfer queues for the data endpoints (not EP0).
+ *
+ * The HAL takes one transfer per endpoint at a time. Producers queue
+ * transfers ahead with usb_queue_submit; when one completes, the
+ * DataIn/DataOut stage callback starts the next one within the same
+ * interrupt, and passes the finished one to PendSV, which calls its
+ * completion hook (usb_event.h). An iso IN transfer the host did not
+ * take in its frame is aborted by the HAL; it ends with USB_XFER_MISSED
+ * and the next one starts the same way.
+ *
+ * Buffers must stay valid until their hook is called. Transfers are
+ * sent as given: a bulk IN transfer that is a multiple of the max packet
+ * size needs a zero-length transfer queued after it if the host has to
+ * see its end.
+ */
+#define USB_QUEUE_DEPTH 8	// Transfers per endpoint, power of 2
+
+typedef enum {
+	USB_XFER_DONE,
+	USB_XFER_CANCELLED,	// Endpoint closed or bus reset before the transfer completed
+	USB_XFER_MISSED,	// Iso IN not taken in its frame (IISOIXFR), the data is dropped
+} usb_xfer_status_t;
+
+// Called from PendSV, or from the OTG_FS interrupt if the event ring
+// overflows. length is the number of bytes sent, or received for OUT endpoints.
+typedef void (*usb_xfer_done_t)(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status);
+
+// Queues a transfer, starts it if the endpoint is idle.
+// Returns HAL_BUSY if the queue is full. Thread mode, PendSV or the
+// OTG_FS interrupt, never from the sampling interrupts (main.h).
+HAL_StatusTypeDef usb_queue_submit(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_done_t done);
+
+// Free entries in the queue of the endpoint
+uint32_t usb_queue_space(uint8_t ep_addr);
+
+// Advances the queue, call from the DataIn/DataOut stage callbacks
+void usb_queue_complete(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+
+// Ends the transfer in flight as USB_XFER_MISSED and starts the next,
+// call from HAL_PCD_ISOINIncompleteCallback once the HAL aborted it
+void usb_queue_abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+
+// Drops all queued transfers of the endpoint, calling their hooks with
+// USB_XFER_CANCELLED. Call after closing the endpoint.
+void usb_queue_flush(uint8_t ep_addr);
+
+#endif /* __USB_QUEUE_H */
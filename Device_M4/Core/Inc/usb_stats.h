@@ -0,0 +1,70 @@
+#ifndef __USB_STATS_H
+#define __USB_STATS_H
+
+#include "stm32f4xx_hal.h"
+#include "usb_desc.h"
+
+/*
+ * Device-side USB counters, so the host can compare its own view of a
+ * transfer with what the device saw.
+ *
+ * Transfers, packets and bytes are counted when a transfer completes
+ * (DataIn/DataOut stage callbacks). The core does not count NAKs; the
+ * "IN token received while the Tx FIFO was empty" flag is sampled on every
+ * OTG_FS interrupt instead, so naks is a lower bound: at most one per
+ * endpoint and interrupt. FIFO-empty interrupts and incomplete iso frames
+ * come from the same sample of GINTSTS and DIEPINT.
+ *
+ * The host reads the block with the USB_STATS vendor request (usb.c).
+ * The layout is little-endian and fixed, Host_Driver/usb_drv_ioctl.h has
+ * the same struct; bump USB_STATS_VERSION on change. Counters wrap at 2^32.
+ */
+#define USB_STATS_VERSION 1
+#define USB_STATS_EPS (USB_MAX_EP_NUM + 1)
+
+typedef enum {
+	USB_STATS_SETUP_STANDARD,
+	USB_STATS_SETUP_CLASS,
+	USB_STATS_SETUP_VENDOR,
+	USB_STATS_SETUP_RESERVED,
+	USB_STATS_SETUP_COUNT
+} usb_stats_setup_t;
+
+typedef struct {
+	uint32_t transfers;	// Completed transfers
+	uint32_t packets;	// Packets of the completed transfers, ZLPs included
+	uint32_t bytes;
+	uint32_t naks;		// IN only: interrupts that found an IN token NAKed
+	uint32_t fifo_empty;	// IN only: Tx FIFO empty interrupts
+} usb_ep_stats_t;
+
+typedef struct {
+	uint8_t version;	// USB_STATS_VERSION
+	uint8_t num_eps;	// USB_STATS_EPS, entries in in[] and out[]
+	uint8_t ep_entry_size;	// sizeof(usb_ep_stats_t)
+	uint8_t reserved;
+	uint32_t frame;		// Frame number when the block was read
+	uint32_t bus_resets;
+	uint32_t setup[USB_STATS_SETUP_COUNT];	// SETUP packets by bmRequestType type
+	uint32_t iso_in_incomplete;	// Frames in which an iso IN transfer was not taken
+	uint32_t iso_out_incomplete;
+	usb_ep_stats_t in[USB_STATS_EPS];
+	usb_ep_stats_t out[USB_STATS_EPS];
+} usb_stats_t;
+
+_Static_assert(sizeof(usb_ep_stats_t) == 20, "usb_ep_stats_t layout changed");
+_Static_assert(sizeof(usb_stats_t) == 36 + 2 * 20 * USB_STATS_EPS, "usb_stats_t layout changed");
+
+void usb_stats_reset(void);
+
+// Samples the interrupt flags, call from OTG_FS_IRQHandler before HAL_PCD_IRQHandler
+void usb_stats_irq(uint32_t gintsts);
+// Completed transfer of ep_addr (direction bit included)
+void usb_stats_transfer(uint8_t ep_addr, uint32_t bytes, uint32_t mps);
+void usb_stats_setup(uint8_t request_type);
+void usb_stats_bus_reset(void);
+
+// Consistent copy of the block, optionally clearing it in the same step
+void usb_stats_snapshot(usb_stats_t *dest, int reset);
+
+#endif /* __USB_STATS_H */
@@ -0,0 +1,105 @@
+#include "stm32f4xx_hal.h"
+#include "clock.h"
+#include "fmt.h"
+
+#define SYSCLK_HZ 168000000
+// OTG FS needs an AHB clock of at least 14.2 MHz (RM0090, 34.4.4)
+#define USB_MIN_HCLK_HZ 14200000
+
+// Full-speed frame is 1 ms. At most 19 64-byte bulk packets fit into it
+// (USB 2.0 spec, table 5-10), i.e. one transfer interrupt each in the worst case.
+#define USB_FRAMES_PER_SECOND 1000
+#define USB_BULK_PACKETS_PER_FRAME 19
+
+typedef struct {
+	const char *name;
+	uint32_t ahb_divider;
+	uint32_t ahb_divider_value;
+	uint32_t apb1_divider;
+	uint32_t apb2_divider;
+	uint32_t flash_latency;
+	uint8_t prefetch;
+} clock_profile_config_t;
+
+// Wait states for 2.7-3.6 V, RM0090 table 10: one per 30 MHz of HCLK.
+// APB1 is limited to 42 MHz, APB2 to 84 MHz.
+static const clock_profile_config_t profiles[CLOCK_PROFILE_COUNT] = {
+	[CLOCK_PROFILE_PERFORMANCE] = { "performance", RCC_SYSCLK_DIV1, 1, RCC_HCLK_DIV4, RCC_HCLK_DIV2, FLASH_LATENCY_5, 1 },
+	// At 0 wait states the prefetch buffer only costs power
+	[CLOCK_PROFILE_LOW_POWER] = { "low power", RCC_SYSCLK_DIV8, 8, RCC_HCLK_DIV1, RCC_HCLK_DIV1, FLASH_LATENCY_0, 0 },
+};
+
+_Static_assert(SYSCLK_HZ / 8 >= USB_MIN_HCLK_HZ, "Low power HCLK too slow for OTG FS");
+_Static_assert(SYSCLK_HZ / 8 <= 30000000, "Low power HCLK too fast for 0 wait states");
+
+static clock_profile_t current_profile = CLOCK_PROFILE_PERFORMANCE;
+
+HAL_StatusTypeDef clock_set_profile(clock_profile_t profile) {
+	RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+	const clock_profile_config_t *config;
+
+	if (profile >= CLOCK_PROFILE_COUNT) return HAL_ERROR;
+	// HAL_RCC_ClockConfig times out on HAL_GetTick, which needs SysTick to run
+	if (__get_IPSR() != 0) return HAL_ERROR;
+	config = &profiles[profile];
+
+	// Prefetch off before lowering the clock, on after raising it:
+	// it is never enabled at 0 wait states
+	if (!config->prefetch) __HAL_FLASH_PREFETCH_BUFFER_DISABLE();
+
+	// HAL_RCC_ClockConfig orders the wait state and prescaler updates
+	// so the flash is never too slow for HCLK, and updates SysTick
+	RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+								|RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+	RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+	RCC_ClkInitStruct.AHBCLKDivider = config->ahb_divider;
+	RCC_ClkInitStruct.APB1CLKDivider = config->apb1_divider;
+	RCC_ClkInitStruct.APB2CLKDivider = config->apb2_divider;
+	// The OTG core times its turnaround in HCLK cycles (GUSBCFG.TRDT); the
+	// HAL only sets it at enumeration. A slower clock needs a larger value
+	// first: too large is only slower, too small is out of spec.
+	uint32_t new_hclk = SYSCLK_HZ / config->ahb_divider_value;
+	int is_usb_on = __HAL_RCC_USB_OTG_FS_IS_CLK_ENABLED();
+	if (is_usb_on && new_hclk < HAL_RCC_GetHCLKFreq()) USB_SetTurnaroundTime(USB_OTG_FS, new_hclk, USBD_FS_SPEED);
+
+	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, config->flash_latency) != HAL_OK) return HAL_ERROR;
+	if (is_usb_on) USB_SetTurnaroundTime(USB_OTG_FS, HAL_RCC_GetHCLKFreq(), USBD_FS_SPEED);
+
+	if (config->prefetch) __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+#if (INSTRUCTION_CACHE_ENABLE != 0U)
+	__HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+#endif
+#if (DATA_CACHE_ENABLE != 0U)
+	__HAL_FLASH_DATA_CACHE_ENABLE();
+#endif
+
+	// Verify what the hardware actually runs with
+	if (__HAL_FLASH_GET_LATENCY() != config->flash_latency) return HAL_ERROR;
+	if (((FLASH->ACR & FLASH_ACR_PRFTEN) != 0) != config->prefetch) return HAL_ERROR;
+	if (HAL_RCC_GetHCLKFreq() != SYSCLK_HZ / config->ahb_divider_value) return HAL_ERROR;
+
+	current_profile = profile;
+	return HAL_OK;
+}
+
+clock_profile_t clock_get_profile(void) {
+	return current_profile;
+}
+
+void clock_report(void) {
+	uint32_t hclk = HAL_RCC_GetHCLKFreq();
+
+	fmt_printf("Clock profile %s: HCLK %i MHz, %i wait states, prefetch %s, caches I%s/D%s\n",
+			profiles[current_profile].name, (int)(hclk / 1000000), (int)__HAL_FLASH_GET_LATENCY(),
+			FLASH->ACR & FLASH_ACR_PRFTEN ? "on" : "off",
+			FLASH->ACR & FLASH_ACR_ICEN ? "on" : "off",
+			FLASH->ACR & FLASH_ACR_DCEN ? "on" : "off");
+	// Cycles per USB frame and per bulk packet interrupt under each profile
+	for (int i = 0; i < CLOCK_PROFILE_COUNT; i++) {
+		uint32_t cycles = SYSCLK_HZ / profiles[i].ahb_divider_value / USB_FRAMES_PER_SECOND;
+
+		fmt_printf("USB budget %s%s: %i cycles per frame, %i cycles per bulk packet interrupt\n",
+				profiles[i].name, i == current_profile ? " (current)" : "",
+				(int)cycles, (int)(cycles / USB_BULK_PACKETS_PER_FRAME));
+	}
+}
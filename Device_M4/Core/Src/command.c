@@ -0,0 +1,86 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "sched.h"
+#include "usb.h"
+#include "stream.h"
+#include "loopback.h"
+#include "pattern.h"
+#include "clock.h"
+#include <string.h>
+#include "command.h"
+#include "fmt.h"
+
+typedef struct {
+	uint8_t request;
+	uint8_t tag;
+	uint16_t value;
+	uint16_t length;
+	const uint8_t *data;
+} command_t;
+
+static command_t pending CCMRAM;
+static int command_task_id = -1;
+
+#define COMMAND_EVENT_REQUEST 1
+
+static void command_task(uint32_t events) {
+	// Copy: the bottom half may post the next request once the status stage is out
+	command_t command = pending;
+
+	switch (command.request) {
+	case VENDOR_STREAM:
+		if (command.value) {
+			pattern_stop();
+			loopback_stop();
+			stream_start(command.value <= STREAM_COMPRESSED ? command.value : STREAM_RAW);
+		} else {
+			stream_stop();
+		}
+		if (command.value) fmt_printf("Stream started, format %i\n", command.value);
+		else fmt_printf("Stream stopped\n");
+		break;
+	case VENDOR_LOOPBACK:
+		if (command.value == LOOPBACK_BULK) {
+			stream_stop();
+			pattern_stop();
+		}
+		loopback_start(command.value);
+		fmt_printf("Loopback mode %i\n", command.value);
+		break;
+	case VENDOR_PATTERN:
+		if (command.length == sizeof(pattern_config_t)) {
+			pattern_config_t config;
+
+			memcpy(&config, command.data, sizeof(config));
+			stream_stop();
+			loopback_stop();
+			if (pattern_start(&config) == 0) {
+				fmt_printf("Pattern on 0x%02X, %i byte records, %u per second\n", config.endpoints,
+						config.record_size, (unsigned)config.rate);
+			} else {
+				fmt_printf("Pattern configuration refused\n");
+			}
+		} else {
+			pattern_stop();
+			fmt_printf("Pattern stopped\n");
+		}
+		break;
+	case VENDOR_CLOCK:
+		if (clock_set_profile(command.value) == HAL_OK) clock_report();
+		else fmt_printf("Clock profile %i refused\n", command.value);
+		break;
+	default:
+		fmt_printf("Received %i bytes of CTRL data, request %i\n", command.length, command.request);
+		break;
+	}
+	usb_command_done(command.tag);
+}
+
+void command_init(void) {
+	command_task_id = sched_add("command", command_task);
+}
+
+void command_post(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length, uint8_t tag) {
+	pending = (command_t){ .request = request, .tag = tag, .value = value, .length = length, .data = data };
+	sched_signal(command_task_id, COMMAND_EVENT_REQUEST);
+}
@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <string.h>
+#include "fmt.h"
+
+// Output sink: a buffer that is either flushed when full (fmt_printf)
+// or stops taking characters (fmt_snprintf)
+typedef struct {
+	char *buff;
+	size_t size;		// Characters buff can take
+	size_t length;		// Characters in buff
+	size_t total;		// Characters produced, kept or not
+	int flush;		// Hand full buffers to _write instead of dropping the rest
+} fmt_out_t;
+
+extern int _write(int file, char *ptr, int len);
+
+static void flush(fmt_out_t *out) {
+	if (out->length) _write(1, out->buff, out->length);
+	out->length = 0;
+}
+
+static void put(fmt_out_t *out, char c) {
+	out->total++;
+	if (out->length == out->size) {
+		if (!out->flush) return;
+		flush(out);
+	}
+	out->buff[out->length++] = c;
+}
+
+// Copies as much as fits in one go, literal text and converted numbers.
+// A run that does not fit goes to _write as it is, not through the chunk.
+static void put_text(fmt_out_t *out, const char *text, size_t length) {
+	out->total += length;
+	if (out->flush && length > out->size - out->length) {
+		flush(out);
+		_write(1, (char*)text, length);
+		return;
+	}
+	while (length) {
+		if (out->length == out->size) {
+			if (!out->flush) return;
+			flush(out);
+		}
+		size_t count = out->size - out->length;
+		if (count > length) count = length;
+		memcpy(out->buff + out->length, text, count);
+		out->length += count;
+		text += count;
+		length -= count;
+	}
+}
+
+static void pad(fmt_out_t *out, char c, int count) {
+	while (count-- > 0) put(out, c);
+}
+
+// The digits end at end, returns the first one. Constant bases let the
+// compiler divide by multiplication and shifts.
+static char *to_decimal(char *end, uint32_t value) {
+	do {
+		*--end = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	return end;
+}
+
+static char *to_hex(char *end, uint32_t value, const char *symbols) {
+	do {
+		*--end = symbols[value & 0x0F];
+		value >>= 4;
+	} while (value);
+	return end;
+}
+
+static void fmt_format(fmt_out_t *out, const char *format, va_list args) {
+	static const char lower[] = "0123456789abcdef";
+	static const char upper[] = "0123456789ABCDEF";
+
+	while (*format) {
+		if (*format != '%') {
+			const char *text = format;
+			while (*format && *format != '%') format++;
+			put_text(out, text, format - text);
+			continue;
+		}
+		const char *start = format++;
+		int left = 0;
+		char fill = ' ';
+		int width = 0;
+
+		for (;; format++) {
+			if (*format == '-') left = 1;
+			else if (*format == '0') fill = '0';
+			else break;
+		}
+		while (*format >= '0' && *format <= '9') {
+			if (width < FMT_MAX_WIDTH) width = width * 10 + *format - '0';
+			format++;
+		}
+		if (width > FMT_MAX_WIDTH) width = FMT_MAX_WIDTH;
+		if (*format == 'l') format++;
+		if (left) fill = ' ';
+
+		char digits[10];	// 32 bits in decimal
+		char *end = digits + sizeof(digits);
+		char *first = end;
+		int negative = 0;
+		const char *text = NULL;
+
+		switch (*format) {
+		case 'd':
+		case 'i': {
+			int32_t value = va_arg(args, int32_t);
+			negative = value < 0;
+			first = to_decimal(end, negative ? 0U - (uint32_t)value : (uint32_t)value);
+			break;
+		}
+		case 'u':
+			first = to_decimal(end, va_arg(args, uint32_t));
+			break;
+		case 'x':
+			first = to_hex(end, va_arg(args, uint32_t), lower);
+			break;
+		case 'X':
+			first = to_hex(end, va_arg(args, uint32_t), upper);
+			break;
+		case 'p':
+			first = to_hex(end, (uintptr_t)va_arg(args, void*), lower);
+			put_text(out, "0x", 2);
+			width -= 2;
+			break;
+		case 'c':
+			*--first = (char)va_arg(args, int);
+			fill = ' ';
+			break;
+		case 's':
+			text = va_arg(args, const char*);
+			if (!text) text = "(null)";
+			fill = ' ';
+			break;
+		case '%':
+			put(out, '%');
+			format++;
+			continue;
+		default:
+			// Unknown conversion: show it as it was written
+			while (start <= format && *start) put(out, *start++);
+			if (*format) format++;
+			continue;
+		}
+		format++;
+
+		if (text) {
+			int length = strlen(text);
+			if (!left) pad(out, ' ', width - length);
+			put_text(out, text, length);
+			if (left) pad(out, ' ', width - length);
+			continue;
+		}
+		int count = end - first;
+		int length = count + negative;
+		// Zero padding goes between the sign and the digits
+		if (negative && fill == '0') put(out, '-');
+		if (!left) pad(out, fill, width - length);
+		if (negative && fill != '0') put(out, '-');
+		put_text(out, first, count);
+		if (left) pad(out, ' ', width - length);
+	}
+}
+
+int fmt_printf(const char *format_string, ...) {
+	// Plain text, most of the log: one _write, no chunk
+	if (!strchr(format_string, '%')) {
+		int length = strlen(format_string);
+		_write(1, (char*)format_string, length);
+		return length;
+	}
+
+	char chunk[FMT_CHUNK];
+	fmt_out_t out = { .buff = chunk, .size = sizeof(chunk), .flush = 1 };
+	va_list args;
+
+	va_start(args, format_string);
+	fmt_format(&out, format_string, args);
+	va_end(args);
+	flush(&out);
+	return out.total;
+}
+
+int fmt_vsnprintf(char *buff, size_t size, const char *format_string, va_list args) {
+	// Keep one place for the terminator
+	fmt_out_t out = { .buff = buff, .size = size ? size - 1 : 0 };
+
+	fmt_format(&out, format_string, args);
+	if (size) buff[out.length] = 0;
+	return out.total;
+}
+
+int fmt_snprintf(char *buff, size_t size, const char *format_string, ...) {
+	va_list args;
+
+	va_start(args, format_string);
+	int length = fmt_vsnprintf(buff, size, format_string, args);
+	va_end(args);
+	return length;
+}
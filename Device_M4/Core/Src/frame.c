@@ -0,0 +1,18 @@
+#include "stm32f4xx_hal.h"
+#include "usb.h"
+#include "hw_crc.h"
+#include "frame.h"
+
+uint32_t frame_seal(uint8_t *buff, uint16_t length, uint32_t seq, uint16_t flags) {
+	frame_header_t *header = (frame_header_t*)buff;
+
+	header->sync = FRAME_SYNC;
+	header->length = length;
+	header->seq = seq;
+	header->usb_frame = usb_frame();
+	header->flags = flags;
+	hw_crc_reset();
+	hw_crc_feed((const uint32_t*)buff, offsetof(frame_header_t, crc) / 4);
+	header->crc = hw_crc_feed((const uint32_t*)(buff + sizeof(frame_header_t)), length / 4);
+	return sizeof(frame_header_t) + length;
+}
@@ -0,0 +1,26 @@
+#include "stm32f4xx_hal.h"
+#include "hw_crc.h"
+
+void hw_crc_init(void) {
+	__HAL_RCC_CRC_CLK_ENABLE();
+}
+
+void hw_crc_reset(void) {
+	CRC->CR = CRC_CR_RESET;
+}
+
+uint32_t hw_crc_feed(const uint32_t *words, uint32_t count) {
+	// The bus stalls the next write while the unit is busy
+	while (count >= 4) {
+		CRC->DR = words[0];
+		CRC->DR = words[1];
+		CRC->DR = words[2];
+		CRC->DR = words[3];
+		words += 4;
+		count -= 4;
+	}
+	while (count--) {
+		CRC->DR = *words++;
+	}
+	return CRC->DR;
+}
@@ -0,0 +1,73 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "irq_stats.h"
+
+static irq_stats_t irq_stats CCMRAM;
+static uint32_t irq_overhead CCMRAM;
+
+// GINTSTS bits of each source, in booking order. The rest is IRQ_SRC_OTHER.
+static const uint32_t source_mask[IRQ_SRC_OTHER] = {
+	[IRQ_SRC_RESET] = USB_OTG_GINTSTS_USBRST | USB_OTG_GINTSTS_ENUMDNE,
+	[IRQ_SRC_RXFLVL] = USB_OTG_GINTSTS_RXFLVL,
+	[IRQ_SRC_OEPINT] = USB_OTG_GINTSTS_OEPINT,
+	[IRQ_SRC_IEPINT] = USB_OTG_GINTSTS_IEPINT,
+	[IRQ_SRC_SOF] = USB_OTG_GINTSTS_SOF,
+};
+
+void irq_stats_init(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// Two back-to-back counter reads
+	uint32_t best = 0xFFFFFFFF;
+	for (int i = 0; i < 4; i++) {
+		uint32_t start = irq_stats_start();
+		uint32_t cycles = DWT->CYCCNT - start;
+		if (cycles < best) best = cycles;
+	}
+	irq_overhead = best;
+
+	irq_stats_reset();
+}
+
+void irq_stats_reset(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (int i = 0; i < IRQ_SRC_COUNT; i++) {
+		irq_stats.source[i] = (irq_stat_t){ .min = 0xFFFFFFFF };
+	}
+	irq_stats.multi = 0;
+	__set_PRIMASK(primask);
+}
+
+RAMFUNC void irq_stats_record(uint32_t gintsts, uint32_t start) {
+	uint32_t cycles = DWT->CYCCNT - start;
+	int source = 0;
+
+	while (source < IRQ_SRC_OTHER && !(gintsts & source_mask[source])) source++;
+	// More than one bit left after clearing the lowest one
+	if (gintsts & (gintsts - 1)) irq_stats.multi++;
+
+	irq_stat_t *stat = &irq_stats.source[source];
+	stat->total += cycles;
+	stat->count++;
+	stat->last = cycles;
+	if (cycles < stat->min) stat->min = cycles;
+	if (cycles > stat->max) stat->max = cycles;
+}
+
+void irq_stats_snapshot(irq_stats_t *dest, int reset) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*dest = irq_stats;
+	if (reset) irq_stats_reset();
+	__set_PRIMASK(primask);
+
+	dest->version = IRQ_STATS_VERSION;
+	dest->num_sources = IRQ_SRC_COUNT;
+	dest->entry_size = sizeof(irq_stat_t);
+	dest->reserved = 0;
+	dest->cpu_hz = HAL_RCC_GetHCLKFreq();
+	dest->overhead = irq_overhead;
+}
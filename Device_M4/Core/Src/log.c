@@ -0,0 +1,51 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "sched.h"
+#include "log.h"
+
+_Static_assert((LOG_BUFF_SIZE & (LOG_BUFF_SIZE - 1)) == 0, "LOG_BUFF_SIZE must be a power of 2");
+
+static char log_buff[LOG_BUFF_SIZE] CCMRAM;
+// Free running, tail - head is the number of characters waiting
+static volatile uint32_t head CCMRAM;
+static volatile uint32_t tail CCMRAM;
+static uint32_t dropped CCMRAM;
+static int log_task_id = -1;
+
+#define LOG_EVENT_DATA 1
+
+static void log_task(uint32_t events) {
+	for (int i = 0; i < LOG_DRAIN_CHUNK; i++) {
+		if (head == tail) return;
+		// Returns at once without a debugger attached
+		ITM_SendChar(log_buff[head % LOG_BUFF_SIZE]);
+		head++;
+	}
+	// More to come: let the other tasks run first
+	sched_signal(log_task_id, LOG_EVENT_DATA);
+}
+
+void log_init(void) {
+	log_task_id = sched_add("log", log_task);
+	if (head != tail) sched_signal(log_task_id, LOG_EVENT_DATA);
+}
+
+uint32_t log_dropped(void) {
+	return dropped;
+}
+
+// Called by fmt_printf, from any context
+int _write(int file, char *ptr, int len) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t space = LOG_BUFF_SIZE - (tail - head);
+	uint32_t count = (uint32_t)len < space ? (uint32_t)len : space;
+	for (uint32_t i = 0; i < count; i++) {
+		log_buff[tail++ % LOG_BUFF_SIZE] = ptr[i];
+	}
+	dropped += len - count;
+	__set_PRIMASK(primask);
+
+	if (count) sched_signal(log_task_id, LOG_EVENT_DATA);
+	return len;
+}
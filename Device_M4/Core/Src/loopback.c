@@ -0,0 +1,77 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "usb.h"
+#include "usb_event.h"
+#include "usb_queue.h"
+#include "loopback.h"
+
+#define ECHO_SIZE (sizeof(loopback_header_t) + LOOPBACK_PAYLOAD)
+
+// The payload is received behind room for the header, the echo is sent
+// from the start of the same buffer
+static uint8_t buffers[LOOPBACK_BUFFERS][ECHO_SIZE] __attribute__((aligned(4))) CCMRAM;
+// Buffers with the USB queues, changed in PendSV or under usb_lock
+static uint8_t in_use CCMRAM;
+static volatile uint8_t echo_ep CCMRAM;		// 0 when stopped
+
+static void packet_received(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status);
+
+static int buffer_index(const uint8_t *buff) {
+	return (buff - buffers[0]) / ECHO_SIZE;
+}
+
+static void release(const uint8_t *buff) {
+	in_use &= ~(1 << buffer_index(buff));
+}
+
+static void receive(uint8_t *buff) {
+	in_use |= 1 << buffer_index(buff);
+	if (usb_queue_submit(LOOPBACK_OUT_EP, buff + sizeof(loopback_header_t), LOOPBACK_PAYLOAD,
+			packet_received) != HAL_OK) {
+		release(buff);
+	}
+}
+
+// PendSV
+static void echo_sent(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status) {
+	if (status == USB_XFER_DONE && echo_ep) receive(buff);
+	else release(buff);
+}
+
+// PendSV
+static void packet_received(uint8_t ep_addr, uint8_t *payload, uint32_t length, usb_xfer_status_t status) {
+	uint8_t *buff = payload - sizeof(loopback_header_t);
+	uint8_t ep = echo_ep;
+
+	if (status != USB_XFER_DONE || !ep) {
+		release(buff);
+		if (status == USB_XFER_CANCELLED) echo_ep = 0;
+		return;
+	}
+	loopback_header_t *header = (loopback_header_t*)buff;
+	header->cycles = DWT->CYCCNT;
+	header->frame = usb_frame();
+	header->length = length;
+	if (usb_queue_submit(ep, buff, sizeof(loopback_header_t) + length, echo_sent) != HAL_OK) {
+		receive(buff);
+	}
+}
+
+void loopback_start(loopback_mode_t mode) {
+	if (mode == LOOPBACK_OFF) {
+		loopback_stop();
+		return;
+	}
+	uint32_t key = usb_lock();
+	echo_ep = mode == LOOPBACK_BULK ? LOOPBACK_BULK_EP : LOOPBACK_INTR_EP;
+	if (usb_is_configured()) {
+		for (int i = 0; i < LOOPBACK_BUFFERS; i++) {
+			if (!(in_use & (1 << i))) receive(buffers[i]);
+		}
+	}
+	usb_unlock(key);
+}
+
+void loopback_stop(void) {
+	echo_ep = 0;
+}
@@ -21,7 +21,16 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
-
+#include "usb_fifo.h"
+#include "clock.h"
+#include "irq_stats.h"
+#include "sched.h"
+#include "log.h"
+#include "command.h"
+#include "stream.h"
+#include "pattern.h"
+#include "hw_crc.h"
+#include "fmt.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -56,13 +65,7 @@ static void MX_USB_OTG_FS_PCD_Init(void);
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-#include "stdio.h"
-int _write(int file, char *ptr, int len) {
-	for (int i = 0; i < len; i++) {
-		ITM_SendChar(*ptr++);
-	}
-	return len;
-}
+
 /* USER CODE END 0 */
 
 /**
@@ -88,14 +91,28 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  // Same settings as SystemClock_Config, checks flash latency and prefetch
+  if (clock_set_profile(CLOCK_PROFILE_PERFORMANCE) != HAL_OK)
+  {
+    Error_Handler();
+  }
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   MX_USB_OTG_FS_PCD_Init();
   /* USER CODE BEGIN 2 */
-  printf("Starting...\n");
+  // Output before this point waits in the log buffer
+  sched_init();
+  log_init();
+  command_init();
+  hw_crc_init();
+  stream_init();
+  pattern_init();
+  fmt_printf("Starting...\n");
+  clock_report();
+  fmt_printf("FIFO words: RX %i, TX %i/%i/%i/%i, free %i\n", USB_FIFO_RX_WORDS, USB_FIFO_TX0_WORDS,
+		  USB_FIFO_TX_WORDS(1), USB_FIFO_TX_WORDS(2), USB_FIFO_TX_WORDS(3), USB_FIFO_FREE_WORDS);
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -105,6 +122,8 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    // Runs one task, or sleeps until an interrupt makes one ready
+    sched_dispatch();
   }
   /* USER CODE END 3 */
 }
@@ -133,9 +152,9 @@ void SystemClock_Config(void)
   RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
   RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
   RCC_OscInitStruct.PLL.PLLM = 4;
-  RCC_OscInitStruct.PLL.PLLN = 72;
+  RCC_OscInitStruct.PLL.PLLN = 168;
   RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-  RCC_OscInitStruct.PLL.PLLQ = 3;
+  RCC_OscInitStruct.PLL.PLLQ = 7;
   if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
   {
     Error_Handler();
@@ -145,12 +164,12 @@ void SystemClock_Config(void)
   */
   RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
                               |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
   RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
-  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
 
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_5) != HAL_OK)
   {
     Error_Handler();
   }
@@ -187,14 +206,14 @@ static void MX_USB_OTG_FS_PCD_Init(void)
   }
   /* USER CODE BEGIN USB_OTG_FS_Init 2 */
 
-  // Set FIFO number to activate,
-  // along with its size in 4-byte WORDS, e.g.
-  // 0x20 = 32 words = 128 bytes
-  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, 0x20);
-  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 1, 0x20);
-  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 2, 0x20);
-  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 3, 0x100);
-  HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, 0x40);
+  // FIFO sizes in 4-byte WORDS, planned from the endpoint table in usb_fifo.h.
+  // Rx FIFO goes first: Tx FIFO offsets are computed from its size.
+  HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, USB_FIFO_RX_WORDS);
+  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, USB_FIFO_TX0_WORDS);
+  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 1, USB_FIFO_TX_WORDS(1));
+  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 2, USB_FIFO_TX_WORDS(2));
+  HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 3, USB_FIFO_TX_WORDS(3));
+  irq_stats_init();
   HAL_PCD_Start(&hpcd_USB_OTG_FS);
   /* USER CODE END USB_OTG_FS_Init 2 */
 
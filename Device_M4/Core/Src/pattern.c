@@ -0,0 +1,164 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "sched.h"
+#include "usb.h"
+#include "usb_queue.h"
+#include "usb_pool.h"
+#include "pattern.h"
+
+#define CHANNELS 2	// Bulk, iso
+
+typedef struct {
+	uint8_t ep_addr;
+	volatile uint8_t is_running;
+	uint32_t seq;		// Next record
+	volatile uint32_t credit;	// Records the rate allows now
+	uint32_t rate_remainder;
+	volatile uint32_t sent;
+} channel_t;
+
+// .ccmbss is zeroed at startup, not loaded: pattern_init sets ep_addr
+static channel_t channels[CHANNELS] CCMRAM;
+static pattern_config_t config CCMRAM;
+static uint32_t rejected CCMRAM;
+static int pattern_task_id = -1;
+
+#define PATTERN_EVENT_RUN 1
+
+// Byte-wise add without carries between the bytes
+static inline uint32_t add_bytes(uint32_t a, uint32_t b) {
+	return ((a & 0x7F7F7F7F) + (b & 0x7F7F7F7F)) ^ ((a ^ b) & 0x80808080);
+}
+
+static void fill_record(uint8_t *record, uint32_t seq, uint16_t size, uint8_t ep_addr) {
+	pattern_record_t *header = (pattern_record_t*)record;
+	uint32_t *word = (uint32_t*)(record + sizeof(pattern_record_t));
+	uint32_t *end = (uint32_t*)(record + size);
+	// Bytes seq + i, four at a time
+	uint32_t bytes = add_bytes((uint8_t)(seq + sizeof(pattern_record_t)) * 0x01010101, 0x03020100);
+
+	header->seq = seq;
+	header->record_size = size;
+	header->ep_addr = ep_addr;
+	header->reserved = 0;
+	while (word < end) {
+		*word++ = bytes;
+		bytes = add_bytes(bytes, 0x04040404);
+	}
+}
+
+static channel_t *get_channel(uint8_t ep_addr) {
+	return ep_addr == PATTERN_BULK_EP ? &channels[0] : &channels[1];
+}
+
+// PendSV
+static void records_sent(uint8_t ep_addr, uint8_t *block, uint32_t length, usb_xfer_status_t status) {
+	channel_t *channel = get_channel(ep_addr);
+
+	// The block may be from before a restart with another size: its first header has the size
+	if (status == USB_XFER_DONE) channel->sent += length / ((pattern_record_t*)block)->record_size;
+	// A missed iso frame only loses its records, the host sees the gap
+	else if (status == USB_XFER_CANCELLED) channel->is_running = 0;
+	usb_pool_release(block);
+	sched_signal(pattern_task_id, PATTERN_EVENT_RUN);
+}
+
+// Keeps the endpoint queue full, as far as the rate allows
+static void fill_channel(channel_t *channel, uint32_t records_per_transfer) {
+	while (channel->is_running && usb_is_configured() && usb_queue_space(channel->ep_addr)) {
+		uint32_t count = records_per_transfer;
+
+		if (config.rate && channel->credit < count) count = channel->credit;
+		if (!count) return;
+		uint8_t *block = usb_pool_acquire();
+		if (!block) return;
+		for (uint32_t i = 0; i < count; i++) {
+			fill_record(block + i * config.record_size, channel->seq + i, config.record_size, channel->ep_addr);
+		}
+		if (usb_pool_submit(channel->ep_addr, block, count * config.record_size, records_sent) != HAL_OK) {
+			usb_pool_release(block);
+			return;
+		}
+		channel->seq += count;
+		if (config.rate) {
+			uint32_t primask = __get_PRIMASK();
+			__disable_irq();
+			channel->credit -= count;
+			__set_PRIMASK(primask);
+		}
+	}
+}
+
+static void pattern_task(uint32_t events) {
+	if (!config.record_size) return;
+	fill_channel(&channels[0], USB_POOL_BLOCK_SIZE / config.record_size);
+	fill_channel(&channels[1], 1);
+}
+
+void pattern_init(void) {
+	channels[0].ep_addr = PATTERN_BULK_EP;
+	channels[1].ep_addr = PATTERN_ISO_EP;
+	pattern_task_id = sched_add("pattern", pattern_task);
+}
+
+int pattern_start(const pattern_config_t *new_config) {
+	uint16_t size = new_config->record_size;
+	int is_valid = size >= sizeof(pattern_record_t) && size <= USB_POOL_BLOCK_SIZE && size % 4 == 0 &&
+			new_config->endpoints && !(new_config->endpoints & ~(PATTERN_BULK | PATTERN_ISO)) &&
+			(!(new_config->endpoints & PATTERN_ISO) || size <= usb_iso_packet_size());
+
+	pattern_stop();
+	if (!is_valid) {
+		rejected++;
+		return -1;
+	}
+	config = *new_config;
+	for (int i = 0; i < CHANNELS; i++) {
+		channel_t *channel = &channels[i];
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		channel->seq = 0;
+		channel->sent = 0;
+		channel->credit = 0;
+		channel->rate_remainder = 0;
+		channel->is_running = (config.endpoints >> i) & 1;
+		__set_PRIMASK(primask);
+	}
+	sched_signal(pattern_task_id, PATTERN_EVENT_RUN);
+	return 0;
+}
+
+void pattern_stop(void) {
+	// Transfers already queued still go out
+	channels[0].is_running = 0;
+	channels[1].is_running = 0;
+}
+
+void pattern_tick(void) {
+	int is_due = 0;
+
+	if (!config.rate) return;
+	for (int i = 0; i < CHANNELS; i++) {
+		channel_t *channel = &channels[i];
+		uint32_t limit = USB_QUEUE_DEPTH * (USB_POOL_BLOCK_SIZE / config.record_size);
+
+		if (!channel->is_running) continue;
+		channel->rate_remainder += config.rate;
+		channel->credit += channel->rate_remainder / 1000;
+		channel->rate_remainder %= 1000;
+		// A host that stopped reading gets no burst when it comes back
+		if (channel->credit > limit) channel->credit = limit;
+		if (channel->credit) is_due = 1;
+	}
+	if (is_due) sched_signal(pattern_task_id, PATTERN_EVENT_RUN);
+}
+
+void pattern_status(pattern_status_t *dest) {
+	dest->version = PATTERN_STATUS_VERSION;
+	dest->endpoints = channels[0].is_running | channels[1].is_running << 1;
+	dest->record_size = config.record_size;
+	dest->rate = config.rate;
+	dest->sent[0] = channels[0].sent;
+	dest->sent[1] = channels[1].sent;
+	dest->rejected = rejected;
+}
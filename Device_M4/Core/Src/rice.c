@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include "rice.h"
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#endif
+
+#define PAIRS (RICE_BLOCK / 2)
+
+// Two 16-bit subtractions, no borrow from one to the other
+static inline uint32_t sub16(uint32_t a, uint32_t b) {
+#if defined(__ARM_FEATURE_SIMD32)
+	return __usub16(a, b);
+#else
+	return ((a - b) & 0xFFFF) | ((a - (b & 0xFFFF0000)) & 0xFFFF0000);
+#endif
+}
+
+// Zigzag of two 16-bit values: (d << 1) ^ (d >> 15) in each half
+static inline uint32_t zigzag2(uint32_t delta) {
+	uint32_t sign = (delta >> 15) & 0x00010001;
+
+	return ((delta << 1) & 0xFFFEFFFE) ^ (sign * 0xFFFF);
+}
+
+// Per block: deltas and zigzag, two values per word
+static uint32_t map_block(const uint16_t *samples, uint16_t prev, uint32_t *values) {
+	const uint32_t *pairs = (const uint32_t*)samples;
+	uint32_t last = (uint32_t)prev << 16;
+	uint32_t sum = 0;
+
+	for (int i = 0; i < PAIRS; i++) {
+		uint32_t pair = pairs[i];
+		// The sample before each of the two: PKHBT
+		uint32_t before = (last >> 16) | (pair << 16);
+		uint32_t value = zigzag2(sub16(pair, before));
+
+		values[i] = value;
+		sum += (value & 0xFFFF) + (value >> 16);
+		last = pair;
+	}
+	return sum;
+}
+
+// floor(log2(mean)), the k that keeps the unary parts near one bit each
+static uint32_t pick_k(uint32_t sum) {
+	uint32_t mean = sum / RICE_BLOCK;
+
+	if (!mean) return 0;
+	uint32_t k = 31 - __builtin_clz(mean);
+	return k > RICE_MAX_K ? RICE_MAX_K : k;
+}
+
+static inline uint32_t get_value(const uint32_t *values, int i) {
+	return i & 1 ? values[i / 2] >> 16 : values[i / 2] & 0xFFFF;
+}
+
+static uint32_t write_raw(const uint32_t *values, uint8_t *out) {
+	*out++ = RICE_RAW;
+	for (int i = 0; i < PAIRS; i++) {
+		out[0] = values[i];
+		out[1] = values[i] >> 8;
+		out[2] = values[i] >> 16;
+		out[3] = values[i] >> 24;
+		out += 4;
+	}
+	return RICE_MAX_BYTES;
+}
+
+uint32_t rice_encode_block(const uint16_t *samples, uint16_t prev, uint8_t *out) {
+	uint32_t values[PAIRS];
+	uint32_t k = pick_k(map_block(samples, prev, values));
+	uint32_t high_mask = (0xFFFF >> k) * 0x00010001;
+	uint32_t unary_bits = RICE_BLOCK;
+
+	for (int i = 0; i < PAIRS; i++) {
+		uint32_t high = (values[i] >> k) & high_mask;
+		unary_bits += (high & 0xFFFF) + (high >> 16);
+	}
+	if (1 + 4 * k + (unary_bits + 7) / 8 >= RICE_MAX_BYTES) return write_raw(values, out);
+
+	uint8_t *start = out;
+	uint32_t low_mask = (1 << k) - 1;
+	uint32_t bits = 0, count = 0;
+
+	*out++ = k;
+	// Low bits: 32 * k bits, whole bytes
+	for (int i = 0; k && i < RICE_BLOCK; i++) {
+		bits |= (get_value(values, i) & low_mask) << count;
+		count += k;
+		while (count >= 8) {
+			*out++ = bits;
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	// Unary parts
+	for (int i = 0; i < RICE_BLOCK; i++) {
+		uint32_t value = get_value(values, i);
+
+		count += value >> k;
+		while (count >= 8) {
+			*out++ = bits;
+			bits = 0;
+			count -= 8;
+		}
+		bits |= 1 << count;
+		if (++count == 8) {
+			*out++ = bits;
+			bits = 0;
+			count = 0;
+		}
+	}
+	if (count) *out++ = bits;
+	return out - start;
+}
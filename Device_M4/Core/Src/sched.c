@@ -0,0 +1,110 @@
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "sched.h"
+
+// The 8-bit ready queue indices run freely and wrap at 256: the modulo stays
+// in step only for a power of two, and a full queue must not read as empty
+_Static_assert((SCHED_MAX_TASKS & (SCHED_MAX_TASKS - 1)) == 0, "SCHED_MAX_TASKS must be a power of two");
+_Static_assert(SCHED_MAX_TASKS <= 128, "Ready queue indices are 8 bit");
+
+typedef struct {
+	const char *name;
+	sched_task_t run;
+	uint32_t events;	// Collected since the last run
+} task_t;
+
+static task_t tasks[SCHED_MAX_TASKS] CCMRAM;
+static uint8_t num_tasks CCMRAM;
+
+// A task is queued at most once: only when its events go from none to some.
+// head and tail run freely, the queue can never hold more than the task table.
+static uint8_t ready[SCHED_MAX_TASKS] CCMRAM;
+static uint8_t ready_head CCMRAM;
+static uint8_t ready_tail CCMRAM;
+
+static sched_stats_t sched_stats CCMRAM;
+static uint32_t last_mark CCMRAM;	// DWT->CYCCNT when the last cycles were booked
+
+// Books the cycles since the last call, with interrupts disabled
+static uint32_t book(uint64_t *account) {
+	uint32_t now = DWT->CYCCNT;
+	uint32_t cycles = now - last_mark;
+
+	last_mark = now;
+	sched_stats.elapsed += cycles;
+	if (account) *account += cycles;
+	return cycles;
+}
+
+void sched_init(void) {
+	// CYCCNT stops in Sleep unless the debug block keeps HCLK running there,
+	// without it idle would always read 0. The cost: the core clock is no
+	// longer gated in WFI, so Sleep saves little. Leave the bit out when
+	// measuring the current of the low power clock profile.
+	DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+	last_mark = DWT->CYCCNT;
+}
+
+int sched_add(const char *name, sched_task_t task) {
+	if (num_tasks == SCHED_MAX_TASKS) return -1;
+	tasks[num_tasks] = (task_t){ .name = name, .run = task };
+	return num_tasks++;
+}
+
+void sched_signal(int task, uint32_t events) {
+	if (task < 0 || task >= num_tasks || !events) return;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (!tasks[task].events) ready[ready_tail++ % SCHED_MAX_TASKS] = task;
+	tasks[task].events |= events;
+	__set_PRIMASK(primask);
+}
+
+void sched_dispatch(void) {
+	__disable_irq();
+	if (ready_head == ready_tail) {
+		book(NULL);
+		// Wakes up on a pending interrupt even with PRIMASK set,
+		// so nothing signalled after the check above is missed
+		__DSB();
+		__WFI();
+		book(&sched_stats.idle);
+		// The interrupt that woke the CPU up runs here
+		__enable_irq();
+		return;
+	}
+
+	uint8_t id = ready[ready_head++ % SCHED_MAX_TASKS];
+	uint32_t events = tasks[id].events;
+	tasks[id].events = 0;
+	book(NULL);
+	__enable_irq();
+
+	tasks[id].run(events);
+
+	__disable_irq();
+	sched_task_stat_t *stat = &sched_stats.task[id];
+	uint32_t cycles = book(&stat->cycles);
+	stat->runs++;
+	if (cycles > stat->max) stat->max = cycles;
+	__enable_irq();
+}
+
+void sched_stats_snapshot(sched_stats_t *dest, int reset) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*dest = sched_stats;
+	if (reset) memset(&sched_stats, 0, sizeof(sched_stats));
+	__set_PRIMASK(primask);
+
+	dest->version = SCHED_STATS_VERSION;
+	dest->num_tasks = num_tasks;
+	dest->entry_size = sizeof(sched_task_stat_t);
+	dest->reserved = 0;
+	dest->cpu_hz = HAL_RCC_GetHCLKFreq();
+	for (int i = 0; i < num_tasks; i++) {
+		strncpy(dest->task[i].name, tasks[i].name, SCHED_NAME_LENGTH);
+	}
+}
@@ -22,6 +22,10 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "irq_stats.h"
+#include "usb_stats.h"
+#include "usb_event.h"
+#include "pattern.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -170,6 +174,8 @@ void DebugMon_Handler(void)
 void PendSV_Handler(void)
 {
   /* USER CODE BEGIN PendSV_IRQn 0 */
+  // Bottom half of the USB handling, pended by the OTG_FS interrupt
+  usb_event_run();
 
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
@@ -187,6 +193,7 @@ void SysTick_Handler(void)
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
+  pattern_tick();
 
   /* USER CODE END SysTick_IRQn 1 */
 }
@@ -204,11 +211,13 @@ void SysTick_Handler(void)
 void OTG_FS_IRQHandler(void)
 {
   /* USER CODE BEGIN OTG_FS_IRQn 0 */
-
+  uint32_t irq_start = irq_stats_start();
+  uint32_t irq_pending = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK;
+  usb_stats_irq(irq_pending);
   /* USER CODE END OTG_FS_IRQn 0 */
   HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
   /* USER CODE BEGIN OTG_FS_IRQn 1 */
-
+  irq_stats_record(irq_pending, irq_start);
   /* USER CODE END OTG_FS_IRQn 1 */
 }
 
@@ -0,0 +1,110 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "sched.h"
+#include "usb.h"
+#include "usb_queue.h"
+#include "usb_pool.h"
+#include "frame.h"
+#include "rice.h"
+#include "stream.h"
+
+_Static_assert(USB_POOL_BLOCK_SIZE % 64 == 0, "Stream blocks must be whole bulk packets");
+
+static int stream_task_id = -1;
+static volatile uint8_t is_streaming CCMRAM;
+static uint8_t stream_format CCMRAM;
+static uint16_t next_sample CCMRAM;
+static uint16_t last_sample CCMRAM;
+static uint32_t next_seq CCMRAM;
+// Samples waiting for the encoder, a Rice block at a time
+static uint16_t rice_samples[RICE_BLOCK] __attribute__((aligned(4))) CCMRAM;
+
+#define STREAM_EVENT_START 1
+#define STREAM_EVENT_SENT 2	// A block is back in the pool
+
+#define FRAME_PAYLOAD (USB_POOL_BLOCK_SIZE - sizeof(frame_header_t))
+// Samples after the frame header, which keeps the frame a whole block
+#define FRAME_SAMPLES (FRAME_PAYLOAD / 2)
+
+// The shortest Rice block is the k byte and a unary bit per sample
+_Static_assert(FRAME_PAYLOAD / (1 + RICE_BLOCK / 8) * RICE_BLOCK <= 0xFFFF, "Rice sample count must fit rice_header_t");
+
+// Runs in PendSV
+static void block_sent(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status) {
+	usb_pool_release(buff);
+	// Endpoint closed: the host has to start the stream again
+	if (status == USB_XFER_CANCELLED) is_streaming = 0;
+	sched_signal(stream_task_id, STREAM_EVENT_SENT);
+}
+
+static void fill_samples(uint16_t *samples, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		samples[i] = next_sample++;
+	}
+	last_sample = samples[count - 1];
+}
+
+// Rice blocks while the next one surely fits, returns the payload length
+static uint16_t fill_compressed(uint8_t *payload) {
+	rice_header_t *header = (rice_header_t*)payload;
+	uint32_t length = sizeof(rice_header_t);
+
+	header->count = 0;
+	header->prev = last_sample;
+	while (length + RICE_MAX_BYTES + 3 <= FRAME_PAYLOAD) {
+		uint16_t prev = last_sample;
+
+		fill_samples(rice_samples, RICE_BLOCK);
+		length += rice_encode_block(rice_samples, prev, payload + length);
+		header->count += RICE_BLOCK;
+	}
+	// The frame CRC takes whole words
+	while (length % 4) {
+		payload[length++] = 0;
+	}
+	return length;
+}
+
+// Tops up the endpoint queue. Runs again whenever a block comes back.
+static void stream_task(uint32_t events) {
+	while (is_streaming && usb_is_configured() && usb_queue_space(STREAM_EP)) {
+		uint8_t *block = usb_pool_acquire();
+
+		if (!block) return;
+		uint32_t length = USB_POOL_BLOCK_SIZE;
+		if (stream_format == STREAM_RAW) {
+			fill_samples((uint16_t*)block, USB_POOL_BLOCK_SIZE / 2);
+		} else {
+			uint8_t *payload = block + sizeof(frame_header_t);
+			uint16_t flags = next_seq ? 0 : FRAME_FLAG_START;
+
+			if (stream_format == STREAM_COMPRESSED) {
+				length = frame_seal(block, fill_compressed(payload), next_seq, flags | FRAME_FLAG_RICE);
+			} else {
+				fill_samples((uint16_t*)payload, FRAME_SAMPLES);
+				length = frame_seal(block, FRAME_SAMPLES * 2, next_seq, flags);
+			}
+		}
+		if (usb_pool_submit(STREAM_EP, block, length, block_sent) != HAL_OK) {
+			usb_pool_release(block);
+			return;
+		}
+		if (stream_format != STREAM_RAW) next_seq++;
+	}
+}
+
+void stream_init(void) {
+	stream_task_id = sched_add("stream", stream_task);
+}
+
+void stream_start(uint8_t format) {
+	stream_format = format;
+	next_seq = 0;
+	is_streaming = 1;
+	sched_signal(stream_task_id, STREAM_EVENT_START);
+}
+
+void stream_stop(void) {
+	// Blocks already queued still go out
+	is_streaming = 0;
+}
@@ -1,198 +1,640 @@
-#include <stdio.h>
 #include "stm32f4xx_hal.h"
 #include "main.h"
+#include "usb_desc.h"
+#include "usb_fifo.h"
+#include "irq_stats.h"
+#include "usb_stats.h"
+#include "usb_queue.h"
+#include "usb_event.h"
+#include "usb.h"
+#include "sched.h"
+#include "command.h"
+#include "pattern.h"
+#include "fmt.h"
 #include <string.h>
 
 /*
- * Make sure to allocate FIFOs and start the peripheral in main.c
+ * Make sure to allocate FIFOs and start the peripheral in main.c.
+ * FIFO sizes come from the planner in usb_fifo.h:
  *
- *   // Set FIFO number to activate,
- *   // along with its size in 4-byte WORDS, e.g.
- *   // 0x20 = 32 words = 128 bytes
- *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, 0x20);
- *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 1, 0x20);
- *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 2, 0x20);
- *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 3, 0x100);
- *   HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, 0x40);
+ *   HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, USB_FIFO_RX_WORDS);
+ *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, USB_FIFO_TX0_WORDS);
+ *   HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, n, USB_FIFO_TX_WORDS(n));
  *   HAL_PCD_Start(&hpcd_USB_OTG_FS);
  *
  */
 
 extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
 extern uint16_t xfer_buff[];	// Data to transmit to the host. The data itself is generated elsewhere.
-static uint8_t usb_buff[4];
-static int is_ctrl_receive_pending = 0;
-static const uint8_t int_packet_size = 48;		// Up to 64
-static const uint8_t blk_packet_size = 64;		// Up to 64
-static const uint16_t iso_packet_size = 280;	// Up to 1024
-int is_xfer_requested = 0;
-
-uint8_t device_descriptor[] = {
+int is_xfer_requested CCMRAM = 0;
+
+// Descriptor constants, used in the descriptors and when parsing requests
+#define DESCRIPTOR_DEVICE 1
+#define DESCRIPTOR_CONFIGURATION 2
+#define DESCRIPTOR_STRING 3
+#define DESCRIPTOR_INTERFACE 4
+#define DESCRIPTOR_DEVICE_QUALIFIER 6
+
+const uint8_t device_descriptor[] = {
 		0x12,		// Length
-		0x01,		// Descriptor type
+		DESCRIPTOR_DEVICE,	// Descriptor type
 		0x00, 0x02,	// USB version
 		0x00,		// Device class
 		0x00,		// Device subclass
 		0x00,		// Device protocol
-		0x40,		// Max Packet Size (endpoint 0)
+		USB_EP0_SIZE,	// Max Packet Size (endpoint 0)
 		0x83, 0x04,	// idVendor
 		0x55, 0x12,	// idProduct
 		0x01, 0x01,	// Device version
-		0x00,		// iManufacturer
-		0x00,		// iProduct
-		0x00,		// iSerialNumber
+		0x01,		// iManufacturer
+		0x02,		// iProduct
+		0x03,		// iSerialNumber
 		0x01		// Num configurations
 };
 
-uint8_t configuration_descriptor[] = {
+// Interfaces, endpoints and lengths come from the tables in usb_desc.h
+const uint8_t configuration_descriptor[] = {
 		0x09,		// Length
-		0x02, 		// Descriptor type
-		0x00, 0x00, // Total length, to be filled later
+		DESCRIPTOR_CONFIGURATION,	// Descriptor type
+		USB_CONFIG_DESC_LENGTH & 0xff, USB_CONFIG_DESC_LENGTH >> 8,	// Total length
 		0x01,		// Num interfaces
 		0x01,		// Configuration number
 		0x00,		// iConfiguration
 		0xc0,		// Attributes. SELF-POWERED, NO-REMOTE-WAKEUP
-		0x19,		// Max power. 50 mA
-		// Interface descriptor
+		USB_MAX_POWER_MA / 2,	// Max power, 2 mA units
+		// Interface 0, alternate setting 0. No iso endpoint, no iso bandwidth.
 		0x09,		// Length
-		0x04,		// Descriptor type
+		DESCRIPTOR_INTERFACE,	// Descriptor type
 		0x00,		// Interface number
 		0x00, 		// Alternate setting
-
-		//------------ UPDATE IF ENDPOINTS UPDATED ---------------------------
-		0x03,		// Endpoints number
-		//--------------------------------------------------------------------
-
+		USB_NUM_ENDPOINTS,	// Endpoints number
 		0xff,		// Interface class. Custom
 		0xff,		// Interface Subclass. Custom
 		0xff,		// Interface Protocol. Custom
 		0x00,		// iInterface
-		// Interrupt endpoint descriptor
-		0x07,		// Length
-		0x05,		// Descriptor type
-		0x01,		// Address. OUT 1
-		0x03,		// Type. Interrupt
-		int_packet_size, 0x00,		// Max packet size
-		0x03,
-		// Bulk endpoint descriptor
-		0x07,		// Length
-		0x05,		// Descriptor type
-		0x82,		// Address. IN 2
-		0x02,		// Type. Bulk
-		blk_packet_size, 0x00,		// Max packet size
-		0x03,
-		// Isochronous endpoint descriptor
-		0x07,		// Length
-		0x05,		// Descriptor type
-		0x83,		// Address. IN 3
-		0x0D,		// Type. Iso, synchronous with SOF
-		iso_packet_size & 0xff, (iso_packet_size & 0xff00) >> 8,		// Max packet size
-		0x01,		// Interval. 1, request data every frame
+		USB_ENDPOINTS(USB_EP_DESCRIPTOR)
+		// Alternate settings 1..N: same endpoints plus the iso one
+		USB_ISO_ALT_SETTINGS(USB_ALT_DESCRIPTOR)
 };
+_Static_assert(sizeof(configuration_descriptor) == USB_CONFIG_DESC_LENGTH, "Configuration descriptor length mismatch");
+
+// Endpoints opened by SET_CONFIGURATION, besides endpoint 0
+static const usb_endpoint_t endpoints[] = { USB_ENDPOINTS(USB_EP_ENTRY) };
+// Iso max packet size per alternate setting, 0 for setting 0
+static const uint16_t iso_alt_mps[USB_NUM_ISO_ALTS + 1] = { USB_ISO_ALT_SETTINGS(USB_ALT_MPS_ENTRY) };
+
+// String descriptors. u"" literals are UTF-16, stored little-endian as USB expects.
+// The terminating zero of the literal does not fit the array and is dropped.
+#define STRING_DESCRIPTOR(name, str) \
+	static const struct __attribute__((packed)) { \
+		uint8_t length; \
+		uint8_t type; \
+		uint16_t data[sizeof(str) / 2 - 1]; \
+	} name = { sizeof(str), DESCRIPTOR_STRING, str }
+
+STRING_DESCRIPTOR(string_languages, u"\x0409");	// English (United States)
+STRING_DESCRIPTOR(string_manufacturer, u"STMicroelectronics");
+STRING_DESCRIPTOR(string_product, u"USBExample");
+
+static const void *usb_strings[] = {
+		&string_languages,
+		&string_manufacturer,
+		&string_product,
+		0,		// Serial number, made from the chip unique ID on request
+};
+
+// 24 hex digits of the 96-bit unique ID
+static uint8_t serial_descriptor[2 + 2 * 24];
+
+static uint8_t usb_configuration CCMRAM = 0;
+static uint8_t usb_alt_setting CCMRAM = 0;
+static uint8_t status_buff[2] CCMRAM;
 
-// Control requests used for enumeration
+/*
+ * EP0 control transfer state:
+ *
+ *   SETUP --(IN data)--> DATA_IN --> STATUS_OUT --> IDLE
+ *         --(OUT data)-> DATA_OUT --> STATUS_IN --> IDLE
+ *         --(no data)--------------> STATUS_IN --> IDLE
+ *         --(vendor OUT)-> [DATA_OUT] --> COMMAND --> STATUS_IN --> IDLE
+ *         --(error)----> STALL (until the next SETUP)
+ *
+ * The SETUP event only starts a stage, everything else is driven from
+ * the DataIn/DataOut completion events. The core accepts a SETUP
+ * packet in any state: a new SETUP aborts the current transfer and starts over.
+ *
+ * The HAL callbacks at the end of the file are the top half: they record
+ * events, which the bottom half handles in PendSV (usb_event.h). All the
+ * state below belongs to the bottom half, except for the two counters.
+ */
+typedef enum {
+	CTRL_IDLE,
+	CTRL_DATA_IN,		// Sending the data stage
+	CTRL_DATA_OUT,		// Receiving the data stage
+	CTRL_STATUS_IN,		// ZLP to the host queued
+	CTRL_STATUS_OUT,	// Waiting for the ZLP from the host
+	CTRL_COMMAND,		// Vendor OUT request with the command task
+	CTRL_STALL,
+} ctrl_state_t;
+
+static ctrl_state_t ctrl_state CCMRAM;
+
+// Set by the bottom half for each packet handed to the core on EP0 IN,
+// cleared by the top half when the completion or a new SETUP comes in.
+// A completion of an aborted packet that shows up after the SETUP is dropped.
+static volatile uint8_t ep0_in_armed CCMRAM;
+// SETUP packets recorded and handled. EP0 events still pending
+// while a newer SETUP waits belong to the aborted transfer.
+static volatile uint8_t setups_posted CCMRAM;
+static uint8_t setups_handled CCMRAM;
+
+// Rest of the current EP0 data stage. The core moves one packet per
+// HAL_PCD_EP_Transmit/Receive on EP0, the others follow from the
+// DataIn/DataOut stage callbacks.
+static const uint8_t *ctrl_tx_data CCMRAM;
+static uint16_t ctrl_tx_left CCMRAM;
+static uint8_t ctrl_tx_zlp CCMRAM;
+
+// Vendor OUT data stages are collected here, up to CTRL_BUFF_SIZE bytes.
+// The spare packet at the end takes whatever a misbehaving host sends past wLength:
+// the core always accepts a full packet on EP0.
+#define CTRL_BUFF_SIZE 4096
+static uint8_t ctrl_buff[CTRL_BUFF_SIZE + USB_EP0_SIZE] __attribute__((aligned(4))) CCMRAM;
+static uint16_t ctrl_rx_length CCMRAM;	// wLength of the OUT data stage
+static uint16_t ctrl_rx_count CCMRAM;
+static uint8_t ctrl_rx_request CCMRAM;
+static uint16_t ctrl_rx_value CCMRAM;
+static uint16_t ctrl_data_length CCMRAM;	// Length of the last completed upload
+
+// Copies sent to the host, the live blocks keep counting during the data stage
+static irq_stats_t irq_stats_buff CCMRAM;
+static usb_stats_t usb_stats_buff CCMRAM;
+static sched_stats_t sched_stats_buff CCMRAM;
+static pattern_status_t pattern_status_buff CCMRAM;
+
+// Request types (bmRequestType)
 #define STANDARD 0x80
+#define STANDARD_OUT 0x00
+#define STANDARD_INTERFACE 0x81
+#define STANDARD_INTERFACE_OUT 0x01
+#define STANDARD_ENDPOINT 0x82
+#define STANDARD_ENDPOINT_OUT 0x02
+#define REQUEST_TYPE_MASK 0x60
+
+// Standard requests (bRequest)
+#define GET_STATUS 0
+#define CLEAR_FEATURE 1
+#define SET_FEATURE 3
+#define SET_ADDRESS 5
 #define GET_DESCRIPTOR 6
-#define DESCRIPTOR_DEVICE 1
-#define DESCRIPTOR_DEVICE_QUALIFIER 6
-#define DESCRIPTOR_CONFIGURATION 2
+#define GET_CONFIGURATION 8
 #define SET_CONFIGURATION 9
-#define SET_ADDRESS 5
+#define GET_INTERFACE 10
+#define SET_INTERFACE 11
+
+// Feature selectors
+#define FEATURE_ENDPOINT_HALT 0
 
 // Custom control requests
 #define CLASS_INPUT 0xC0
 #define CLASS_OUTPUT 0x40
 
+// Vendor requests (bRequest)
+#define VENDOR_IRQ_STATS 0x10		// IN: irq_stats_t, wValue bit 0 clears it after the copy
+#define VENDOR_USB_STATS 0x11		// IN: usb_stats_t, wValue bit 0 clears it after the copy
+#define VENDOR_READ_BACK 0x12		// IN: data of the last vendor OUT request
+#define VENDOR_SCHED_STATS 0x13		// IN: sched_stats_t, wValue bit 0 clears it after the copy
+#define VENDOR_PATTERN_STATUS 0x14	// IN: pattern_status_t
+// Vendor OUT requests are listed in command.h
+
+
+// Makes the current control transfer fail. The core clears
+// the stall on endpoint 0 by itself when the next SETUP arrives.
+static void ctrl_stall(PCD_HandleTypeDef *hpcd) {
+	ctrl_state = CTRL_STALL;
+	HAL_PCD_EP_SetStall(hpcd, 0x80);
+	HAL_PCD_EP_SetStall(hpcd, 0x00);
+}
+
+// Ends a request without data stage, or an OUT data stage: ZLP to the host
+static void ctrl_status(PCD_HandleTypeDef *hpcd) {
+	ctrl_state = CTRL_STATUS_IN;
+	ep0_in_armed = 1;
+	HAL_PCD_EP_Transmit(hpcd, 0x00, 0, 0);
+}
+
+// Sends the next packet of the EP0 data stage
+static void ctrl_send_next(PCD_HandleTypeDef *hpcd) {
+	uint16_t length = ctrl_tx_left > USB_EP0_SIZE ? USB_EP0_SIZE : ctrl_tx_left;
+	const uint8_t *data = ctrl_tx_data;
+
+	ctrl_tx_data += length;
+	ctrl_tx_left -= length;
+	if (length == 0) ctrl_tx_zlp = 0;
+	ep0_in_armed = 1;
+	// The HAL only reads from the buffer, descriptors can stay in flash
+	HAL_PCD_EP_Transmit(hpcd, 0x00, (uint8_t*)data, length);
+}
+
+// Sends a data stage, never longer than the host asked for
+static void ctrl_send(PCD_HandleTypeDef *hpcd, const uint8_t *data, uint16_t length, uint16_t requested_length) {
+	if (requested_length < length) length = requested_length;
+	ctrl_state = CTRL_DATA_IN;
+	ctrl_tx_data = data;
+	ctrl_tx_left = length;
+	// A short answer ending on a packet boundary needs a ZLP to end the data stage
+	ctrl_tx_zlp = length < requested_length && length % USB_EP0_SIZE == 0 && length != 0;
+	ctrl_send_next(hpcd);
+}
+
+// Starts receiving an OUT data stage of length bytes into ctrl_buff
+static void ctrl_receive(PCD_HandleTypeDef *hpcd, uint8_t request, uint16_t value, uint16_t length) {
+	ctrl_rx_request = request;
+	ctrl_rx_value = value;
+	ctrl_rx_length = length;
+	ctrl_rx_count = 0;
+	ctrl_state = CTRL_DATA_OUT;
+	HAL_PCD_EP_Receive(hpcd, 0x00, ctrl_buff, length > USB_EP0_SIZE ? USB_EP0_SIZE : length);
+}
+
+// Hands a complete vendor OUT request to the command task. The status
+// stage waits for usb_command_done, so the host sees the request complete
+// only after the command ran.
+static void handle_vendor_data(uint8_t request, uint16_t value, const uint8_t *data, uint16_t length) {
+	ctrl_data_length = length;
+	ctrl_state = CTRL_COMMAND;
+	command_post(request, value, data, length, setups_handled);
+}
+
+// Packet of the OUT data stage received
+static void ctrl_data_out_done(PCD_HandleTypeDef *hpcd, uint16_t count) {
+	ctrl_rx_count += count;
+	// The data stage ends with the announced length or a short packet
+	if (ctrl_rx_count < ctrl_rx_length && count == USB_EP0_SIZE) {
+		uint16_t left = ctrl_rx_length - ctrl_rx_count;
+		HAL_PCD_EP_Receive(hpcd, 0x00, ctrl_buff + ctrl_rx_count, left > USB_EP0_SIZE ? USB_EP0_SIZE : left);
+		return;
+	}
+	if (ctrl_rx_count > ctrl_rx_length) ctrl_rx_count = ctrl_rx_length;
+	handle_vendor_data(ctrl_rx_request, ctrl_rx_value, ctrl_buff, ctrl_rx_count);
+}
+
+// Packet of the IN data stage sent
+static void ctrl_data_in_done(PCD_HandleTypeDef *hpcd) {
+	if (ctrl_tx_left || ctrl_tx_zlp) {
+		ctrl_send_next(hpcd);
+		return;
+	}
+	ctrl_state = CTRL_STATUS_OUT;
+	HAL_PCD_EP_Receive(hpcd, 0x00, 0, 0);
+}
+
+// Transfer finished: be ready for the next SETUP
+static void ctrl_idle(PCD_HandleTypeDef *hpcd) {
+	ctrl_state = CTRL_IDLE;
+	USB_EP0_OutStart(hpcd->Instance, (uint8_t)hpcd->Init.dma_enable, (uint8_t*)hpcd->Setup);
+}
 
-void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd) {
-	printf("In Reset handler\n");
+static int is_endpoint_valid(uint8_t ep_addr) {
+	if ((ep_addr & 0x7F) == 0) return 1;
+	if (!usb_configuration) return 0;
+	if (ep_addr == USB_ISO_EP) return usb_alt_setting != 0;
+	for (int i = 0; i < USB_NUM_ENDPOINTS; i++) {
+		if (endpoints[i].addr == ep_addr) return 1;
+	}
+	return 0;
+}
+
+static PCD_EPTypeDef* get_endpoint(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	if (ep_addr & 0x80) return &hpcd->IN_ep[ep_addr & 0x0F];
+	return &hpcd->OUT_ep[ep_addr & 0x0F];
+}
+
+static void open_endpoints(PCD_HandleTypeDef *hpcd) {
+	for (int i = 0; i < USB_NUM_ENDPOINTS; i++) {
+		HAL_PCD_EP_Flush(hpcd, endpoints[i].addr);
+		HAL_PCD_EP_Open(hpcd, endpoints[i].addr, endpoints[i].mps, endpoints[i].type);
+	}
+}
+
+// Selects the iso packet size of the alternate setting. The iso Tx FIFO
+// is the last one, so it can be resized without moving the others.
+static void set_alt_setting(PCD_HandleTypeDef *hpcd, uint8_t alt) {
+	if (usb_alt_setting) {
+		HAL_PCD_EP_Close(hpcd, USB_ISO_EP);
+		HAL_PCD_EP_Flush(hpcd, USB_ISO_EP);
+		usb_queue_flush(USB_ISO_EP);
+	}
+	usb_alt_setting = alt;
+	if (!alt) return;
+
+	HAL_PCDEx_SetTxFiFo(hpcd, USB_ISO_EP & 0x0F, USB_FIFO_ISO_WORDS(iso_alt_mps[alt]));
+	HAL_PCD_EP_Flush(hpcd, USB_ISO_EP);
+	HAL_PCD_EP_Open(hpcd, USB_ISO_EP, iso_alt_mps[alt], EP_TYPE_ISOC);
+}
+
+static void close_endpoints(PCD_HandleTypeDef *hpcd) {
+	set_alt_setting(hpcd, 0);
+	for (int i = 0; i < USB_NUM_ENDPOINTS; i++) {
+		HAL_PCD_EP_Close(hpcd, endpoints[i].addr);
+		HAL_PCD_EP_Flush(hpcd, endpoints[i].addr);
+		usb_queue_flush(endpoints[i].addr);
+	}
+}
+
+// Returns the string descriptor for the index, or 0 if there is none
+static const uint8_t* get_string_descriptor(uint8_t index) {
+	if (index >= sizeof(usb_strings) / sizeof(usb_strings[0])) return 0;
+	if (usb_strings[index]) return usb_strings[index];
+
+	uint32_t uid[3] = { HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2() };
+	serial_descriptor[0] = sizeof(serial_descriptor);
+	serial_descriptor[1] = DESCRIPTOR_STRING;
+	for (int i = 0; i < 24; i++) {
+		uint8_t nibble = (uid[i / 8] >> (28 - 4 * (i % 8))) & 0x0F;
+		serial_descriptor[2 + 2 * i] = nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
+		serial_descriptor[3 + 2 * i] = 0;
+	}
+	return serial_descriptor;
+}
+
+
+static void handle_reset(PCD_HandleTypeDef *hpcd) {
+	fmt_printf("In Reset handler\n");
 	// Open OUT endpoint 0
 	HAL_PCD_EP_Flush(&hpcd_USB_OTG_FS, 0x00);
-	HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x00, 64, 0);
+	HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x00, USB_EP0_SIZE, EP_TYPE_CTRL);
 
 	// Open IN endpoint 0
 	HAL_PCD_EP_Flush(&hpcd_USB_OTG_FS, 0x80);
-	HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x80, 64, 0);
-	((uint16_t*)configuration_descriptor)[1] = sizeof(configuration_descriptor);
+	HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x80, USB_EP0_SIZE, EP_TYPE_CTRL);
+
+	usb_stats_bus_reset();
+	// The core has deactivated all data endpoints, nothing queued will complete
+	for (int i = 0; i < USB_NUM_ENDPOINTS; i++) {
+		usb_queue_flush(endpoints[i].addr);
+	}
+	usb_queue_flush(USB_ISO_EP);
+	usb_configuration = 0;
+	usb_alt_setting = 0;
+	ctrl_tx_left = 0;
+	ctrl_tx_zlp = 0;
+	ctrl_state = CTRL_IDLE;
 }
 
 
+// Chapter 9 requests. Anything not supported is answered with a STALL,
+// so the host moves on instead of waiting for a timeout.
+static void handle_standard_request(PCD_HandleTypeDef *hpcd, uint8_t request_type, uint8_t request,
+		uint16_t value, uint16_t index, uint16_t requested_length) {
+	uint8_t descriptor_type = value >> 8;
+	uint8_t descriptor_index = value & 0xff;
+	PCD_EPTypeDef *ep;
+	const uint8_t *descriptor;
+
+	if (request_type == STANDARD && request == GET_DESCRIPTOR && descriptor_type == DESCRIPTOR_DEVICE) {
+		ctrl_send(hpcd, device_descriptor, sizeof(device_descriptor), requested_length);
+	} else if (request_type == STANDARD && request == GET_DESCRIPTOR && descriptor_type == DESCRIPTOR_DEVICE_QUALIFIER) {
+		// Full-speed only device, the qualifier must be refused
+		fmt_printf("Ignoring qualifier descriptor\n");
+		ctrl_stall(hpcd);
+	} else if (request_type == STANDARD && request == GET_DESCRIPTOR && descriptor_type == DESCRIPTOR_CONFIGURATION) {
+		fmt_printf("Sending configuration descriptor\n");
+		ctrl_send(hpcd, configuration_descriptor, sizeof(configuration_descriptor), requested_length);
+	} else if (request_type == STANDARD && request == GET_DESCRIPTOR && descriptor_type == DESCRIPTOR_STRING) {
+		descriptor = get_string_descriptor(descriptor_index);
+		if (descriptor) ctrl_send(hpcd, descriptor, descriptor[0], requested_length);
+		else ctrl_stall(hpcd);
+	} else if (request_type == STANDARD_OUT && request == SET_ADDRESS) {
+		fmt_printf("Setting address: %i\n", value & 0x7f);
+		HAL_PCD_SetAddress(hpcd, value & 0x7f);
+		ctrl_status(hpcd);
+	} else if (request_type == STANDARD && request == GET_CONFIGURATION) {
+		status_buff[0] = usb_configuration;
+		ctrl_send(hpcd, status_buff, 1, requested_length);
+	} else if (request_type == STANDARD_OUT && request == SET_CONFIGURATION) {
+		fmt_printf("Setting configuration, %i\n", value);
+		if (value > 1) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		if (usb_configuration) close_endpoints(hpcd);
+		usb_configuration = value;
+		if (usb_configuration) open_endpoints(hpcd);
+
+		ctrl_status(hpcd);
+	} else if (request_type == STANDARD_INTERFACE && request == GET_INTERFACE) {
+		if (!usb_configuration || index != 0) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		status_buff[0] = usb_alt_setting;
+		ctrl_send(hpcd, status_buff, 1, requested_length);
+	} else if (request_type == STANDARD_INTERFACE_OUT && request == SET_INTERFACE) {
+		if (!usb_configuration || index != 0 || value > USB_NUM_ISO_ALTS) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		fmt_printf("Setting alternate setting %i, iso packet %i\n", value, iso_alt_mps[value]);
+		set_alt_setting(hpcd, value);
+		ctrl_status(hpcd);
+	} else if (request == GET_STATUS && (request_type == STANDARD || request_type == STANDARD_INTERFACE)) {
+		if (request_type == STANDARD_INTERFACE && (!usb_configuration || index != 0)) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		// Device: bit 0 is SELF-POWERED, as in the configuration attributes
+		status_buff[0] = request_type == STANDARD ? 0x01 : 0x00;
+		status_buff[1] = 0;
+		ctrl_send(hpcd, status_buff, 2, requested_length);
+	} else if (request == GET_STATUS && request_type == STANDARD_ENDPOINT) {
+		if (!is_endpoint_valid(index)) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		ep = get_endpoint(hpcd, index);
+		status_buff[0] = ep->is_stall ? 0x01 : 0x00;	// HALT
+		status_buff[1] = 0;
+		ctrl_send(hpcd, status_buff, 2, requested_length);
+	} else if ((request == CLEAR_FEATURE || request == SET_FEATURE) && request_type == STANDARD_ENDPOINT_OUT) {
+		if (value != FEATURE_ENDPOINT_HALT || !is_endpoint_valid(index)) {
+			ctrl_stall(hpcd);
+			return;
+		}
+		fmt_printf("%s halt on ep 0x%02X\n", request == SET_FEATURE ? "Setting" : "Clearing", index);
+		// Endpoint 0 cannot be halted, the request is only acknowledged
+		if ((index & 0x7f) != 0) {
+			if (request == SET_FEATURE) HAL_PCD_EP_SetStall(hpcd, index);
+			else HAL_PCD_EP_ClrStall(hpcd, index);
+		}
+		ctrl_status(hpcd);
+	} else {
+		fmt_printf("Unsupported standard request\n");
+		ctrl_stall(hpcd);
+	}
+}
+
 // Handles enumeration process, reacts to custom control requests
-void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd) {
-	printf("Setup stage\n");
+static void handle_setup(PCD_HandleTypeDef *hpcd, const uint8_t *setup) {
+	fmt_printf("Setup stage\n");
 	for (int i = 0; i < 8; i++) {
-		printf("0x%02X ", ((uint8_t*)hpcd->Setup)[i]);
+		fmt_printf("0x%02X ", setup[i]);
 	}
-	printf("\n");
+	fmt_printf("\n");
 
-	uint8_t request_type = ((uint8_t*)hpcd->Setup)[0];
-	uint8_t request = ((uint8_t*)hpcd->Setup)[1];
-	uint8_t data1 = ((uint8_t*)hpcd->Setup)[2];
-	uint8_t data2 = ((uint8_t*)hpcd->Setup)[3];
-	uint8_t requested_length = ((uint16_t*)hpcd->Setup)[3];
+	uint8_t request_type = setup[0];
+	uint8_t request = setup[1];
+	uint8_t data1 = setup[2];
+	uint16_t value = setup[2] | setup[3] << 8;
+	uint16_t index = setup[4] | setup[5] << 8;
+	uint16_t requested_length = setup[6] | setup[7] << 8;
 
-	if (request_type == STANDARD && request == GET_DESCRIPTOR && data2 == DESCRIPTOR_DEVICE) {
-		HAL_PCD_EP_Transmit(hpcd, 0x00, device_descriptor, sizeof(device_descriptor));
-	} else if (request_type == STANDARD && request == GET_DESCRIPTOR && data2 == DESCRIPTOR_DEVICE_QUALIFIER) {
-		printf("Sending configuration descriptor\n");
-		HAL_PCD_EP_Transmit(hpcd, 0x00, 0, 0);
-	} else if (request_type == STANDARD && request == GET_DESCRIPTOR && data2 == DESCRIPTOR_CONFIGURATION) {
-		printf("Ignoring qualifier descriptor\n");
+	setups_handled++;
+	// A new SETUP aborts whatever was left of the previous transfer.
+	// A packet still waiting in the Tx FIFO would go out as the first one of the answer,
+	// and a pending completion of the old packet would advance the new transfer.
+	if (ctrl_state == CTRL_DATA_IN || ctrl_state == CTRL_STATUS_IN) {
+		uint32_t USBx_BASE = (uint32_t)hpcd->Instance;	// Used by USBx_INEP
 
-		if (requested_length > sizeof(configuration_descriptor)) requested_length = sizeof(configuration_descriptor);
+		HAL_PCD_EP_Abort(hpcd, 0x80);
+		HAL_PCD_EP_Flush(hpcd, 0x80);
+		USBx_INEP(0)->DIEPINT = USB_OTG_DIEPINT_XFRC;
+	}
+	ctrl_state = CTRL_IDLE;
+	ctrl_tx_left = 0;
+	ctrl_tx_zlp = 0;
 
-		HAL_PCD_EP_Transmit(hpcd, 0x00, configuration_descriptor, requested_length);
-	} else if (request == SET_ADDRESS) {
-		printf("Setting address: %i\n", data1);
-		HAL_PCD_SetAddress(hpcd, data1);
-		HAL_PCD_EP_Transmit(hpcd, 0, 0, 0);
-	} else if (request == SET_CONFIGURATION) {
-		printf("Setting configuration, %i\n", data1);
+	if ((request_type & REQUEST_TYPE_MASK) == 0) {
+		handle_standard_request(hpcd, request_type, request, value, index, requested_length);
+	} else if (request_type == CLASS_INPUT && request == VENDOR_IRQ_STATS) {
+		irq_stats_snapshot(&irq_stats_buff, value & 1);
+		ctrl_send(hpcd, (const uint8_t*)&irq_stats_buff, sizeof(irq_stats_buff), requested_length);
+	} else if (request_type == CLASS_INPUT && request == VENDOR_USB_STATS) {
+		usb_stats_snapshot(&usb_stats_buff, value & 1);
+		ctrl_send(hpcd, (const uint8_t*)&usb_stats_buff, sizeof(usb_stats_buff), requested_length);
+	} else if (request_type == CLASS_INPUT && request == VENDOR_READ_BACK) {
+		ctrl_send(hpcd, ctrl_buff, ctrl_data_length, requested_length);
+	} else if (request_type == CLASS_INPUT && request == VENDOR_SCHED_STATS) {
+		sched_stats_snapshot(&sched_stats_buff, value & 1);
+		ctrl_send(hpcd, (const uint8_t*)&sched_stats_buff, sizeof(sched_stats_buff), requested_length);
+	} else if (request_type == CLASS_INPUT && request == VENDOR_PATTERN_STATUS) {
+		pattern_status(&pattern_status_buff);
+		ctrl_send(hpcd, (const uint8_t*)&pattern_status_buff, sizeof(pattern_status_buff), requested_length);
+	} else if (request_type == CLASS_OUTPUT && requested_length <= CTRL_BUFF_SIZE) {
+		fmt_printf("Control OUT request with value %i, %i bytes\n", data1, requested_length);
+		if (requested_length) {
+			ctrl_receive(hpcd, request, value, requested_length);
+		} else {
+			// No data stage: straight to the command
+			handle_vendor_data(request, value, ctrl_buff, 0);
+		}
+	} else {
+		ctrl_stall(hpcd);
+	}
+}
 
-		HAL_PCD_EP_Flush(&hpcd_USB_OTG_FS, 0x01);
-		HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x01, int_packet_size, EP_TYPE_INTR);
-		HAL_PCD_EP_Flush(&hpcd_USB_OTG_FS, 0x82);
-		HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x82, blk_packet_size, EP_TYPE_BULK);
-		HAL_PCD_EP_Flush(&hpcd_USB_OTG_FS, 0x83);
-		HAL_PCD_EP_Open(&hpcd_USB_OTG_FS, 0x83, iso_packet_size, EP_TYPE_ISOC);
+// EP0 completion recorded before a newer SETUP: the transfer it belongs to is gone
+static int is_ep0_event_stale(void) {
+	return setups_handled != setups_posted;
+}
 
-		HAL_PCD_EP_Transmit(hpcd, 0, 0, 0);
-	}
-	if (request_type == CLASS_INPUT) {
-		printf("Control IN request\n");
-		sprintf((char*)usb_buff, "Hi!\n");
-		if (requested_length > strlen((char*)usb_buff)) requested_length = strlen((char*)usb_buff);
+// Bottom half, runs in PendSV with the top half masked
+void usb_handle_event(const usb_event_t *event) {
+	PCD_HandleTypeDef *hpcd = &hpcd_USB_OTG_FS;
 
-		HAL_PCD_EP_Transmit(hpcd, 0, usb_buff, requested_length);
-	} else if (request_type == CLASS_OUTPUT) {
-		is_ctrl_receive_pending = 1;
-		HAL_PCD_EP_Receive(hpcd, 0, usb_buff, requested_length);
-		printf("Control OUT request with value %i\n", data1);
-		HAL_PCD_EP_Transmit(hpcd, 0, 0, 0);
+	switch (event->type) {
+	case USB_EVENT_RESET:
+		handle_reset(hpcd);
+		break;
+	case USB_EVENT_SETUP:
+		handle_setup(hpcd, event->setup);
+		break;
+	case USB_EVENT_DATA_OUT:
+		if (is_ep0_event_stale()) break;
+		fmt_printf("Data OUT stage, ep 0\n");
+		if (ctrl_state == CTRL_DATA_OUT) ctrl_data_out_done(hpcd, event->length);
+		// Status ZLP from the host, the HAL has already re-armed EP0 for SETUP
+		else if (ctrl_state == CTRL_STATUS_OUT) ctrl_state = CTRL_IDLE;
+		break;
+	case USB_EVENT_DATA_IN:
+		if (is_ep0_event_stale()) break;
+		fmt_printf("Data IN stage, ep 0\n");
+		if (ctrl_state == CTRL_DATA_IN) ctrl_data_in_done(hpcd);
+		else if (ctrl_state == CTRL_STATUS_IN) ctrl_idle(hpcd);
+		break;
 	}
+}
 
+int usb_is_configured(void) {
+	return usb_configuration != 0;
 }
 
-void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
-	printf("Data OUT stage, ep %i\n", epnum);
-	if (is_ctrl_receive_pending) {
-		is_ctrl_receive_pending = 0;
-		printf("Received CTRL data: %s", usb_buff);
-	}
+uint16_t usb_iso_packet_size(void) {
+	return iso_alt_mps[usb_alt_setting];
 }
-void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
-	printf("Data IN stage, ep %i\n", epnum);
-	if (epnum == 0) {
-		HAL_PCD_EP_Receive(hpcd, 0x00, 0, 0);
-	}
-	else if (epnum == 2) {
-		printf("INT data IN callback\n");
+
+uint16_t usb_frame(void) {
+	uint32_t USBx_BASE = (uint32_t)USB_OTG_FS;	// Used by USBx_DEVICE
+
+	return (USBx_DEVICE->DSTS & USB_OTG_DSTS_FNSOF) >> USB_OTG_DSTS_FNSOF_Pos;
+}
+
+void usb_command_done(uint8_t tag) {
+	uint32_t key = usb_lock();
+	// A newer SETUP, handled or still pending, has replaced the request
+	if (ctrl_state == CTRL_COMMAND && tag == setups_handled && !is_ep0_event_stale()) {
+		ctrl_status(&hpcd_USB_OTG_FS);
 	}
-	else if (epnum == 2) {
-		printf("BULK data IN callback\n");
+	usb_unlock(key);
+}
+
+/*
+ * Top half: runs in the OTG_FS interrupt, keeps to counters and events.
+ * The data endpoints are re-armed here, their hooks run in PendSV.
+ */
+
+RAMFUNC void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd) {
+	usb_event_t event = { .type = USB_EVENT_RESET };
+
+	ep0_in_armed = 0;
+	usb_event_post(&event);
+}
+
+RAMFUNC void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd) {
+	usb_event_t event = { .type = USB_EVENT_SETUP };
+
+	// The next SETUP overwrites hpcd->Setup, the event keeps a copy
+	memcpy(event.setup, hpcd->Setup, sizeof(event.setup));
+	usb_stats_setup(event.setup[0]);
+	ep0_in_armed = 0;
+	if (usb_event_post(&event)) setups_posted++;
+}
+
+RAMFUNC void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+	usb_stats_transfer(epnum, HAL_PCD_EP_GetRxCount(hpcd, epnum), hpcd->OUT_ep[epnum].maxpacket);
+	if (epnum != 0) {
+		usb_queue_complete(hpcd, epnum);
+		return;
 	}
-	else if (epnum == 3) {
-		printf("ISO data IN callback\n");
+	usb_event_t event = { .type = USB_EVENT_DATA_OUT, .length = HAL_PCD_EP_GetRxCount(hpcd, 0) };
+	usb_event_post(&event);
+}
+
+RAMFUNC void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+	usb_stats_transfer(epnum | 0x80, hpcd->IN_ep[epnum].xfer_count, hpcd->IN_ep[epnum].maxpacket);
+	if (epnum != 0) {
+		usb_queue_complete(hpcd, epnum | 0x80);
+		return;
 	}
+	if (!ep0_in_armed) return;
+	ep0_in_armed = 0;
+	usb_event_t event = { .type = USB_EVENT_DATA_IN, .ep_addr = 0x80 };
+	usb_event_post(&event);
+}
 
+// An iso IN transfer was not taken in its frame: the HAL has disabled the
+// endpoint on IISOIXFR and flushed its Tx FIFO on EPDISD before calling
+// here, so the next transfer starts clean. The queue goes on with it.
+RAMFUNC void HAL_PCD_ISOINIncompleteCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum) {
+	usb_queue_abort(hpcd, epnum | 0x80);
 }
@@ -0,0 +1,67 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "usb_event.h"
+
+_Static_assert((USB_EVENT_RING_SIZE & (USB_EVENT_RING_SIZE - 1)) == 0, "USB_EVENT_RING_SIZE must be a power of 2");
+_Static_assert(USB_EVENT_RING_SIZE <= 128, "Ring indices are 8 bit");
+
+static usb_event_t ring[USB_EVENT_RING_SIZE] CCMRAM;
+// Free running like the usb_queue indices: head only moves in PendSV, tail only in the top half
+static volatile uint8_t head CCMRAM;
+static volatile uint8_t tail CCMRAM;
+static uint32_t overflows CCMRAM;
+static uint32_t max_pending CCMRAM;
+
+RAMFUNC int usb_event_post(const usb_event_t *event) {
+	uint8_t pending = tail - head;
+
+	if (pending == USB_EVENT_RING_SIZE) {
+		overflows++;
+		return 0;
+	}
+	ring[tail % USB_EVENT_RING_SIZE] = *event;
+	// The entry has to be complete before PendSV can see it
+	__DMB();
+	tail++;
+	if (pending + 1U > max_pending) max_pending = pending + 1U;
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	return 1;
+}
+
+uint32_t usb_lock(void) {
+	uint32_t basepri = __get_BASEPRI();
+	// Sampling interrupts above IRQ_PRIORITY_USB stay enabled
+	__set_BASEPRI(IRQ_PRIORITY_USB << (8U - __NVIC_PRIO_BITS));
+	return basepri;
+}
+
+void usb_unlock(uint32_t key) {
+	__set_BASEPRI(key);
+}
+
+void usb_event_run(void) {
+	while (head != tail) {
+		usb_event_t *event = &ring[head % USB_EVENT_RING_SIZE];
+
+		if (event->type == USB_EVENT_XFER_DONE) {
+			// The hooks only touch the queues under PRIMASK, no lock needed
+			event->done(event->ep_addr, event->buff, event->length, event->status);
+		} else {
+			// The HAL PCD is not reentrant: keep the top half out while calling it
+			uint32_t key = usb_lock();
+			usb_handle_event(event);
+			usb_unlock(key);
+		}
+		// Free the entry only after it has been used
+		__DMB();
+		head++;
+	}
+}
+
+uint32_t usb_event_overflows(void) {
+	return overflows;
+}
+
+uint32_t usb_event_max_pending(void) {
+	return max_pending;
+}
@@ -0,0 +1,97 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "usb_pool.h"
+
+_Static_assert(USB_POOL_BLOCK_SIZE % 4 == 0, "Blocks must be whole words for the FIFO burst copy");
+_Static_assert(USB_POOL_BLOCKS <= 255, "Block indices are 8 bit");
+
+// In SRAM, not CCM: keeps the blocks usable for DMA
+static uint8_t blocks[USB_POOL_BLOCKS][USB_POOL_BLOCK_SIZE] __attribute__((aligned(4)));
+
+// Stack of free block indices, filled on the first acquire
+static uint8_t free_list[USB_POOL_BLOCKS] CCMRAM;
+static uint8_t free_count CCMRAM;
+static uint8_t min_free CCMRAM;
+static uint8_t is_initialized CCMRAM;
+// Set from acquire to release, catches a block given back twice
+static uint8_t is_used[USB_POOL_BLOCKS] CCMRAM;
+static uint32_t double_releases CCMRAM;
+
+// Hook of each submitted block, NULL to release it on completion
+static usb_xfer_done_t block_done[USB_POOL_BLOCKS] CCMRAM;
+
+static void init_free_list(void) {
+	for (int i = 0; i < USB_POOL_BLOCKS; i++) {
+		free_list[i] = i;
+	}
+	free_count = USB_POOL_BLOCKS;
+	min_free = USB_POOL_BLOCKS;
+	is_initialized = 1;
+}
+
+static int block_index(const uint8_t *block) {
+	uint32_t offset = (uintptr_t)block - (uintptr_t)blocks;
+
+	// Pointers below the pool wrap around to large offsets
+	if (offset >= sizeof(blocks) || offset % USB_POOL_BLOCK_SIZE) return -1;
+	return offset / USB_POOL_BLOCK_SIZE;
+}
+
+RAMFUNC uint8_t *usb_pool_acquire(void) {
+	uint8_t *block = NULL;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (!is_initialized) init_free_list();
+	if (free_count) {
+		uint8_t index = free_list[--free_count];
+		is_used[index] = 1;
+		block = blocks[index];
+		if (free_count < min_free) min_free = free_count;
+	}
+	__set_PRIMASK(primask);
+	return block;
+}
+
+RAMFUNC void usb_pool_release(uint8_t *block) {
+	int index = block_index(block);
+
+	if (index < 0) return;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (is_used[index]) {
+		is_used[index] = 0;
+		free_list[free_count++] = index;
+	} else {
+		// Already free: pushing it again would hand it to two owners
+		double_releases++;
+	}
+	__set_PRIMASK(primask);
+}
+
+// Completion hook of every pool transfer
+RAMFUNC static void pool_xfer_done(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status) {
+	usb_xfer_done_t done = block_done[block_index(buff)];
+
+	if (done) done(ep_addr, buff, length, status);
+	else usb_pool_release(buff);
+}
+
+HAL_StatusTypeDef usb_pool_submit(uint8_t ep_addr, uint8_t *block, uint32_t length, usb_xfer_done_t done) {
+	int index = block_index(block);
+
+	if (index < 0 || length > USB_POOL_BLOCK_SIZE) return HAL_ERROR;
+	block_done[index] = done;
+	return usb_queue_submit(ep_addr, block, length, pool_xfer_done);
+}
+
+uint32_t usb_pool_free(void) {
+	return is_initialized ? free_count : USB_POOL_BLOCKS;
+}
+
+uint32_t usb_pool_min_free(void) {
+	return is_initialized ? min_free : USB_POOL_BLOCKS;
+}
+
+uint32_t usb_pool_double_releases(void) {
+	return double_releases;
+}
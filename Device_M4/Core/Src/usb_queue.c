@@ -0,0 +1,126 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "usb_queue.h"
+#include "usb_event.h"
+
+_Static_assert((USB_QUEUE_DEPTH & (USB_QUEUE_DEPTH - 1)) == 0, "USB_QUEUE_DEPTH must be a power of 2");
+_Static_assert(USB_QUEUE_DEPTH <= 128, "Queue indices are 8 bit");
+
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+typedef struct {
+	uint8_t *buff;
+	uint32_t length;
+	usb_xfer_done_t done;
+} usb_xfer_t;
+
+// head and tail run freely, tail - head is the number of queued transfers
+typedef struct {
+	usb_xfer_t xfer[USB_QUEUE_DEPTH];
+	uint8_t head;	// Transfer in flight, or the next one to start
+	uint8_t tail;	// Next free entry
+	uint8_t busy;	// head has been handed to the HAL
+} usb_queue_t;
+
+// Indexed by direction (0 OUT, 1 IN) and endpoint number
+static usb_queue_t queues[2][USB_MAX_EP_NUM + 1] CCMRAM;
+
+static usb_queue_t *get_queue(uint8_t ep_addr) {
+	uint8_t num = ep_addr & 0x0F;
+
+	if (num == 0 || num > USB_MAX_EP_NUM) return NULL;
+	return &queues[ep_addr >> 7][num];
+}
+
+// Hands the transfer at head to the HAL
+static void start_next(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, usb_queue_t *queue) {
+	usb_xfer_t *xfer = &queue->xfer[queue->head % USB_QUEUE_DEPTH];
+
+	queue->busy = 1;
+	if (ep_addr & 0x80) HAL_PCD_EP_Transmit(hpcd, ep_addr, xfer->buff, xfer->length);
+	else HAL_PCD_EP_Receive(hpcd, ep_addr, xfer->buff, xfer->length);
+}
+
+HAL_StatusTypeDef usb_queue_submit(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_done_t done) {
+	usb_queue_t *queue = get_queue(ep_addr);
+	HAL_StatusTypeDef status = HAL_OK;
+
+	if (!queue) return HAL_ERROR;
+
+	// The interrupt advances head and may start transfers itself
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if ((uint8_t)(queue->tail - queue->head) == USB_QUEUE_DEPTH) {
+		status = HAL_BUSY;
+	} else {
+		queue->xfer[queue->tail % USB_QUEUE_DEPTH] = (usb_xfer_t){ buff, length, done };
+		queue->tail++;
+		if (!queue->busy) start_next(&hpcd_USB_OTG_FS, ep_addr, queue);
+	}
+	__set_PRIMASK(primask);
+	return status;
+}
+
+uint32_t usb_queue_space(uint8_t ep_addr) {
+	usb_queue_t *queue = get_queue(ep_addr);
+
+	if (!queue) return 0;
+	return USB_QUEUE_DEPTH - (uint8_t)(queue->tail - queue->head);
+}
+
+// Ends the transfer at head, re-arms the endpoint and passes the finished one to PendSV
+RAMFUNC static void finish_head(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, usb_queue_t *queue,
+		uint32_t length, usb_xfer_status_t status) {
+	// Copy first: once head moves on, a producer may reuse the entry
+	usb_xfer_t xfer = queue->xfer[queue->head % USB_QUEUE_DEPTH];
+
+	queue->head++;
+	queue->busy = 0;
+	// Re-arm the endpoint before running the hook
+	if (queue->tail != queue->head) start_next(hpcd, ep_addr, queue);
+
+	if (!xfer.done) return;
+	usb_event_t event = {
+			.type = USB_EVENT_XFER_DONE, .ep_addr = ep_addr, .status = status,
+			.length = length, .buff = xfer.buff, .done = xfer.done };
+	// The hook runs in PendSV. With the ring full, run it here rather than lose the buffer.
+	if (!usb_event_post(&event)) xfer.done(ep_addr, xfer.buff, length, status);
+}
+
+RAMFUNC void usb_queue_complete(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	usb_queue_t *queue = get_queue(ep_addr);
+
+	if (!queue || !queue->busy) return;
+	uint32_t length = ep_addr & 0x80 ? queue->xfer[queue->head % USB_QUEUE_DEPTH].length :
+			HAL_PCD_EP_GetRxCount(hpcd, ep_addr);
+	finish_head(hpcd, ep_addr, queue, length, USB_XFER_DONE);
+}
+
+RAMFUNC void usb_queue_abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	usb_queue_t *queue = get_queue(ep_addr);
+
+	if (!queue || !queue->busy) return;
+	finish_head(hpcd, ep_addr, queue, 0, USB_XFER_MISSED);
+}
+
+void usb_queue_flush(uint8_t ep_addr) {
+	usb_queue_t *queue = get_queue(ep_addr);
+
+	if (!queue) return;
+	while (1) {
+		usb_xfer_t xfer;
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		if (queue->tail == queue->head) {
+			queue->busy = 0;
+			__set_PRIMASK(primask);
+			return;
+		}
+		xfer = queue->xfer[queue->head % USB_QUEUE_DEPTH];
+		queue->head++;
+		queue->busy = 0;
+		__set_PRIMASK(primask);
+
+		if (xfer.done) xfer.done(ep_addr, xfer.buff, 0, USB_XFER_CANCELLED);
+	}
+}
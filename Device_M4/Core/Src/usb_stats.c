@@ -0,0 +1,67 @@
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "usb_stats.h"
+
+static usb_stats_t usb_stats CCMRAM;
+
+void usb_stats_reset(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	usb_stats = (usb_stats_t){ 0 };
+	__set_PRIMASK(primask);
+}
+
+RAMFUNC void usb_stats_irq(uint32_t gintsts) {
+	uint32_t USBx_BASE = (uint32_t)USB_OTG_FS;	// Used by the USBx_ register macros
+
+	if (gintsts & USB_OTG_GINTSTS_IISOIXFR) usb_stats.iso_in_incomplete++;
+	if (gintsts & USB_OTG_GINTSTS_PXFR_INCOMPISOOUT) usb_stats.iso_out_incomplete++;
+
+	for (int ep = 0; ep < USB_STATS_EPS; ep++) {
+		uint32_t diepint = USBx_INEP(ep)->DIEPINT;
+
+		// Not in DIEPMSK, so the HAL leaves it set: clear it here
+		if (diepint & USB_OTG_DIEPINT_ITTXFE) {
+			usb_stats.in[ep].naks++;
+			USBx_INEP(ep)->DIEPINT = USB_OTG_DIEPINT_ITTXFE;
+		}
+		// TXFE is always set while the FIFO is empty, only count it while unmasked
+		if ((gintsts & USB_OTG_GINTSTS_IEPINT) && (diepint & USB_OTG_DIEPINT_TXFE) &&
+				(USBx_DEVICE->DIEPEMPMSK & (1U << ep))) {
+			usb_stats.in[ep].fifo_empty++;
+		}
+	}
+}
+
+RAMFUNC void usb_stats_transfer(uint8_t ep_addr, uint32_t bytes, uint32_t mps) {
+	if ((ep_addr & 0x0F) >= USB_STATS_EPS) return;
+	usb_ep_stats_t *stat = ep_addr & 0x80 ? &usb_stats.in[ep_addr & 0x0F] : &usb_stats.out[ep_addr & 0x0F];
+
+	stat->transfers++;
+	stat->bytes += bytes;
+	// Packets from the byte count; a ZLP after a full packet is a transfer of its own
+	stat->packets += bytes == 0 ? 1 : (bytes + mps - 1) / mps;
+}
+
+RAMFUNC void usb_stats_setup(uint8_t request_type) {
+	usb_stats.setup[(request_type >> 5) & 0x03]++;
+}
+
+void usb_stats_bus_reset(void) {
+	usb_stats.bus_resets++;
+}
+
+void usb_stats_snapshot(usb_stats_t *dest, int reset) {
+	uint32_t USBx_BASE = (uint32_t)USB_OTG_FS;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*dest = usb_stats;
+	if (reset) usb_stats_reset();
+	__set_PRIMASK(primask);
+
+	dest->version = USB_STATS_VERSION;
+	dest->num_eps = USB_STATS_EPS;
+	dest->ep_entry_size = sizeof(usb_ep_stats_t);
+	dest->reserved = 0;
+	dest->frame = (USBx_DEVICE->DSTS & USB_OTG_DSTS_FNSOF) >> USB_OTG_DSTS_FNSOF_Pos;
+}
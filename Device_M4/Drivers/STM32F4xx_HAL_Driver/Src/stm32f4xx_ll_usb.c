@@ -40,6 +40,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_hal.h"
+#include "usb_fifo_copy.h"
 
 /** @addtogroup STM32F4xx_LL_USB_DRIVER
   * @{
@@ -1001,21 +1002,11 @@ HAL_StatusTypeDef USB_WritePacket(const USB_OTG_GlobalTypeDef *USBx, uint8_t *sr
                                   uint8_t ch_ep_num, uint16_t len, uint8_t dma)
 {
   uint32_t USBx_BASE = (uint32_t)USBx;
-  uint8_t *pSrc = src;
-  uint32_t count32b;
-  uint32_t i;
 
   if (dma == 0U)
   {
-    count32b = ((uint32_t)len + 3U) / 4U;
-    for (i = 0U; i < count32b; i++)
-    {
-      USBx_DFIFO((uint32_t)ch_ep_num) = __UNALIGNED_UINT32_READ(pSrc);
-      pSrc++;
-      pSrc++;
-      pSrc++;
-      pSrc++;
-    }
+    /* Word-aligned buffers are copied in 4-word LDM/STM bursts */
+    usb_fifo_write(&USBx_DFIFO((uint32_t)ch_ep_num), src, len);
   }
 
   return HAL_OK;
@@ -1031,37 +1022,9 @@ HAL_StatusTypeDef USB_WritePacket(const USB_OTG_GlobalTypeDef *USBx, uint8_t *sr
 void *USB_ReadPacket(const USB_OTG_GlobalTypeDef *USBx, uint8_t *dest, uint16_t len)
 {
   uint32_t USBx_BASE = (uint32_t)USBx;
-  uint8_t *pDest = dest;
-  uint32_t pData;
-  uint32_t i;
-  uint32_t count32b = (uint32_t)len >> 2U;
-  uint16_t remaining_bytes = len % 4U;
-
-  for (i = 0U; i < count32b; i++)
-  {
-    __UNALIGNED_UINT32_WRITE(pDest, USBx_DFIFO(0U));
-    pDest++;
-    pDest++;
-    pDest++;
-    pDest++;
-  }
-
-  /* When Number of data is not word aligned, read the remaining byte */
-  if (remaining_bytes != 0U)
-  {
-    i = 0U;
-    __UNALIGNED_UINT32_WRITE(&pData, USBx_DFIFO(0U));
-
-    do
-    {
-      *(uint8_t *)pDest = (uint8_t)(pData >> (8U * (uint8_t)(i)));
-      i++;
-      pDest++;
-      remaining_bytes--;
-    } while (remaining_bytes != 0U);
-  }
 
-  return ((void *)pDest);
+  /* Word-aligned buffers are copied in 4-word LDM/STM bursts */
+  return ((void *)usb_fifo_read(&USBx_DFIFO(0U), dest, len));
 }
 
 /**
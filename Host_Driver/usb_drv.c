@@ -1,12 +1,16 @@
 #include <linux/module.h>
 #include <linux/usb.h>
 #include <linux/slab.h> 
+#include <linux/uaccess.h>
+#include "usb_drv_ioctl.h"
 
 #define VENDOR_ID 0x0483
 #define PRODUCT_ID 0x1255
 #define DEV_FILE_NAME "usbdrv_%d"
 
-#define CTRL_REQ_LEN 4
+// Largest vendor OUT data stage the firmware accepts (CTRL_BUFF_SIZE in usb.c)
+#define CTRL_REQ_MAX_LEN 4096
+#define VENDOR_USB_STATS 0x11
 
 const struct usb_device_id usb_drv_id_table[] = {
     {USB_DEVICE(VENDOR_ID, PRODUCT_ID)},
@@ -15,38 +19,44 @@ const struct usb_device_id usb_drv_id_table[] = {
 
 static struct usb_class_driver usb_drv_class;
 static struct usb_device *usb_drv_device;
+static struct usb_interface *usb_drv_interface;
 static __u8 *usb_buff;
+static struct usb_drv_stats *usb_drv_stats;
 
 int usb_drv_open(struct inode *i, struct file *f) {
     return 0;
 }
 
-ssize_t usb_drv_read (struct file *f, char __user *buff, size_t count, loff_t *offset) {
-    // USB setup request fields
-    __u8 usb_request = 0x00;        // GET STATUS
-    __u16 usb_requesttype = 0xC0;   // TYPE_VENDOR | RECEPIENT_DEVICE
+// Fetches the device counters into usb_drv_stats
+static int usb_drv_get_stats(int clear) {
+    unsigned int ctrlpipe = usb_rcvctrlpipe(usb_drv_device, 0);
+    int ret = usb_control_msg(usb_drv_device, ctrlpipe, VENDOR_USB_STATS, 0xC0, clear ? 1 : 0,
+        0, usb_drv_stats, sizeof(*usb_drv_stats), 1000);
 
-    // Value & Index can be anything
-    __u16 usb_value = 1;
-    __u16 usb_index = 2;
+    if (ret < 0) return ret;
+    if (ret != sizeof(*usb_drv_stats) || usb_drv_stats->version != USB_DRV_STATS_VERSION) {
+        printk("Unexpected statistics block: %d bytes, version %d\n", ret, usb_drv_stats->version);
+        return -EPROTO;
+    }
+    return 0;
+}
 
-    // The host defines length of the response.
-    // Device may send fewer bytes, but it should not send more then requested.
-    int response_len = CTRL_REQ_LEN;
+ssize_t usb_drv_read (struct file *f, char __user *buff, size_t count, loff_t *offset) {
+    // Returns the raw statistics block of the device, see usb_drv_ioctl.h
+    int response_len = sizeof(*usb_drv_stats);
     int ret = 0;
-    
-    unsigned int ctrlpipe = usb_rcvctrlpipe(usb_drv_device, 0);
 
     // Stop reading file if not the first attempt
     if (*offset > 0) return 0;
     printk("Reading device\n");
-    
-    usb_control_msg(usb_drv_device, ctrlpipe, usb_request, usb_requesttype, usb_value, 
-        usb_index, usb_buff, response_len, 1000);
+
+    ret = usb_drv_get_stats(0);
+    if (ret < 0) return ret;
 
     // Copy the response to the user-space buffer,
     // that will be displayed as a result of the read operation.
-    ret = copy_to_user(buff, usb_buff, min((size_t)response_len, count));
+    response_len = min((size_t)response_len, count);
+    if (copy_to_user(buff, usb_drv_stats, response_len)) return -EFAULT;
 
     *offset += response_len;
 
@@ -63,31 +73,61 @@ ssize_t usb_drv_write(struct file *f, const char __user *buff, size_t count, lof
     // Value & Index can be anything
     __u16 usb_value = 1;
     __u16 usb_index = 2;
-    int request_len = CTRL_REQ_LEN;
+    // One request carries the whole write, split into packets by the host controller
+    int request_len = min(count, (size_t)CTRL_REQ_MAX_LEN);
     int ret = 0;
     
     unsigned int ctrlpipe = usb_sndctrlpipe(usb_drv_device, 0);
 
-    printk("Writing to device\n");    
+    printk("Writing %d bytes to device\n", request_len);
 
-    ret = copy_from_user(usb_buff, buff, min((size_t)request_len, count));
-    usb_control_msg(usb_drv_device, ctrlpipe, usb_request, usb_requesttype, usb_value, 
+    if (copy_from_user(usb_buff, buff, request_len)) return -EFAULT;
+    ret = usb_control_msg(usb_drv_device, ctrlpipe, usb_request, usb_requesttype, usb_value, 
         usb_index, usb_buff, request_len, 1000);
+    if (ret < 0) return ret;
     // Number of bytes written. If less than 'count',
     // the function will be called again
-    return count;
+    return request_len;
+}
+
+long usb_drv_ioctl(struct file *f, unsigned int cmd, unsigned long arg) {
+    struct usb_host_interface *alt = usb_drv_interface->cur_altsetting;
+    int setting;
+    int ret;
+
+    switch (cmd) {
+    case USB_DRV_IOC_GET_STATS:
+    case USB_DRV_IOC_GET_CLEAR_STATS:
+        ret = usb_drv_get_stats(cmd == USB_DRV_IOC_GET_CLEAR_STATS);
+        if (ret < 0) return ret;
+        if (copy_to_user((void __user *)arg, usb_drv_stats, sizeof(*usb_drv_stats))) return -EFAULT;
+        return 0;
+    case USB_DRV_IOC_SET_ALT:
+        if (get_user(setting, (int __user *)arg)) return -EFAULT;
+        // Sends SET_INTERFACE, the host reserves only the bandwidth of the new setting
+        ret = usb_set_interface(usb_drv_device, alt->desc.bInterfaceNumber, setting);
+        printk("Setting alternate setting %d: %d\n", setting, ret);
+        return ret;
+    case USB_DRV_IOC_GET_ALT:
+        setting = alt->desc.bAlternateSetting;
+        return put_user(setting, (int __user *)arg);
+    default:
+        return -ENOTTY;
+    }
 }
 
 struct file_operations fops = {
     .open=usb_drv_open,
     .read=usb_drv_read,
-    .write=usb_drv_write
+    .write=usb_drv_write,
+    .unlocked_ioctl=usb_drv_ioctl
 };
 
 int usb_drv_probe (struct usb_interface *intf, const struct usb_device_id *id) {
     int retval = 0;
     printk("Probing device\n");
     usb_drv_device = interface_to_usbdev(intf);
+    usb_drv_interface = intf;
     usb_drv_class.name = DEV_FILE_NAME;
     usb_drv_class.fops = &fops;
     if ((retval = usb_register_dev(intf, &usb_drv_class)) < 0) {
@@ -95,13 +135,16 @@ int usb_drv_probe (struct usb_interface *intf, const struct usb_device_id *id) {
     } else {
         printk("Minor obtained: %d\n", intf->minor);
     }
-    usb_buff = kmalloc(CTRL_REQ_LEN, GFP_KERNEL);
+    usb_buff = kmalloc(CTRL_REQ_MAX_LEN, GFP_KERNEL);
+    // Control transfer buffers must be DMA-capable: no stack, no static data
+    usb_drv_stats = kmalloc(sizeof(*usb_drv_stats), GFP_KERNEL);
     return retval;
 }
 
 void usb_drv_disconnect(struct usb_interface *intf) {
     printk("Disconnecting device\n");
     kfree(usb_buff);
+    kfree(usb_drv_stats);
     usb_deregister_dev(intf, &usb_drv_class);
 }
 
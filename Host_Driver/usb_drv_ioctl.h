@@ -0,0 +1,48 @@
+#ifndef USB_DRV_IOCTL_H
+#define USB_DRV_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define USB_DRV_IOC_MAGIC 'U'
+
+// Selects the alternate setting of interface 0, i.e. the iso packet size.
+// Setting 0 has no iso endpoint and releases the iso bandwidth.
+// The argument points to an int.
+#define USB_DRV_IOC_SET_ALT _IOW(USB_DRV_IOC_MAGIC, 1, int)
+#define USB_DRV_IOC_GET_ALT _IOR(USB_DRV_IOC_MAGIC, 2, int)
+
+// Device-side USB counters, same layout as usb_stats_t in
+// Device_M4/Core/Inc/usb_stats.h. Counters wrap at 2^32.
+#define USB_DRV_STATS_VERSION 1
+#define USB_DRV_STATS_EPS 4
+
+struct usb_drv_ep_stats {
+    __u32 transfers;
+    __u32 packets;
+    __u32 bytes;
+    __u32 naks;         // IN only, lower bound
+    __u32 fifo_empty;   // IN only
+};
+
+struct usb_drv_stats {
+    __u8 version;
+    __u8 num_eps;
+    __u8 ep_entry_size;
+    __u8 reserved;
+    __u32 frame;
+    __u32 bus_resets;
+    __u32 setup[4];     // Standard, class, vendor, reserved
+    __u32 iso_in_incomplete;
+    __u32 iso_out_incomplete;
+    struct usb_drv_ep_stats in[USB_DRV_STATS_EPS];
+    struct usb_drv_ep_stats out[USB_DRV_STATS_EPS];
+};
+
+_Static_assert(sizeof(struct usb_drv_stats) == 36 + 2 * 20 * USB_DRV_STATS_EPS, "Layout differs from the firmware");
+
+// Reads the counters; the second one also clears them on the device
+#define USB_DRV_IOC_GET_STATS _IOR(USB_DRV_IOC_MAGIC, 3, struct usb_drv_stats)
+#define USB_DRV_IOC_GET_CLEAR_STATS _IOR(USB_DRV_IOC_MAGIC, 4, struct usb_drv_stats)
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef __STM32F4xx_HAL_H
+#define __STM32F4xx_HAL_H
+
+/*
+ * Stand-in for the HAL and CMSIS headers when the firmware USB layer is
+ * built on the host. Only what Core/Src uses is here: the PCD types and
+ * calls (implemented by mock_pcd.c), the OTG register bits, and the
+ * Cortex-M core registers and intrinsics, which become plain variables.
+ * Values and field names follow the real headers.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+/* Cortex-M core */
+
+#define __NVIC_PRIO_BITS 4U
+
+typedef struct {
+	volatile uint32_t ICSR;
+} SCB_Type;
+
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+	volatile uint32_t CR;
+} DBGMCU_TypeDef;
+
+extern SCB_Type sim_scb;
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+extern DBGMCU_TypeDef sim_dbgmcu;
+#define SCB (&sim_scb)
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+#define DBGMCU (&sim_dbgmcu)
+
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28U)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0U)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24U)
+#define DBGMCU_CR_DBG_SLEEP (1UL << 0U)
+
+// Interrupt masking: the simulation is single threaded, the masks are
+// only kept so that save/restore pairs behave as on the target
+extern uint32_t sim_primask;
+extern uint32_t sim_basepri;
+
+static inline uint32_t __get_PRIMASK(void) { return sim_primask; }
+static inline void __set_PRIMASK(uint32_t primask) { sim_primask = primask; }
+static inline void __disable_irq(void) { sim_primask = 1; }
+static inline void __enable_irq(void) { sim_primask = 0; }
+static inline uint32_t __get_BASEPRI(void) { return sim_basepri; }
+static inline void __set_BASEPRI(uint32_t basepri) { sim_basepri = basepri; }
+static inline void __DMB(void) { __asm__ volatile("" ::: "memory"); }
+static inline void __DSB(void) { __asm__ volatile("" ::: "memory"); }
+
+// The main loop has nothing to do: the simulation takes over again
+void sim_wfi(void);
+#define __WFI() sim_wfi()
+
+// SWO output
+uint32_t ITM_SendChar(uint32_t ch);
+
+/* System */
+
+uint32_t HAL_GetUIDw0(void);
+uint32_t HAL_GetUIDw1(void);
+uint32_t HAL_GetUIDw2(void);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+
+/* OTG_FS registers */
+
+typedef struct {
+	volatile uint32_t GINTSTS;
+	volatile uint32_t GINTMSK;
+} USB_OTG_GlobalTypeDef;
+
+typedef struct {
+	volatile uint32_t DSTS;
+	volatile uint32_t DIEPEMPMSK;
+} USB_OTG_DeviceTypeDef;
+
+typedef struct {
+	volatile uint32_t DIEPCTL;
+	volatile uint32_t DIEPINT;
+	volatile uint32_t DIEPTSIZ;
+	volatile uint32_t DTXFSTS;
+} USB_OTG_INEndpointTypeDef;
+
+extern USB_OTG_GlobalTypeDef sim_otg_global;
+extern USB_OTG_DeviceTypeDef sim_otg_device;
+extern USB_OTG_INEndpointTypeDef sim_otg_in_ep[16];
+#define USB_OTG_FS (&sim_otg_global)
+
+// The firmware computes USBx_BASE from the instance pointer as on the
+// target; here the macros ignore it and point at the register copies
+#define USBx_DEVICE ((void)USBx_BASE, &sim_otg_device)
+#define USBx_INEP(i) ((void)USBx_BASE, &sim_otg_in_ep[(i)])
+
+#define USB_OTG_DIEPINT_XFRC (0x1UL << 0U)
+#define USB_OTG_DIEPINT_ITTXFE (0x1UL << 4U)
+#define USB_OTG_DIEPINT_TXFE (0x1UL << 7U)
+#define USB_OTG_GINTSTS_SOF (0x1UL << 3U)
+#define USB_OTG_GINTSTS_RXFLVL (0x1UL << 4U)
+#define USB_OTG_GINTSTS_USBRST (0x1UL << 12U)
+#define USB_OTG_GINTSTS_ENUMDNE (0x1UL << 13U)
+#define USB_OTG_GINTSTS_IEPINT (0x1UL << 18U)
+#define USB_OTG_GINTSTS_OEPINT (0x1UL << 19U)
+#define USB_OTG_GINTSTS_IISOIXFR (0x1UL << 20U)
+#define USB_OTG_GINTSTS_PXFR_INCOMPISOOUT (0x1UL << 21U)
+#define USB_OTG_DSTS_FNSOF_Pos (8U)
+#define USB_OTG_DSTS_FNSOF (0x3FFFUL << USB_OTG_DSTS_FNSOF_Pos)
+
+/* PCD */
+
+#define EP_TYPE_CTRL 0U
+#define EP_TYPE_ISOC 1U
+#define EP_TYPE_BULK 2U
+#define EP_TYPE_INTR 3U
+
+typedef struct {
+	uint8_t num;
+	uint8_t is_in;
+	uint8_t is_stall;
+	uint8_t type;
+	uint32_t maxpacket;
+	uint8_t *xfer_buff;
+	uint32_t xfer_len;
+	uint32_t xfer_count;
+} PCD_EPTypeDef;
+
+typedef struct {
+	uint32_t dev_endpoints;
+	uint32_t dma_enable;
+} PCD_InitTypeDef;
+
+typedef struct {
+	USB_OTG_GlobalTypeDef *Instance;
+	PCD_InitTypeDef Init;
+	PCD_EPTypeDef IN_ep[16];
+	PCD_EPTypeDef OUT_ep[16];
+	uint32_t Setup[12];
+} PCD_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type);
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len);
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len);
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_EP_Abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr);
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t address);
+HAL_StatusTypeDef HAL_PCDEx_SetTxFiFo(PCD_HandleTypeDef *hpcd, uint8_t fifo, uint16_t size);
+HAL_StatusTypeDef HAL_PCDEx_SetRxFiFo(PCD_HandleTypeDef *hpcd, uint16_t size);
+HAL_StatusTypeDef USB_EP0_OutStart(USB_OTG_GlobalTypeDef *USBx, uint8_t dma, uint8_t *psetup);
+
+// Implemented by the firmware (usb.c)
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef *hpcd);
+void HAL_PCD_ISOINIncompleteCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum);
+
+#endif /* __STM32F4xx_HAL_H */
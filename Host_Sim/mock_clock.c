@@ -0,0 +1,20 @@
+// Stand-in for the clock profiles (clock.c), which drive RCC and the
+// flash interface. The host keeps its clock; the sim only checks that
+// VENDOR_CLOCK reaches clock_set_profile with a valid profile.
+
+#include "clock.h"
+
+static clock_profile_t current;
+
+HAL_StatusTypeDef clock_set_profile(clock_profile_t profile) {
+	if (profile >= CLOCK_PROFILE_COUNT) return HAL_ERROR;
+	current = profile;
+	return HAL_OK;
+}
+
+clock_profile_t clock_get_profile(void) {
+	return current;
+}
+
+void clock_report(void) {
+}
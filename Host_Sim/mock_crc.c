@@ -0,0 +1,24 @@
+// Stand-in for the CRC calculation unit (hw_crc.c): the same CRC, a bit
+// at a time. Deliberately not the table code of Host_Tools/frame_decode.c,
+// so the sim checks one against the other.
+
+#include "hw_crc.h"
+
+static uint32_t crc;
+
+void hw_crc_init(void) {
+}
+
+void hw_crc_reset(void) {
+	crc = 0xFFFFFFFF;
+}
+
+uint32_t hw_crc_feed(const uint32_t *words, uint32_t count) {
+	while (count--) {
+		crc ^= *words++;
+		for (int i = 0; i < 32; i++) {
+			crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+	return crc;
+}
@@ -0,0 +1,336 @@
+// Functional stand-in for the HAL PCD driver and the OTG_FS core.
+//
+// Transfers follow the HAL in slave mode: an IN transfer goes out in max
+// packet size pieces and completes with the last short or full packet,
+// EP0 transfers are cut to one packet, a SETUP packet is taken in any
+// state and clears the EP0 stall. Packets move only when the host side
+// (sim_in/sim_out) asks for them; there is no timing here.
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "usb_fifo.h"
+#include "usb_event.h"
+#include "irq_stats.h"
+#include "sched.h"
+#include "log.h"
+#include "command.h"
+#include "stream.h"
+#include "pattern.h"
+#include "sim.h"
+
+PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+SCB_Type sim_scb;
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+DBGMCU_TypeDef sim_dbgmcu;
+uint32_t sim_primask;
+uint32_t sim_basepri;
+USB_OTG_GlobalTypeDef sim_otg_global;
+USB_OTG_DeviceTypeDef sim_otg_device;
+USB_OTG_INEndpointTypeDef sim_otg_in_ep[16];
+
+int sim_verbose;
+int sim_errors;
+
+static int is_idle;
+static uint8_t in_open[16], out_open[16];
+static uint8_t in_armed[16], out_armed[16];
+static uint32_t in_serial[16], out_serial[16];	// Transfers started
+static uint8_t address;
+
+uint16_t sim_rx_fifo_words;
+uint16_t sim_tx_fifo_words[16];
+
+#define RETRIES 100
+
+static void error(const char *message, uint8_t ep_addr) {
+	printf("PCD misuse: %s, ep 0x%02X\n", message, ep_addr);
+	sim_errors++;
+}
+
+static PCD_EPTypeDef *get_ep(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	return ep_addr & 0x80 ? &hpcd->IN_ep[ep_addr & 0x0F] : &hpcd->OUT_ep[ep_addr & 0x0F];
+}
+
+/* CMSIS and HAL system calls */
+
+void sim_wfi(void) {
+	is_idle = 1;
+}
+
+uint32_t ITM_SendChar(uint32_t ch) {
+	if (sim_verbose) putchar(ch);
+	return ch;
+}
+
+uint32_t HAL_GetUIDw0(void) { return 0x00400031; }
+uint32_t HAL_GetUIDw1(void) { return 0x3137510B; }
+uint32_t HAL_GetUIDw2(void) { return 0x33383538; }
+uint32_t HAL_RCC_GetHCLKFreq(void) { return 168000000; }
+
+/* PCD calls used by the firmware */
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type) {
+	PCD_EPTypeDef *ep = get_ep(hpcd, ep_addr);
+
+	ep->num = ep_addr & 0x0F;
+	ep->is_in = ep_addr >> 7;
+	ep->maxpacket = ep_mps;
+	ep->type = ep_type;
+	ep->is_stall = 0;
+	if (ep_addr & 0x80) in_open[ep->num] = 1;
+	else out_open[ep->num] = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	uint8_t num = ep_addr & 0x0F;
+
+	if (ep_addr & 0x80) in_open[num] = in_armed[num] = 0;
+	else out_open[num] = out_armed[num] = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len) {
+	PCD_EPTypeDef *ep = &hpcd->OUT_ep[ep_addr & 0x0F];
+
+	if (!out_open[ep->num]) error("receive on a closed endpoint", ep_addr);
+	if (out_armed[ep->num]) error("receive while a transfer is active", ep_addr);
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = ep->num == 0 && len > ep->maxpacket ? ep->maxpacket : len;
+	ep->xfer_count = 0;
+	out_armed[ep->num] = 1;
+	out_serial[ep->num]++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len) {
+	PCD_EPTypeDef *ep = &hpcd->IN_ep[ep_addr & 0x0F];
+
+	if (!in_open[ep->num]) error("transmit on a closed endpoint", ep_addr);
+	if (in_armed[ep->num]) error("transmit while a transfer is active", ep_addr);
+	ep->xfer_buff = pBuf;
+	ep->xfer_len = ep->num == 0 && len > ep->maxpacket ? ep->maxpacket : len;
+	ep->xfer_count = 0;
+	in_armed[ep->num] = 1;
+	in_serial[ep->num]++;
+	return HAL_OK;
+}
+
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	return hpcd->OUT_ep[ep_addr & 0x0F].xfer_count;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	get_ep(hpcd, ep_addr)->is_stall = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	get_ep(hpcd, ep_addr)->is_stall = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Abort(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) {
+	if (ep_addr & 0x80) in_armed[ep_addr & 0x0F] = 0;
+	else out_armed[ep_addr & 0x0F] = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t value) {
+	address = value;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_SetTxFiFo(PCD_HandleTypeDef *hpcd, uint8_t fifo, uint16_t size) {
+	sim_tx_fifo_words[fifo] = size;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_SetRxFiFo(PCD_HandleTypeDef *hpcd, uint16_t size) {
+	sim_rx_fifo_words = size;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef USB_EP0_OutStart(USB_OTG_GlobalTypeDef *USBx, uint8_t dma, uint8_t *psetup) {
+	return HAL_OK;
+}
+
+/* Host side */
+
+// Exception return from the OTG_FS interrupt: PendSV runs if pended
+static void pendsv(void) {
+	if (!(SCB->ICSR & SCB_ICSR_PENDSVSET_Msk)) return;
+	SCB->ICSR = 0;
+	usb_event_run();
+}
+
+void sim_init(void) {
+	hpcd_USB_OTG_FS.Instance = USB_OTG_FS;
+	hpcd_USB_OTG_FS.Init.dev_endpoints = 4;
+	HAL_PCDEx_SetRxFiFo(&hpcd_USB_OTG_FS, USB_FIFO_RX_WORDS);
+	HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 0, USB_FIFO_TX0_WORDS);
+	HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 1, USB_FIFO_TX_WORDS(1));
+	HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 2, USB_FIFO_TX_WORDS(2));
+	HAL_PCDEx_SetTxFiFo(&hpcd_USB_OTG_FS, 3, USB_FIFO_TX_WORDS(3));
+	irq_stats_init();
+	sched_init();
+	log_init();
+	command_init();
+	stream_init();
+	pattern_init();
+}
+
+void sim_bus_reset(void) {
+	memset(in_open, 0, sizeof(in_open));
+	memset(out_open, 0, sizeof(out_open));
+	memset(in_armed, 0, sizeof(in_armed));
+	memset(out_armed, 0, sizeof(out_armed));
+	address = 0;
+	HAL_PCD_ResetCallback(&hpcd_USB_OTG_FS);
+	pendsv();
+}
+
+void sim_setup(const uint8_t setup[8]) {
+	memcpy(hpcd_USB_OTG_FS.Setup, setup, 8);
+	hpcd_USB_OTG_FS.IN_ep[0].is_stall = 0;
+	hpcd_USB_OTG_FS.OUT_ep[0].is_stall = 0;
+	HAL_PCD_SetupStageCallback(&hpcd_USB_OTG_FS);
+	pendsv();
+}
+
+int sim_in(uint8_t ep_num, uint8_t *buff, int max) {
+	PCD_EPTypeDef *ep = &hpcd_USB_OTG_FS.IN_ep[ep_num];
+
+	if (ep->is_stall) return SIM_STALL;
+	if (!in_armed[ep_num]) return SIM_NAK;
+
+	uint32_t length = ep->xfer_len - ep->xfer_count;
+	if (length > ep->maxpacket) length = ep->maxpacket;
+	if (length > (uint32_t)max) {
+		printf("Host buffer overflow on ep 0x%02X\n", ep_num | 0x80);
+		sim_errors++;
+		length = max;
+	}
+	if (length) memcpy(buff, ep->xfer_buff + ep->xfer_count, length);
+	ep->xfer_count += length;
+	if (length < ep->maxpacket || ep->xfer_count == ep->xfer_len) {
+		in_armed[ep_num] = 0;
+		sim_otg_in_ep[ep_num].DIEPINT |= USB_OTG_DIEPINT_XFRC;
+		HAL_PCD_DataInStageCallback(&hpcd_USB_OTG_FS, ep_num);
+		sim_otg_in_ep[ep_num].DIEPINT &= ~USB_OTG_DIEPINT_XFRC;
+		pendsv();
+	}
+	return length;
+}
+
+int sim_out(uint8_t ep_num, const uint8_t *data, int length) {
+	PCD_EPTypeDef *ep = &hpcd_USB_OTG_FS.OUT_ep[ep_num];
+
+	if (ep->is_stall) return SIM_STALL;
+	if (!out_armed[ep_num]) return SIM_NAK;
+
+	uint32_t count = ep->xfer_len - ep->xfer_count;
+	if (count > (uint32_t)length) count = length;
+	if (count) memcpy(ep->xfer_buff + ep->xfer_count, data, count);
+	ep->xfer_count += length;
+	if ((uint32_t)length < ep->maxpacket || ep->xfer_count >= ep->xfer_len) {
+		out_armed[ep_num] = 0;
+		HAL_PCD_DataOutStageCallback(&hpcd_USB_OTG_FS, ep_num);
+		pendsv();
+	}
+	return 0;
+}
+
+int sim_iso_in_incomplete(uint8_t ep_num) {
+	PCD_EPTypeDef *ep = &hpcd_USB_OTG_FS.IN_ep[ep_num];
+
+	if (!in_open[ep_num] || ep->type != EP_TYPE_ISOC || !in_armed[ep_num]) return 0;
+	// The HAL aborts the endpoint and calls back once it is disabled (EPDISD)
+	HAL_PCD_EP_Abort(&hpcd_USB_OTG_FS, ep_num | 0x80);
+	HAL_PCD_ISOINIncompleteCallback(&hpcd_USB_OTG_FS, ep_num);
+	pendsv();
+	return 1;
+}
+
+int sim_in_left(uint8_t ep_num, uint32_t *serial) {
+	PCD_EPTypeDef *ep = &hpcd_USB_OTG_FS.IN_ep[ep_num];
+
+	*serial = in_serial[ep_num];
+	return in_armed[ep_num] ? (int)(ep->xfer_len - ep->xfer_count) : -1;
+}
+
+int sim_out_left(uint8_t ep_num, uint32_t *serial) {
+	PCD_EPTypeDef *ep = &hpcd_USB_OTG_FS.OUT_ep[ep_num];
+
+	*serial = out_serial[ep_num];
+	return out_armed[ep_num] ? (int)(ep->xfer_len - ep->xfer_count) : -1;
+}
+
+int sim_ep_type(uint8_t ep_addr) {
+	uint8_t num = ep_addr & 0x0F;
+
+	if (!(ep_addr & 0x80 ? in_open[num] : out_open[num])) return -1;
+	return get_ep(&hpcd_USB_OTG_FS, ep_addr)->type;
+}
+
+void sim_run(void) {
+	do {
+		is_idle = 0;
+		sched_dispatch();
+	} while (!is_idle);
+}
+
+// Retries a NAKed stage with the main loop running in between
+#define RETRY(result, call) do { \
+	for (int try_ = 0; try_ < RETRIES; try_++) { \
+		result = (call); \
+		if (result != SIM_NAK) break; \
+		sim_run(); \
+	} \
+	if (result == SIM_NAK) result = SIM_TIMEOUT; \
+} while (0)
+
+static void send_setup(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, uint16_t length) {
+	uint8_t setup[8] = { request_type, request, value, value >> 8, index, index >> 8, length, length >> 8 };
+	sim_setup(setup);
+}
+
+int sim_control_in(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+		uint8_t *buff, uint16_t length) {
+	int received = 0;
+	int result;
+
+	send_setup(request_type, request, value, index, length);
+	while (received < length) {
+		RETRY(result, sim_in(0, buff + received, length - received));
+		if (result < 0) return result;
+		received += result;
+		if (result < USB_EP0_SIZE) break;
+	}
+	RETRY(result, sim_out(0, NULL, 0));
+	return result < 0 ? result : received;
+}
+
+int sim_control_out(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+		const uint8_t *data, uint16_t length) {
+	uint8_t status[USB_EP0_SIZE];
+	int sent = 0;
+	int result;
+
+	send_setup(request_type, request, value, index, length);
+	while (sent < length) {
+		int packet = length - sent < USB_EP0_SIZE ? length - sent : USB_EP0_SIZE;
+		RETRY(result, sim_out(0, data + sent, packet));
+		if (result < 0) return result;
+		sent += packet;
+	}
+	RETRY(result, sim_in(0, status, sizeof(status)));
+	return result < 0 ? result : sent;
+}
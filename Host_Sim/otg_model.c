@@ -0,0 +1,427 @@
+// Frame and FIFO timing on top of the functional mock, see otg_model.h.
+//
+// The mock moves the data and runs the firmware callbacks; this file
+// decides when. Bus time advances per transaction, CPU time per piece
+// of interrupt or task work. A packet the interrupt loads into a Tx FIFO
+// becomes visible to the host when the load is done, an OUT packet in
+// the Rx FIFO reaches the firmware when the interrupt has drained it.
+
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "usb_desc.h"
+#include "sched.h"
+#include "otg_model.h"
+
+#define NUM_EPS (USB_MAX_EP_NUM + 1)
+#define BYTE_NS (MODEL_FRAME_NS / MODEL_FRAME_BYTES)
+
+// Bus bytes besides the data: tokens, PIDs, CRCs, handshakes, sync and EOP
+#define SOF_BYTES 6
+#define DATA_OVERHEAD 13	// Bulk and interrupt transactions
+#define ISO_OVERHEAD 9		// No handshake
+#define NAK_BYTES 8		// Token and NAK handshake
+
+#define TX_PACKETS 16		// More than any Tx FIFO holds
+#define RX_PACKETS 16
+#define RX_PACKET_MAX 64	// Full-speed bulk and interrupt OUT
+
+#define WORDS(bytes) (((bytes) + 3) / 4)
+
+typedef struct {
+	double ready;		// Load into the FIFO done
+	uint16_t length;
+} tx_packet_t;
+
+typedef struct {
+	uint32_t serial;	// Transfer the FIFO is loaded from
+	int loaded_any;		// Some packet of it is loaded, ends a zero-length transfer
+	tx_packet_t fifo[TX_PACKETS];
+	int head, count;
+	uint32_t fifo_bytes;	// Word-aligned, as stored
+	uint32_t queued;	// Data bytes in the FIFO
+	uint32_t host_left;
+} in_ep_t;
+
+typedef struct {
+	double drained;		// Copied out by the interrupt
+	uint8_t ep_num;
+	uint16_t length;
+	uint8_t data[RX_PACKET_MAX];
+} rx_packet_t;
+
+typedef struct {
+	const uint8_t *host_data;
+	uint32_t host_left;
+	uint32_t pending;	// Data bytes of the endpoint in the Rx FIFO
+	int pending_packets;
+} out_ep_t;
+
+const model_config_t model_default_config = {
+	.hclk = 168000000,
+	.isr_cycles = 300,
+	.copy_cycles = 3,
+	.pendsv_cycles = 150,
+	.task_cycles = 2000,
+};
+
+static model_config_t config;
+static model_stats_t *stats;
+static double cycle_ns;
+static double now;		// Start of the next frame
+static uint32_t frame;
+static double isr_free;		// CPU done with interrupt work
+static double thread_free;	// CPU done with the running task, interrupts included
+
+static in_ep_t in_eps[NUM_EPS];
+static out_ep_t out_eps[NUM_EPS];
+static rx_packet_t rx_fifo[RX_PACKETS];
+static int rx_head, rx_count;
+static uint32_t rx_bytes;
+
+// bInterval of the periodic endpoints, IN at 4 + number
+#define EP_INTERVAL(addr, type, attr, mps, interval) [((addr) & 0x0F) + ((addr) & 0x80 ? 4 : 0)] = (interval),
+static const uint8_t intervals[2 * NUM_EPS] = {
+	USB_ENDPOINTS(EP_INTERVAL)
+	[(USB_ISO_EP & 0x0F) + 4] = USB_ISO_INTERVAL,
+};
+
+/* Device CPU */
+
+// Interrupt work of the given length, starting at t or when the CPU is
+// done with earlier interrupt work. Returns the time it is done.
+static double isr(double t, uint32_t cycles) {
+	double start = t > isr_free ? t : isr_free;
+	double length = cycles * cycle_ns;
+
+	isr_free = start + length;
+	stats->isr_ns += length;
+	// A task running meanwhile is preempted
+	if (thread_free > start) thread_free += length;
+	return isr_free;
+}
+
+// Loads packets of the current IN transfer while the FIFO has room
+static void load_tx_fifo(uint8_t ep_num, double t) {
+	in_ep_t *ep = &in_eps[ep_num];
+	uint32_t mps = hpcd_USB_OTG_FS.IN_ep[ep_num].maxpacket;
+	uint32_t capacity = sim_tx_fifo_words[ep_num] * 4;
+	uint32_t serial;
+	int left = sim_in_left(ep_num, &serial);
+
+	if (left < 0) return;
+	if (serial != ep->serial) {
+		// The FIFO is empty when a transfer ends
+		ep->serial = serial;
+		ep->loaded_any = 0;
+	}
+
+	uint32_t to_load = left - ep->queued;
+	uint32_t words = 0;
+	int first = (ep->head + ep->count) % TX_PACKETS;
+	int packets = 0;
+	while (ep->count + packets < TX_PACKETS) {
+		uint32_t length = to_load > mps ? mps : to_load;
+
+		if (length == 0 && ep->loaded_any) break;
+		if (ep->fifo_bytes + 4 * (words + WORDS(length)) > capacity) break;
+		ep->fifo[(first + packets) % TX_PACKETS].length = length;
+		words += WORDS(length);
+		to_load -= length;
+		ep->queued += length;
+		ep->loaded_any = 1;
+		packets++;
+	}
+	if (!packets) return;
+
+	double ready = isr(t, config.isr_cycles + words * config.copy_cycles);
+	for (int i = 0; i < packets; i++) {
+		ep->fifo[(first + i) % TX_PACKETS].ready = ready;
+	}
+	ep->count += packets;
+	ep->fifo_bytes += 4 * words;
+	if (ep->fifo_bytes > stats->in[ep_num].fifo_max) stats->in[ep_num].fifo_max = ep->fifo_bytes;
+}
+
+// Transfer finished: XFRC interrupt, then the completion in PendSV
+static void transfer_done(double t) {
+	isr(t, config.isr_cycles + config.pendsv_cycles);
+}
+
+static uint32_t task_runs(void) {
+	sched_stats_t sched;
+	uint32_t runs = 0;
+
+	sched_stats_snapshot(&sched, 0);
+	for (int i = 0; i < sched.num_tasks; i++) {
+		runs += sched.task[i].runs;
+	}
+	return runs;
+}
+
+// The main loop gets the CPU when no interrupt or task is running
+static void run_thread(double t) {
+	if (thread_free > t || isr_free > t) return;
+
+	uint32_t runs = task_runs();
+	sim_run();
+	runs = task_runs() - runs;
+	if (!runs) return;
+
+	double length = runs * config.task_cycles * cycle_ns;
+	thread_free = t + length;
+	stats->thread_ns += length;
+	// Transfers the tasks started get loaded once they are done
+	for (int i = 1; i < NUM_EPS; i++) {
+		load_tx_fifo(i, thread_free);
+	}
+}
+
+// Hands the OUT packets drained by t to the firmware, then lets the main loop run
+static void run_device(double t) {
+	while (rx_count && rx_fifo[rx_head].drained <= t) {
+		rx_packet_t *packet = &rx_fifo[rx_head];
+		out_ep_t *ep = &out_eps[packet->ep_num];
+		uint32_t serial, serial_after;
+
+		sim_out_left(packet->ep_num, &serial);
+		if (sim_out(packet->ep_num, packet->data, packet->length) < 0) {
+			printf("Model: OUT packet on ep 0x%02X not taken\n", packet->ep_num);
+			sim_errors++;
+		}
+		if (sim_out_left(packet->ep_num, &serial_after) < 0 || serial_after != serial) {
+			transfer_done(packet->drained);
+		}
+		ep->pending -= packet->length;
+		ep->pending_packets--;
+		rx_bytes -= 4 * (WORDS(packet->length) + 1);
+		rx_head = (rx_head + 1) % RX_PACKETS;
+		rx_count--;
+	}
+	run_thread(t);
+}
+
+/* Host */
+
+static double bus(double t, uint32_t bytes) {
+	stats->bus_ns += bytes * BYTE_NS;
+	return t + bytes * BYTE_NS;
+}
+
+// One IN token. Returns the time the transaction ends.
+static double host_in(uint8_t ep_num, double t, int is_iso) {
+	in_ep_t *ep = &in_eps[ep_num];
+	model_ep_stats_t *ep_stats = &stats->in[ep_num];
+
+	if (!ep->count || ep->fifo[ep->head].ready > t) {
+		uint32_t serial;
+
+		if (is_iso && sim_in_left(ep_num, &serial) >= 0) {
+			// Armed but not loaded in time: IISOIXFR, the HAL aborts the
+			// transfer and the firmware flushes the FIFO and starts the next
+			ep_stats->missed++;
+			ep->head = ep->count = 0;
+			ep->fifo_bytes = ep->queued = 0;
+			ep->loaded_any = 0;
+			isr(t, config.isr_cycles + config.pendsv_cycles);
+			sim_iso_in_incomplete(ep_num);
+			load_tx_fifo(ep_num, isr_free);
+			return bus(t, ISO_OVERHEAD);
+		}
+		ep_stats->naks++;
+		// An iso IN token without data gets no answer
+		return bus(t, is_iso ? ISO_OVERHEAD : NAK_BYTES);
+	}
+
+	uint8_t buff[USB_ISO_MPS_MAX];
+	uint32_t serial, serial_after;
+	uint16_t expected = ep->fifo[ep->head].length;
+
+	sim_in_left(ep_num, &serial);
+	int length = sim_in(ep_num, buff, sizeof(buff));
+	if (length != expected) {
+		printf("Model: ep 0x%02X sent %d bytes, %d loaded\n", ep_num | 0x80, length, expected);
+		sim_errors++;
+		length = expected;
+	}
+	ep->head = (ep->head + 1) % TX_PACKETS;
+	ep->count--;
+	ep->fifo_bytes -= 4 * WORDS(length);
+	ep->queued -= length;
+	ep_stats->packets++;
+	ep_stats->bytes += length;
+	if (!is_iso && ep->host_left != MODEL_UNLIMITED) {
+		ep->host_left -= (uint32_t)length < ep->host_left ? (uint32_t)length : ep->host_left;
+	}
+	if (config.in_data) config.in_data(ep_num, buff, length);
+
+	t = bus(t, length + (is_iso ? ISO_OVERHEAD : DATA_OVERHEAD));
+	double load_at = t;
+	if (sim_in_left(ep_num, &serial_after) < 0 || serial_after != serial) {
+		transfer_done(t);
+		load_at = isr_free;
+	}
+	// Tx FIFO empty interrupt
+	load_tx_fifo(ep_num, load_at);
+	return t;
+}
+
+// One OUT packet. Returns the time the transaction ends.
+static double host_out(uint8_t ep_num, double t) {
+	out_ep_t *ep = &out_eps[ep_num];
+	uint32_t mps = hpcd_USB_OTG_FS.OUT_ep[ep_num].maxpacket;
+	uint32_t length = ep->host_left > mps ? mps : ep->host_left;
+	uint32_t serial;
+	int left = sim_out_left(ep_num, &serial);
+
+	// The core takes a packet while the transfer has room and the Rx
+	// FIFO has space for it and its status word
+	int accept = left >= 0 && (left > (int)ep->pending || (left == 0 && !ep->pending_packets)) &&
+			length <= RX_PACKET_MAX && rx_count < RX_PACKETS &&
+			rx_bytes + 4 * (WORDS(length) + 1) <= sim_rx_fifo_words * 4u;
+	if (!accept) {
+		stats->out[ep_num].naks++;
+		return bus(t, NAK_BYTES);
+	}
+
+	rx_packet_t *packet = &rx_fifo[(rx_head + rx_count) % RX_PACKETS];
+	packet->ep_num = ep_num;
+	packet->length = length;
+	memcpy(packet->data, ep->host_data, length);
+	rx_count++;
+	rx_bytes += 4 * (WORDS(length) + 1);
+	if (rx_bytes > stats->rx_fifo_max) stats->rx_fifo_max = rx_bytes;
+	ep->host_data += length;
+	ep->host_left -= length;
+	ep->pending += length;
+	ep->pending_packets++;
+	stats->out[ep_num].packets++;
+	stats->out[ep_num].bytes += length;
+
+	t = bus(t, length + DATA_OVERHEAD);
+	// Rx FIFO level interrupt
+	packet->drained = isr(t, config.isr_cycles + WORDS(length) * config.copy_cycles);
+	return t;
+}
+
+static int is_due(uint8_t ep_addr) {
+	uint8_t interval = intervals[(ep_addr & 0x0F) + (ep_addr & 0x80 ? 4 : 0)];
+
+	return interval <= 1 || frame % interval == 0;
+}
+
+// Bulk endpoints with a host request, round robin
+static int next_bulk(int *last) {
+	for (int i = 1; i <= 2 * NUM_EPS; i++) {
+		int slot = (*last + i) % (2 * NUM_EPS);
+		uint8_t ep_num = slot % NUM_EPS;
+		int is_in = slot >= NUM_EPS;
+
+		if (ep_num == 0 || sim_ep_type(ep_num | (is_in ? 0x80 : 0)) != EP_TYPE_BULK) continue;
+		if (is_in ? in_eps[ep_num].host_left == 0 : out_eps[ep_num].host_left == 0) continue;
+		*last = slot;
+		return slot;
+	}
+	return -1;
+}
+
+static void run_frame(void) {
+	double t = now;
+	double end = now + MODEL_FRAME_NS;
+	static int last_bulk;
+
+	frame++;
+	sim_otg_device.DSTS = (frame << USB_OTG_DSTS_FNSOF_Pos) & USB_OTG_DSTS_FNSOF;
+	run_device(t);
+	if (config.frame_start) {
+		config.frame_start(frame);
+		for (int i = 1; i < NUM_EPS; i++) {
+			load_tx_fifo(i, t);
+		}
+	}
+	t = bus(t, SOF_BYTES);
+
+	// Periodic transfers first
+	for (uint8_t i = 1; i < NUM_EPS; i++) {
+		int type = sim_ep_type(0x80 | i);
+
+		run_device(t);
+		if (type == EP_TYPE_ISOC) t = host_in(i, t, 1);
+		else if (type == EP_TYPE_INTR && in_eps[i].host_left && is_due(0x80 | i)) t = host_in(i, t, 0);
+	}
+	for (uint8_t i = 1; i < NUM_EPS; i++) {
+		run_device(t);
+		if (sim_ep_type(i) == EP_TYPE_INTR && out_eps[i].host_left && is_due(i)) t = host_out(i, t);
+	}
+
+	// Bulk in what is left of the frame
+	for (;;) {
+		run_device(t);
+		int slot = next_bulk(&last_bulk);
+		if (slot < 0) break;
+
+		uint8_t ep_num = slot % NUM_EPS;
+		int is_in = slot >= NUM_EPS;
+		uint32_t mps = is_in ? hpcd_USB_OTG_FS.IN_ep[ep_num].maxpacket : hpcd_USB_OTG_FS.OUT_ep[ep_num].maxpacket;
+		if (t + (mps + DATA_OVERHEAD) * BYTE_NS > end) break;
+		t = is_in ? host_in(ep_num, t, 0) : host_out(ep_num, t);
+	}
+
+	now = end;
+	run_device(now);
+	stats->frames++;
+}
+
+void model_init(const model_config_t *new_config) {
+	config = *new_config;
+	cycle_ns = 1e9 / config.hclk;
+	now = isr_free = thread_free = 0;
+	frame = 0;
+	memset(in_eps, 0, sizeof(in_eps));
+	memset(out_eps, 0, sizeof(out_eps));
+	rx_head = rx_count = 0;
+	rx_bytes = 0;
+}
+
+void model_host_read(uint8_t ep_num, uint32_t length) {
+	in_eps[ep_num].host_left = length;
+}
+
+void model_host_write(uint8_t ep_num, const uint8_t *data, uint32_t length) {
+	out_eps[ep_num].host_data = data;
+	out_eps[ep_num].host_left = length;
+}
+
+uint32_t model_host_write_left(uint8_t ep_num) {
+	return out_eps[ep_num].host_left;
+}
+
+void model_run(uint32_t frames, model_stats_t *run_stats) {
+	stats = run_stats;
+	for (uint32_t i = 0; i < frames; i++) {
+		run_frame();
+	}
+}
+
+void model_print(const model_stats_t *stats) {
+	double elapsed = stats->frames * MODEL_FRAME_NS;
+
+	printf("  %u frames, CPU %.1f%% interrupts %.1f%% tasks, bus %.1f%%\n", stats->frames,
+			100 * stats->isr_ns / elapsed, 100 * stats->thread_ns / elapsed, 100 * stats->bus_ns / elapsed);
+	printf("  %-6s %9s %9s %9s %9s %9s %12s\n", "ep", "packets", "kB/s", "NAKs", "missed", "per frame", "FIFO max");
+	for (int i = 1; i < NUM_EPS; i++) {
+		const model_ep_stats_t *in = &stats->in[i];
+		const model_ep_stats_t *out = &stats->out[i];
+
+		if (in->packets || in->naks || in->missed) {
+			printf("  0x%02X   %9u %9.1f %9u %9u %9.2f %5u of %4u\n", 0x80 | i, in->packets,
+					in->bytes / (elapsed / 1e6), in->naks, in->missed, (double)in->packets / stats->frames,
+					in->fifo_max, sim_tx_fifo_words[i] * 4);
+		}
+		if (out->packets || out->naks) {
+			printf("  0x%02X   %9u %9.1f %9u %9u %9.2f %5u of %4u\n", i, out->packets,
+					out->bytes / (elapsed / 1e6), out->naks, out->missed, (double)out->packets / stats->frames,
+					stats->rx_fifo_max, sim_rx_fifo_words * 4);
+		}
+	}
+}
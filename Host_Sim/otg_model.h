@@ -0,0 +1,84 @@
+#ifndef __OTG_MODEL_H
+#define __OTG_MODEL_H
+
+#include <stdint.h>
+
+/*
+ * Timed model of the OTG FS core and a full-speed host, on top of the
+ * functional mock in mock_pcd.c.
+ *
+ * Time runs in 1 ms frames of 1500 byte times. Each frame starts with
+ * the SOF and the periodic transfers (iso every frame, interrupt every
+ * bInterval frames), the rest goes to bulk transactions, round robin
+ * over the endpoints the host has reads or writes pending for. The host
+ * does not start a transaction that would not end before the frame does.
+ *
+ * The device side has one CPU. Interrupt work (OTG_FS, PendSV) preempts
+ * the main loop, which runs whenever the CPU is free. Each IN endpoint
+ * has a Tx FIFO of the size given to HAL_PCDEx_SetTxFiFo; the interrupt
+ * loads packets of the current transfer while they fit, and the host only
+ * gets a packet that is fully loaded. OUT packets land in the shared Rx
+ * FIFO if they fit, until the interrupt drains them. Without a packet or
+ * without space the core NAKs, or for iso sends nothing. An iso transfer
+ * that is armed but not loaded when its token comes is aborted as on the
+ * board (IISOIXFR): its data is dropped and the firmware's
+ * HAL_PCD_ISOINIncompleteCallback runs.
+ *
+ * The firmware code runs unmodified; its cost comes from model_config_t,
+ * take the numbers from irq_stats and sched_stats on the board. The FIFO
+ * plan and the endpoints come from usb_fifo.h and usb_desc.h as built.
+ * Bit stuffing and bus errors are not modelled: figures are upper bounds.
+ */
+#define MODEL_FRAME_NS 1000000.0
+#define MODEL_FRAME_BYTES 1500
+#define MODEL_UNLIMITED 0xFFFFFFFF
+
+typedef struct {
+	uint32_t hclk;			// Core clock, Hz
+	uint32_t isr_cycles;		// Per OTG_FS interrupt: entry, status decode, HAL dispatch
+	uint32_t copy_cycles;		// Per word moved to or from a FIFO
+	uint32_t pendsv_cycles;		// Per completion handled in the bottom half
+	uint32_t task_cycles;		// Per scheduler task run
+	// Called at each SOF in thread mode, may be 0
+	void (*frame_start)(uint32_t frame);
+	// Called with each IN packet the host receives, may be 0
+	void (*in_data)(uint8_t ep_num, const uint8_t *data, int length);
+} model_config_t;
+
+typedef struct {
+	uint32_t packets;
+	uint64_t bytes;
+	uint32_t naks;		// Tokens answered with NAK, or iso frames with no transfer armed
+	uint32_t missed;	// Iso frames whose armed transfer was not loaded in time and was dropped
+	uint32_t fifo_max;	// Most bytes waiting in the FIFO
+} model_ep_stats_t;
+
+typedef struct {
+	uint32_t frames;
+	double isr_ns;		// Interrupt time (OTG_FS and PendSV)
+	double thread_ns;	// Main loop task time
+	double bus_ns;		// Bus time used by transactions, SOF included
+	model_ep_stats_t in[4];
+	model_ep_stats_t out[4];
+	uint32_t rx_fifo_max;	// Most bytes in the Rx FIFO, status words included
+} model_stats_t;
+
+extern const model_config_t model_default_config;
+
+// Call after sim_init, the FIFO sizes are taken from there
+void model_init(const model_config_t *config);
+
+// Host reads on an IN endpoint, bytes or MODEL_UNLIMITED. Iso endpoints are
+// read every frame regardless.
+void model_host_read(uint8_t ep_num, uint32_t length);
+// Host write on an OUT endpoint. data must stay valid until it is sent.
+void model_host_write(uint8_t ep_num, const uint8_t *data, uint32_t length);
+// Bytes of the host write not yet taken by the device
+uint32_t model_host_write_left(uint8_t ep_num);
+
+// Runs frames, adding to stats
+void model_run(uint32_t frames, model_stats_t *stats);
+
+void model_print(const model_stats_t *stats);
+
+#endif /* __OTG_MODEL_H */
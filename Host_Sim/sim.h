@@ -0,0 +1,58 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "stm32f4xx_hal.h"
+
+/*
+ * Host side of the simulated bus. Each call acts like one bus event on
+ * the target: the PCD callback of the firmware runs as the OTG_FS
+ * interrupt would, then PendSV if the callback pended it. Thread mode
+ * (the scheduler tasks) only runs in sim_run, like the main loop would
+ * between interrupts.
+ */
+#define SIM_NAK -1
+#define SIM_STALL -2
+#define SIM_TIMEOUT -3
+
+extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
+
+// Firmware output (fmt_printf) goes to stdout
+extern int sim_verbose;
+// Firmware misuse of the PCD calls seen so far, see mock_pcd.c
+extern int sim_errors;
+
+// Same sequence as main.c: FIFOs, counters, scheduler and tasks
+void sim_init(void);
+
+void sim_bus_reset(void);
+void sim_setup(const uint8_t setup[8]);
+// One IN token: packet length, SIM_NAK or SIM_STALL
+int sim_in(uint8_t ep_num, uint8_t *buff, int max);
+// One OUT packet: 0 when taken, SIM_NAK or SIM_STALL
+int sim_out(uint8_t ep_num, const uint8_t *data, int length);
+// End of a frame whose iso IN token found no data (IISOIXFR): aborts the
+// transfer as the HAL does. 1 if one was armed, 0 if there was none.
+int sim_iso_in_incomplete(uint8_t ep_num);
+
+// Core state for the frame model (otg_model.h). Bytes the core still
+// has to move in the current transfer, or -1 when none is started;
+// serial counts the transfers started on the endpoint.
+int sim_in_left(uint8_t ep_num, uint32_t *serial);
+int sim_out_left(uint8_t ep_num, uint32_t *serial);
+// EP_TYPE_* of an open endpoint, -1 when closed
+int sim_ep_type(uint8_t ep_addr);
+// Sizes given to HAL_PCDEx_SetRxFiFo/SetTxFiFo, in words
+extern uint16_t sim_rx_fifo_words;
+extern uint16_t sim_tx_fifo_words[16];
+
+// Runs the main loop until every task is idle
+void sim_run(void);
+
+// Whole control transfers as a host controller would run them, retrying
+// NAKed stages with sim_run in between. Bytes moved or SIM_STALL/SIM_TIMEOUT.
+int sim_control_in(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+		uint8_t *buff, uint16_t length);
+int sim_control_out(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+		const uint8_t *data, uint16_t length);
+
+#endif /* __SIM_H */
@@ -0,0 +1,634 @@
+// Runs the firmware USB layer (Device_M4/Core/Src) on the host against
+// the mock PCD in mock_pcd.c, and drives it the way a host controller
+// would: enumeration, vendor requests, the bulk sample stream raw, framed
+// and compressed, the last two through the host decoders of Host_Tools.
+//
+// Every scenario checks what comes back and reports the wall-clock time
+// per control transfer or bulk packet. The time covers the firmware
+// code path only (top half, bottom half, tasks), not the bus: use it to
+// compare changes to the USB layer, not as a throughput figure.
+//
+// The throughput and iso scenarios run the frame model (otg_model.h)
+// instead: they predict the bus rate and the iso frames missed for the
+// FIFO plan as built and the CPU cost given with -i/-c/-t.
+//
+// Usage: usb_sim [-v] [-n iterations] [-i isr] [-c copy] [-t task] [scenario...]
+//   -v	print the firmware log output
+//   -n	repetitions, or frames for the model scenarios (1000)
+//   -i -c -t	cycles per interrupt, per FIFO word, per task run
+//   scenarios: enumerate vendor stream framed compressed loopback pattern iso_missed throughput iso
+//   (all by default)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+#include "otg_model.h"
+#include "command.h"
+#include "stream.h"
+#include "usb_queue.h"
+#include "usb_pool.h"
+#include "loopback.h"
+#include "pattern.h"
+#include "clock.h"
+#include "frame_decode.h"
+#include "rice_decode.h"
+
+// Request types and requests, as in usb.c
+#define STANDARD 0x80
+#define STANDARD_OUT 0x00
+#define VENDOR_IN 0xC0
+#define VENDOR_OUT 0x40
+#define SET_ADDRESS 5
+#define GET_DESCRIPTOR 6
+#define GET_CONFIGURATION 8
+#define SET_CONFIGURATION 9
+#define SET_INTERFACE 11
+#define VENDOR_USB_STATS 0x11
+#define VENDOR_READ_BACK 0x12
+#define VENDOR_SCHED_STATS 0x13
+#define VENDOR_PATTERN_STATUS 0x14
+#define VENDOR_UNKNOWN 0x3F
+
+#define STREAM_PACKET 64
+
+static int failures;
+static model_config_t model_config;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __func__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+		return; \
+	} \
+} while (0)
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double elapsed_ns, long operations, const char *unit) {
+	printf("%-10s %8ld %-9s %10.1f ns each\n", name, operations, unit, elapsed_ns / operations);
+}
+
+// Bus reset, then addressed and configured like the Linux host does it
+static void configure(void) {
+	uint8_t buff[64];
+
+	sim_bus_reset();
+	sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0100, 0, buff, 64);
+	sim_control_out(STANDARD_OUT, SET_ADDRESS, 5, 0, NULL, 0);
+	sim_control_out(STANDARD_OUT, SET_CONFIGURATION, 1, 0, NULL, 0);
+}
+
+/* Scenarios */
+
+static void enumerate(long iterations) {
+	uint8_t buff[512];
+	long transfers = 0;
+	double start = now_ns();
+
+	for (long i = 0; i < iterations; i++) {
+		int result;
+
+		sim_bus_reset();
+		result = sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0100, 0, buff, 64);
+		CHECK(result == 18 && buff[0] == 18 && buff[1] == 1, "device descriptor: %d", result);
+		result = sim_control_out(STANDARD_OUT, SET_ADDRESS, 5, 0, NULL, 0);
+		CHECK(result == 0, "SET_ADDRESS: %d", result);
+		result = sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0100, 0, buff, 18);
+		CHECK(result == 18, "device descriptor: %d", result);
+		result = sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0200, 0, buff, 9);
+		CHECK(result == 9 && buff[1] == 2, "configuration header: %d", result);
+		uint16_t total = buff[2] | buff[3] << 8;
+		CHECK(total <= sizeof(buff), "wTotalLength %d", total);
+		result = sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0200, 0, buff, 255);
+		CHECK(result == total, "configuration descriptor: %d of %d", result, total);
+		for (int index = 0; index < 4; index++) {
+			result = sim_control_in(STANDARD, GET_DESCRIPTOR, 0x0300 | index, 0x0409, buff, 255);
+			CHECK(result > 2 && result == buff[0] && buff[1] == 3, "string %d: %d", index, result);
+		}
+		result = sim_control_out(STANDARD_OUT, SET_CONFIGURATION, 1, 0, NULL, 0);
+		CHECK(result == 0, "SET_CONFIGURATION: %d", result);
+		result = sim_control_in(STANDARD, GET_CONFIGURATION, 0, 0, buff, 1);
+		CHECK(result == 1 && buff[0] == 1, "GET_CONFIGURATION: %d", result);
+		transfers += 11;
+	}
+	report("enumerate", now_ns() - start, transfers, "transfers");
+}
+
+static void vendor(long iterations) {
+	static uint8_t data[4096], back[4096];
+	uint8_t stats[512];
+	long transfers = 0;
+
+	configure();
+	double start = now_ns();
+	for (long i = 0; i < iterations; i++) {
+		int result;
+
+		for (int j = 0; j < sizeof(data); j++) {
+			data[j] = j * 7 + i;
+		}
+		result = sim_control_out(VENDOR_OUT, 0x30, i, 0, data, sizeof(data));
+		CHECK(result == sizeof(data), "vendor OUT: %d", result);
+		result = sim_control_in(VENDOR_IN, VENDOR_READ_BACK, 0, 0, back, sizeof(back));
+		CHECK(result == sizeof(back), "read back: %d", result);
+		CHECK(!memcmp(data, back, sizeof(data)), "read back data differs");
+		result = sim_control_in(VENDOR_IN, VENDOR_USB_STATS, 0, 0, stats, sizeof(stats));
+		CHECK(result > 4 && stats[0] != 0, "usb stats: %d", result);
+		result = sim_control_in(VENDOR_IN, VENDOR_SCHED_STATS, 0, 0, stats, sizeof(stats));
+		CHECK(result > 4 && stats[0] != 0, "sched stats: %d", result);
+		result = sim_control_in(VENDOR_IN, VENDOR_UNKNOWN, 0, 0, stats, 8);
+		CHECK(result == SIM_STALL, "unknown request not stalled: %d", result);
+		result = sim_control_out(VENDOR_OUT, VENDOR_CLOCK, i % CLOCK_PROFILE_COUNT, 0, NULL, 0);
+		CHECK(result == 0 && clock_get_profile() == i % CLOCK_PROFILE_COUNT, "clock profile: %d", result);
+		transfers += 6;
+	}
+	report("vendor", now_ns() - start, transfers, "transfers");
+}
+
+// Next stream packet, with the main loop running while the endpoint NAKs
+static int read_stream_packet(uint8_t *buff) {
+	int result = SIM_NAK;
+
+	for (int i = 0; i < 100 && result == SIM_NAK; i++) {
+		result = sim_in(STREAM_EP & 0x0F, buff, STREAM_PACKET);
+		if (result == SIM_NAK) sim_run();
+	}
+	return result;
+}
+
+static void stream(long iterations) {
+	uint8_t packet[STREAM_PACKET];
+	uint16_t expected = 0;
+	int result;
+
+	configure();
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, 1, 0, NULL, 0);
+	CHECK(result == 0, "stream start: %d", result);
+
+	long packets = iterations * 16;
+	double start = now_ns();
+	for (long i = 0; i < packets; i++) {
+		result = read_stream_packet(packet);
+		CHECK(result == STREAM_PACKET, "packet %ld: %d", i, result);
+		const uint16_t *samples = (const uint16_t*)packet;
+		if (i == 0) expected = samples[0];
+		for (int j = 0; j < STREAM_PACKET / 2; j++, expected++) {
+			CHECK(samples[j] == expected, "packet %ld sample %d: %u, expected %u", i, j, samples[j], expected);
+		}
+	}
+	double elapsed = now_ns() - start;
+
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, 0, 0, NULL, 0);
+	CHECK(result == 0, "stream stop: %d", result);
+	// Blocks queued before the stop still go out, then the endpoint NAKs
+	for (int i = 0; i <= USB_POOL_BLOCKS * USB_POOL_BLOCK_SIZE / STREAM_PACKET; i++) {
+		result = read_stream_packet(packet);
+		if (result == SIM_NAK) break;
+		CHECK(result == STREAM_PACKET, "packet after stop: %d", result);
+	}
+	CHECK(result == SIM_NAK, "stream did not stop");
+	report("stream", elapsed, packets, "packets");
+}
+
+typedef struct {
+	long errors;		// Frames off the ramp or not decodable
+	long samples;
+} ramp_check_t;
+
+static void check_ramp(void *ctx, const frame_header_t *header, const uint8_t *payload) {
+	ramp_check_t *ramp = ctx;
+	static uint16_t decoded[0x10000];
+	const uint16_t *samples = (const uint16_t*)payload;
+	long count = header->length / 2;
+	static uint16_t next;
+	static uint32_t next_seq;
+
+	if (header->flags & FRAME_FLAG_RICE) {
+		count = rice_decode_payload(payload, header->length, decoded, 0x10000);
+		samples = decoded;
+		if (count <= 0) {
+			ramp->errors++;
+			return;
+		}
+	}
+	// Lost frames take their samples with them
+	if (header->flags & FRAME_FLAG_START || header->seq != next_seq) next = samples[0];
+	next_seq = header->seq + 1;
+	ramp->samples += count;
+	for (int i = 0; i < count; i++, next++) {
+		if (samples[i] != next) {
+			ramp->errors++;
+			next = samples[count - 1] + 1;
+			break;
+		}
+	}
+}
+
+// Framed stream through the host decoder, with one packet damaged on the way.
+// The time includes the decoder and the bit-wise CRC of mock_crc.c.
+static void framed(long iterations) {
+	static frame_decoder_t dec;
+	uint8_t packet[STREAM_PACKET];
+	const long damaged = iterations / 2 * 16 + 5;
+	ramp_check_t ramp = { 0 };
+	int result;
+
+	configure();
+	frame_decoder_init(&dec, USB_POOL_BLOCK_SIZE - sizeof(frame_header_t), check_ramp, &ramp);
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, STREAM_FRAMED, 0, NULL, 0);
+	CHECK(result == 0, "stream start: %d", result);
+
+	long packets = iterations * 16;
+	double start = now_ns();
+	for (long i = 0; i < packets; i++) {
+		result = read_stream_packet(packet);
+		CHECK(result == STREAM_PACKET, "packet %ld: %d", i, result);
+		if (i == damaged) packet[20] ^= 0x10;
+		frame_decoder_feed(&dec, packet, result);
+	}
+	double elapsed = now_ns() - start;
+
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, STREAM_OFF, 0, NULL, 0);
+	CHECK(result == 0, "stream stop: %d", result);
+	while (read_stream_packet(packet) >= 0);
+	CHECK(dec.frames == iterations - 1 && dec.restarts == 1, "%llu frames, %llu starts",
+			(unsigned long long)dec.frames, (unsigned long long)dec.restarts);
+	CHECK(dec.crc_errors == 1 && dec.lost == 1 && dec.out_of_order == 0,
+			"damaged frame: %llu CRC errors, %llu lost", (unsigned long long)dec.crc_errors,
+			(unsigned long long)dec.lost);
+	CHECK(ramp.errors == 0, "%ld frames off the ramp", ramp.errors);
+	report("framed", elapsed, packets, "packets");
+}
+
+// Rice coded frames, decoded and checked against the ramp
+static void compressed(long iterations) {
+	static frame_decoder_t dec;
+	uint8_t packet[STREAM_PACKET];
+	ramp_check_t ramp = { 0 };
+	long packets = 0;
+	int result;
+
+	configure();
+	frame_decoder_init(&dec, USB_POOL_BLOCK_SIZE - sizeof(frame_header_t), check_ramp, &ramp);
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, STREAM_COMPRESSED, 0, NULL, 0);
+	CHECK(result == 0, "stream start: %d", result);
+
+	double start = now_ns();
+	while (dec.frames < iterations) {
+		result = read_stream_packet(packet);
+		CHECK(result >= 0, "packet %ld: %d", packets, result);
+		frame_decoder_feed(&dec, packet, result);
+		packets++;
+	}
+	double elapsed = now_ns() - start;
+
+	result = sim_control_out(VENDOR_OUT, VENDOR_STREAM, STREAM_OFF, 0, NULL, 0);
+	CHECK(result == 0, "stream stop: %d", result);
+	while (read_stream_packet(packet) >= 0);
+	CHECK(dec.crc_errors == 0 && dec.lost == 0 && dec.skipped == 0, "%llu CRC errors, %llu lost",
+			(unsigned long long)dec.crc_errors, (unsigned long long)dec.lost);
+	CHECK(ramp.errors == 0, "%ld frames off the ramp or damaged", ramp.errors);
+	// A ramp has deltas of 1: Rice k = 1 gives 13 bytes per 32 samples
+	double ratio = 2.0 * ramp.samples / dec.bytes;
+	CHECK(ratio > 4, "compression %.2f", ratio);
+	report("compressed", elapsed, ramp.samples, "samples");
+}
+
+// Interrupt OUT packets echoed on the interrupt and the bulk IN endpoint
+static void loopback(long iterations) {
+	uint8_t payload[LOOPBACK_PAYLOAD], echo[64];
+	long round_trips = 0;
+	int result;
+
+	configure();
+	double start = now_ns();
+	for (int mode = LOOPBACK_INTR; mode <= LOOPBACK_BULK; mode++) {
+		uint8_t in_ep = (mode == LOOPBACK_INTR ? LOOPBACK_INTR_EP : LOOPBACK_BULK_EP) & 0x0F;
+
+		result = sim_control_out(VENDOR_OUT, VENDOR_LOOPBACK, mode, 0, NULL, 0);
+		CHECK(result == 0, "loopback mode %d: %d", mode, result);
+		for (long i = 0; i < iterations; i++) {
+			int length = 1 + i % LOOPBACK_PAYLOAD;
+
+			memset(payload, i, length);
+			result = SIM_NAK;
+			for (int try = 0; try < 100 && result == SIM_NAK; try++) {
+				result = sim_out(LOOPBACK_OUT_EP, payload, length);
+				if (result == SIM_NAK) sim_run();
+			}
+			CHECK(result == 0, "OUT packet %ld: %d", i, result);
+			result = SIM_NAK;
+			for (int try = 0; try < 100 && result == SIM_NAK; try++) {
+				result = sim_in(in_ep, echo, sizeof(echo));
+				if (result == SIM_NAK) sim_run();
+			}
+			const loopback_header_t *header = (const loopback_header_t*)echo;
+			CHECK(result == sizeof(loopback_header_t) + length && header->length == length,
+					"echo %ld: %d bytes", i, result);
+			CHECK(!memcmp(echo + sizeof(loopback_header_t), payload, length), "echo %ld differs", i);
+			round_trips++;
+		}
+	}
+	result = sim_control_out(VENDOR_OUT, VENDOR_LOOPBACK, LOOPBACK_OFF, 0, NULL, 0);
+	CHECK(result == 0, "loopback off: %d", result);
+	report("loopback", now_ns() - start, round_trips, "echoes");
+}
+
+// Reads one iso packet, running the main loop while there is none
+static int read_iso_packet(uint8_t *packet, int max) {
+	int result = SIM_NAK;
+
+	for (int try = 0; try < 100 && result == SIM_NAK; try++) {
+		result = sim_in(PATTERN_ISO_EP & 0x0F, packet, max);
+		if (result == SIM_NAK) sim_run();
+	}
+	return result;
+}
+
+// Checks a record of the pattern generator, returns its number or -1
+static long check_record(const uint8_t *record, uint16_t size, uint8_t ep_addr) {
+	const pattern_record_t *header = (const pattern_record_t*)record;
+
+	if (header->record_size != size || header->ep_addr != ep_addr) return -1;
+	for (int i = sizeof(pattern_record_t); i < size; i++) {
+		if (record[i] != (uint8_t)(header->seq + i)) return -1;
+	}
+	return header->seq;
+}
+
+// Pattern records on the bulk and the iso endpoint, checked byte by byte
+static void pattern(long iterations) {
+	pattern_config_t config = { .endpoints = PATTERN_BULK | PATTERN_ISO, .record_size = 100 };
+	pattern_status_t status;
+	uint8_t record[1024], packet[1024];
+	long records = 0;
+	int result;
+
+	configure();
+	result = sim_control_out(0x01, SET_INTERFACE, 1, 0, NULL, 0);
+	CHECK(result == 0, "SET_INTERFACE: %d", result);
+	result = sim_control_out(VENDOR_OUT, VENDOR_PATTERN, 0, 0, (const uint8_t*)&config, sizeof(config));
+	CHECK(result == sizeof(config), "pattern start: %d", result);
+
+	double start = now_ns();
+	long bulk_seq = 0, iso_seq = 0;
+	int filled = 0;
+	for (long i = 0; i < iterations; i++) {
+		// Bulk: records run across packet boundaries
+		while (bulk_seq <= i) {
+			result = read_stream_packet(packet);
+			CHECK(result > 0, "bulk packet: %d", result);
+			for (int j = 0; j < result; j++) {
+				record[filled++] = packet[j];
+				if (filled < config.record_size) continue;
+				long seq = check_record(record, config.record_size, PATTERN_BULK_EP);
+				CHECK(seq == bulk_seq, "bulk record %ld: got %ld", bulk_seq, seq);
+				bulk_seq++;
+				filled = 0;
+			}
+		}
+		// Iso: one record per packet
+		result = read_iso_packet(packet, sizeof(packet));
+		CHECK(result == config.record_size, "iso packet: %d", result);
+		long seq = check_record(packet, config.record_size, PATTERN_ISO_EP);
+		CHECK(seq == iso_seq, "iso record %ld: got %ld", iso_seq, seq);
+		iso_seq++;
+		records += 2;
+	}
+	double elapsed = now_ns() - start;
+
+	result = sim_control_in(VENDOR_IN, VENDOR_PATTERN_STATUS, 0, 0, (uint8_t*)&status, sizeof(status));
+	CHECK(result == sizeof(status) && status.version == PATTERN_STATUS_VERSION, "status: %d", result);
+	CHECK(status.endpoints == config.endpoints && status.sent[1] == iso_seq, "status: running 0x%02X, %u iso records",
+			status.endpoints, status.sent[1]);
+	result = sim_control_out(VENDOR_OUT, VENDOR_PATTERN, 0, 0, NULL, 0);
+	CHECK(result == 0, "pattern stop: %d", result);
+	sim_control_out(0x01, SET_INTERFACE, 0, 0, NULL, 0);
+	while (read_stream_packet(packet) >= 0);
+	report("pattern", elapsed, records, "records");
+}
+
+// Iso pattern with every other frame missed: the HAL aborts the armed
+// transfer, its record is lost and the next one goes out
+static void iso_missed(long iterations) {
+	pattern_config_t config = { .endpoints = PATTERN_ISO, .record_size = 100 };
+	pattern_status_t status;
+	uint8_t packet[1024];
+	long received = 0, expected_seq = 0;
+	int result;
+
+	configure();
+	result = sim_control_out(0x01, SET_INTERFACE, 1, 0, NULL, 0);
+	CHECK(result == 0, "SET_INTERFACE: %d", result);
+	result = sim_control_out(VENDOR_OUT, VENDOR_PATTERN, 0, 0, (const uint8_t*)&config, sizeof(config));
+	CHECK(result == sizeof(config), "pattern start: %d", result);
+
+	double start = now_ns();
+	for (long i = 0; i < iterations; i++) {
+		result = read_iso_packet(packet, sizeof(packet));
+		CHECK(result == config.record_size, "iso packet %ld: %d", i, result);
+		long seq = check_record(packet, config.record_size, PATTERN_ISO_EP);
+		CHECK(seq == expected_seq, "iso record %ld: got %ld", expected_seq, seq);
+		received++;
+
+		sim_run();
+		CHECK(sim_iso_in_incomplete(PATTERN_ISO_EP & 0x0F), "no iso transfer armed to miss");
+		expected_seq = seq + 2;
+	}
+	double elapsed = now_ns() - start;
+
+	result = sim_control_in(VENDOR_IN, VENDOR_PATTERN_STATUS, 0, 0, (uint8_t*)&status, sizeof(status));
+	CHECK(result == sizeof(status), "status: %d", result);
+	CHECK(status.sent[1] == received, "%u iso records counted as sent, %ld received", status.sent[1], received);
+	sim_control_out(VENDOR_OUT, VENDOR_PATTERN, 0, 0, NULL, 0);
+	sim_control_out(0x01, SET_INTERFACE, 0, 0, NULL, 0);
+	sim_run();
+	CHECK(usb_pool_free() == USB_POOL_BLOCKS, "%u of %d pool blocks back", usb_pool_free(), USB_POOL_BLOCKS);
+	CHECK(usb_pool_double_releases() == 0, "%u pool blocks released twice", usb_pool_double_releases());
+	report("iso_missed", elapsed, received, "records");
+}
+
+/* Frame model scenarios */
+
+static uint16_t expected_sample;
+static int is_first_packet;
+static int stream_errors;
+
+static void check_stream(uint8_t ep_num, const uint8_t *data, int length) {
+	const uint16_t *samples = (const uint16_t*)data;
+
+	if (ep_num != (STREAM_EP & 0x0F)) return;
+	if (is_first_packet) expected_sample = samples[0];
+	is_first_packet = 0;
+	for (int i = 0; i < length / 2; i++, expected_sample++) {
+		if (samples[i] != expected_sample && !stream_errors++) {
+			printf("Stream sample %u, expected %u\n", samples[i], expected_sample);
+		}
+	}
+}
+
+static int start_model_stream(void) {
+	configure();
+	if (sim_control_out(VENDOR_OUT, VENDOR_STREAM, 1, 0, NULL, 0) != 0) return -1;
+	model_config.in_data = check_stream;
+	model_init(&model_config);
+	model_host_read(STREAM_EP & 0x0F, MODEL_UNLIMITED);
+	is_first_packet = 1;
+	stream_errors = 0;
+	return 0;
+}
+
+static void stop_model_stream(void) {
+	uint8_t packet[STREAM_PACKET];
+
+	sim_control_out(VENDOR_OUT, VENDOR_STREAM, 0, 0, NULL, 0);
+	while (read_stream_packet(packet) >= 0);
+}
+
+static void throughput(long iterations) {
+	model_stats_t stats = { 0 };
+
+	CHECK(start_model_stream() == 0, "stream start");
+	model_run(iterations, &stats);
+	stop_model_stream();
+	printf("throughput, bulk stream alone\n");
+	model_print(&stats);
+	CHECK(!stream_errors, "%d stream samples out of order", stream_errors);
+	CHECK(stats.in[STREAM_EP & 0x0F].packets, "no stream data");
+}
+
+// Sampling source for the iso endpoint: two packets queued at any time
+static uint16_t iso_packet;
+
+static void iso_sent(uint8_t ep_addr, uint8_t *buff, uint32_t length, usb_xfer_status_t status) {
+	usb_pool_release(buff);
+}
+
+static void iso_frame_start(uint32_t frame) {
+	while (usb_queue_space(USB_ISO_EP) > USB_QUEUE_DEPTH - 2) {
+		uint8_t *block = usb_pool_acquire();
+
+		if (!block) return;
+		memset(block, frame, iso_packet);
+		if (usb_queue_submit(USB_ISO_EP, block, iso_packet, iso_sent) != HAL_OK) {
+			usb_pool_release(block);
+			return;
+		}
+	}
+}
+
+#define ISO_ALT(alt, mps) { alt, mps },
+static const struct {
+	uint8_t alt;
+	uint16_t mps;
+} iso_alts[] = { USB_ISO_ALT_SETTINGS(ISO_ALT) };
+
+// Every alternate setting, with the bulk stream sharing the bus
+static void iso(long iterations) {
+	for (int i = 0; i < sizeof(iso_alts) / sizeof(iso_alts[0]); i++) {
+		model_stats_t stats = { 0 };
+
+		CHECK(start_model_stream() == 0, "stream start");
+		CHECK(sim_control_out(0x01, SET_INTERFACE, iso_alts[i].alt, 0, NULL, 0) == 0, "SET_INTERFACE %d",
+				iso_alts[i].alt);
+		iso_packet = iso_alts[i].mps;
+		model_config.frame_start = iso_frame_start;
+		model_init(&model_config);
+		model_host_read(STREAM_EP & 0x0F, MODEL_UNLIMITED);
+		model_run(iterations, &stats);
+		model_config.frame_start = 0;
+		sim_control_out(0x01, SET_INTERFACE, 0, 0, NULL, 0);
+		stop_model_stream();
+
+		printf("iso, alternate setting %d, %d byte packets, with the bulk stream\n", iso_alts[i].alt, iso_packet);
+		model_print(&stats);
+		CHECK(!stream_errors, "%d stream samples out of order", stream_errors);
+		// Every frame sends a packet or misses one: a missed frame must not stall the endpoint
+		const model_ep_stats_t *iso_stats = &stats.in[USB_ISO_EP & 0x0F];
+		CHECK(iso_stats->packets + iso_stats->missed == stats.frames, "iso: %u packets and %u missed in %u frames",
+				iso_stats->packets, iso_stats->missed, stats.frames);
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(long iterations);
+} scenarios[] = {
+	{ "enumerate", enumerate },
+	{ "vendor", vendor },
+	{ "stream", stream },
+	{ "framed", framed },
+	{ "compressed", compressed },
+	{ "loopback", loopback },
+	{ "pattern", pattern },
+	{ "iso_missed", iso_missed },
+	{ "throughput", throughput },
+	{ "iso", iso },
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+int main(int argc, char **argv) {
+	long iterations = 1000;
+	int first = 1;
+
+	model_config = model_default_config;
+
+	while (first < argc && argv[first][0] == '-') {
+		if (!strcmp(argv[first], "-v")) {
+			sim_verbose = 1;
+			first++;
+		} else if (!strcmp(argv[first], "-n") && first + 1 < argc) {
+			iterations = atol(argv[first + 1]);
+			first += 2;
+		} else if (!strcmp(argv[first], "-i") && first + 1 < argc) {
+			model_config.isr_cycles = atol(argv[first + 1]);
+			first += 2;
+		} else if (!strcmp(argv[first], "-c") && first + 1 < argc) {
+			model_config.copy_cycles = atol(argv[first + 1]);
+			first += 2;
+		} else if (!strcmp(argv[first], "-t") && first + 1 < argc) {
+			model_config.task_cycles = atol(argv[first + 1]);
+			first += 2;
+		} else {
+			printf("Usage: %s [-v] [-n iterations] [-i isr] [-c copy] [-t task] [scenario...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 1) iterations = 1;
+
+	sim_init();
+	for (int i = 0; i < NUM_SCENARIOS; i++) {
+		int selected = first == argc;
+
+		for (int j = first; j < argc; j++) {
+			if (!strcmp(argv[j], scenarios[i].name)) selected = 1;
+		}
+		if (selected) scenarios[i].run(iterations);
+	}
+	for (int j = first; j < argc; j++) {
+		int known = 0;
+
+		for (int i = 0; i < NUM_SCENARIOS; i++) {
+			if (!strcmp(argv[j], scenarios[i].name)) known = 1;
+		}
+		if (!known) {
+			printf("Unknown scenario %s\n", argv[j]);
+			failures++;
+		}
+	}
+
+	if (failures || sim_errors) {
+		printf("%d failed checks, %d PCD misuses\n", failures, sim_errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,57 @@
+// Switches the clock profile of the board (Core/Inc/clock.h).
+//
+// The board runs the switch in its command task and answers the request
+// once it is done; it logs the new HCLK and the USB cycle budget under
+// each profile on its debug output. Read irq_stats afterwards to see
+// the interrupt cost at the new clock.
+//
+// Usage: clock_profile performance|low_power
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <libusb.h>
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_CLOCK 0x23
+#define TIMEOUT_MS 1000
+
+// Indexed by clock_profile_t
+static const char *profile_names[] = { "performance", "low_power" };
+#define NUM_PROFILES (sizeof(profile_names) / sizeof(profile_names[0]))
+
+int main(int argc, char **argv) {
+    libusb_device_handle *dev;
+    unsigned profile = NUM_PROFILES;
+    int ret;
+
+    for (unsigned i = 0; argc == 2 && i < NUM_PROFILES; i++) {
+        if (strcmp(argv[1], profile_names[i]) == 0) profile = i;
+    }
+    if (profile == NUM_PROFILES) {
+        printf("Usage: %s performance|low_power\n", argv[0]);
+        return 1;
+    }
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+
+    ret = libusb_control_transfer(dev, 0x40, VENDOR_CLOCK, profile, 0, NULL, 0, TIMEOUT_MS);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    if (ret < 0) {
+        printf("Request failed: %s\n", libusb_error_name(ret));
+        return 1;
+    }
+    printf("Clock profile %s requested\n", profile_names[profile]);
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Times the frame CRC (frame_crc.c) in each version, and the whole frame
+// decoder (frame_decode.c), on one core of this host in GB/s.
+//
+// The sizes are a frame payload, a bulk transfer of the tools and a large
+// buffer. Every version is checked against the bit-wise one first. The
+// decoder runs on a stream of frames as the board sends them (1008 byte
+// payloads), fed in 16 kB pieces as the libusb tools or a read() on the
+// kernel driver would hand them over. A full-speed board sends at most
+// about 1.2 MB/s, so this is the number of boards one core keeps up with.
+//
+// Usage: crc_bench [megabytes per case]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "frame_crc.h"
+#include "frame_decode.h"
+
+#define PAYLOAD 1008
+#define PIECE 16384
+#define BOARD_RATE 1.216e6     // Bytes/s of one board, bulk alone (Host_Sim throughput)
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const uint8_t *data, size_t length);
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping the calls
+static volatile uint32_t sink;
+
+static double time_crc(crc_fn crc, const uint8_t *data, size_t size, double total) {
+    long iterations = total / size + 1;
+    uint32_t result = 0xFFFFFFFF;
+
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        result = crc(result, data, size);
+    }
+    double elapsed = now_ns() - start;
+    sink = result;
+    return (double)iterations * size / elapsed;
+}
+
+// Frames with a ramp as payload, like the board's stream
+static size_t make_stream(uint8_t *stream, size_t size) {
+    size_t length = 0;
+
+    for (uint32_t seq = 0; length + sizeof(frame_header_t) + PAYLOAD <= size; seq++) {
+        frame_header_t header = { FRAME_SYNC, PAYLOAD, seq, seq & 0x7FF, seq ? 0 : FRAME_FLAG_START, 0 };
+        uint8_t *frame = stream + length;
+
+        for (int i = 0; i < PAYLOAD / 2; i++) {
+            uint16_t sample = seq * (PAYLOAD / 2) + i;
+            memcpy(frame + sizeof(header) + 2 * i, &sample, 2);
+        }
+        memcpy(frame, &header, sizeof(header));
+        header.crc = frame_crc(0xFFFFFFFF, frame, offsetof(frame_header_t, crc));
+        header.crc = frame_crc(header.crc, frame + sizeof(header), PAYLOAD);
+        memcpy(frame, &header, sizeof(header));
+        length += sizeof(header) + PAYLOAD;
+    }
+    return length;
+}
+
+int main(int argc, char **argv) {
+    double total = (argc > 1 ? atof(argv[1]) : 256) * 1e6;
+    const size_t sizes[] = { PAYLOAD, PIECE, 1 << 20 };
+    const struct {
+        const char *name;
+        crc_fn crc;
+    } versions[] = {
+        { "bitwise", frame_crc_bitwise },
+        { "slice8", frame_crc_slice8 },
+        { "pclmul", frame_crc_pclmul },
+    };
+    int count = frame_crc_has_pclmul() ? 3 : 2;
+    uint8_t *data = malloc(1 << 20);
+    static frame_decoder_t dec;
+
+    for (int i = 0; i < 1 << 20; i++) {
+        data[i] = rand();
+    }
+    for (int v = 1; v < count; v++) {
+        for (size_t length = 0; length <= 4096; length += 4) {
+            if (versions[v].crc(0xFFFFFFFF, data, length) != frame_crc_bitwise(0xFFFFFFFF, data, length)) {
+                printf("MISMATCH in %s at %zu bytes\n", versions[v].name, length);
+                return 1;
+            }
+        }
+    }
+
+    printf("frame_crc uses %s\n", frame_crc_name());
+    printf("%-8s %10s %10s %10s  GB/s\n", "version", "1008 B", "16 kB", "1 MB");
+    for (int v = 0; v < count; v++) {
+        // The bit-wise version is only the reference, a short run is enough
+        double amount = v == 0 ? total / 64 : total;
+
+        printf("%-8s", versions[v].name);
+        for (int s = 0; s < 3; s++) {
+            printf(" %10.3f", time_crc(versions[v].crc, data, sizes[s], amount));
+        }
+        printf("\n");
+    }
+
+    size_t length = make_stream(data, 1 << 20);
+    long rounds = total / length + 1;
+    double start = now_ns();
+    for (long r = 0; r < rounds; r++) {
+        frame_decoder_init(&dec, PAYLOAD, NULL, NULL);
+        for (size_t offset = 0; offset < length; offset += PIECE) {
+            frame_decoder_feed(&dec, data + offset, length - offset < PIECE ? length - offset : PIECE);
+        }
+    }
+    double rate = (double)rounds * length / (now_ns() - start);
+    if (dec.crc_errors || dec.skipped || dec.lost || dec.frames != length / (sizeof(frame_header_t) + PAYLOAD)) {
+        printf("Decoder failed on the reference stream\n");
+        return 1;
+    }
+    printf("decoder  %10.3f GB/s, %.0f boards per core\n", rate, rate * 1e9 / BOARD_RATE);
+    return 0;
+}
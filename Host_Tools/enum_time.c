@@ -0,0 +1,103 @@
+// Measures how long the board takes to become usable after a bus reset.
+//
+// The device is reset through libusb, which makes the host go through the
+// whole enumeration again: reset, SET_ADDRESS, descriptors, SET_CONFIGURATION.
+// The time is taken until GET_CONFIGURATION reports configuration 1 and the
+// vendor IN request answers. If the device drops off the bus and comes back
+// as a new device, enumeration did not succeed in one pass.
+//
+// Usage: enum_time [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <libusb.h>
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_USB_STATS 0x11
+#define STATS_HEADER_LEN 4
+#define TIMEOUT_MS 1000
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Returns 0 once the device is configured and answers vendor requests
+static int check_configured(libusb_device_handle *dev) {
+    unsigned char buff[STATS_HEADER_LEN];
+    unsigned char config = 0;
+    int ret;
+
+    // GET_CONFIGURATION
+    ret = libusb_control_transfer(dev, 0x80, 0x08, 0, 0, &config, 1, TIMEOUT_MS);
+    if (ret != 1 || config != 1) return -1;
+
+    // Same request the kernel driver sends on read, only the header is needed
+    ret = libusb_control_transfer(dev, 0xC0, VENDOR_USB_STATS, 0, 0, buff, sizeof(buff), TIMEOUT_MS);
+    if (ret < 0) return -1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10;
+    double min = 1e9, max = 0, total = 0;
+    int passes = 0, retries = 0;
+    libusb_device_handle *dev;
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        double start = now_ms();
+        int ret = libusb_reset_device(dev);
+
+        if (ret == LIBUSB_ERROR_NOT_FOUND) {
+            // Re-enumerated as a new device: the first pass failed
+            retries++;
+            libusb_close(dev);
+            while (!(dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID))) {
+                if (now_ms() - start > 10 * TIMEOUT_MS) {
+                    printf("Device lost\n");
+                    return 1;
+                }
+            }
+        } else if (ret < 0) {
+            printf("Reset failed: %s\n", libusb_error_name(ret));
+            return 1;
+        }
+
+        while (check_configured(dev) != 0) {
+            if (now_ms() - start > 10 * TIMEOUT_MS) {
+                printf("Device not configured\n");
+                return 1;
+            }
+        }
+
+        double elapsed = now_ms() - start;
+        printf("Pass %d: configured in %.2f ms%s\n", i, elapsed,
+            ret == LIBUSB_ERROR_NOT_FOUND ? " (re-enumerated)" : "");
+        if (elapsed < min) min = elapsed;
+        if (elapsed > max) max = elapsed;
+        total += elapsed;
+        passes++;
+    }
+
+    printf("Time to configured: min %.2f ms, avg %.2f ms, max %.2f ms\n",
+        min, total / passes, max);
+    printf("Single-pass enumerations: %d of %d\n", passes - retries, passes);
+
+    libusb_close(dev);
+    libusb_exit(NULL);
+    return retries ? 2 : 0;
+}
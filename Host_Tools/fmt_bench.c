@@ -0,0 +1,76 @@
+// Times the firmware formatter (Device_M4/Core/Src/fmt.c) against the C
+// library snprintf on the host, with the format strings the firmware logs.
+//
+// snprintf against fmt_snprintf into a buffer times only the formatting.
+// fprintf to /dev/null against fmt_printf adds the path to the output:
+// the FILE buffer on one side, the stack chunk (or the direct write of
+// plain text) and a _write that drops the bytes on the other. The output
+// of every case is compared first. These are host numbers: for the
+// Cortex-M4 run the fmt_* and newlib_* cases of Bench_M4, and compare
+// flash and RAM use in the map file (map_report.sh).
+//
+// Usage: fmt_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fmt.h"
+
+// fmt_printf writes here, the log ring on the target
+int _write(int file, char *ptr, int len) {
+    return len;
+}
+
+static FILE *null_out;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define TIME(expr, iterations) ({ \
+    double start_ = now_ns(); \
+    for (long i_ = 0; i_ < (iterations); i_++) { expr; } \
+    (now_ns() - start_) / (iterations); })
+
+// Keeps the compiler from dropping the calls
+static volatile int sink;
+
+#define BENCH(name, ...) do { \
+    char ref[128], out[128]; \
+    int ref_len = snprintf(ref, sizeof(ref), __VA_ARGS__); \
+    int out_len = fmt_snprintf(out, sizeof(out), __VA_ARGS__); \
+    if (ref_len != out_len || strcmp(ref, out)) { \
+        printf("MISMATCH in %s: \"%s\" / \"%s\"\n", name, ref, out); \
+        exit(1); \
+    } \
+    double libc = TIME(sink += snprintf(ref, sizeof(ref), __VA_ARGS__), iterations); \
+    double fmt = TIME(sink += fmt_snprintf(out, sizeof(out), __VA_ARGS__), iterations); \
+    double libc_printf = TIME(sink += fprintf(null_out, __VA_ARGS__), iterations); \
+    double fmt_printf_ = TIME(sink += fmt_printf(__VA_ARGS__), iterations); \
+    printf("%-10s %10.1f %10.1f %7.2fx %10.1f %10.1f %7.2fx\n", name, libc, fmt, libc / fmt, \
+            libc_printf, fmt_printf_, libc_printf / fmt_printf_); \
+} while (0)
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    volatile int value = 168, negative = -1234;
+    const char *volatile name = "performance";
+
+    null_out = fopen("/dev/null", "w");
+    if (!null_out) return 1;
+    printf("%-10s %10s %10s %8s %10s %10s %8s\n", "case", "snprintf", "fmt", "speedup",
+            "fprintf", "fmt_printf", "speedup");
+    // Without conversions the compiler turns the snprintf call into a copy
+    // and the fprintf call into fputs
+    BENCH("text", "Setup stage\n");
+    BENCH("refused", "Pattern configuration refused\n");
+    BENCH("setup", "0x%02X 0x%02X 0x%02X 0x%02X ", value, value >> 1, value >> 2, value >> 3);
+    BENCH("decimal", "Control OUT request with value %i, %i bytes\n", value, negative);
+    BENCH("clock", "Clock profile %s: HCLK %i MHz, %i wait states, prefetch %s, caches I%s/D%s\n",
+            name, value, 5, "on", "+", "+");
+    BENCH("padding", "%-8s|%8i|%08X|%5u\n", name, negative, value, (unsigned)value);
+    return 0;
+}
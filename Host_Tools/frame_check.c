@@ -0,0 +1,205 @@
+// Reads the framed sample stream (Core/Inc/frame.h) and checks it: the CRC
+// of every frame, gaps in the frame numbers, and the sample ramp across
+// frames. Reports the payload rate, the share of the bus bytes the headers
+// take, and how fast the decoder itself runs on this host.
+//
+// With -c the board sends Rice coded frames (Core/Inc/rice.h), which are
+// decoded before the ramp check; the rate is then in samples.
+//
+// Usage: frame_check [-c] [-t seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <libusb.h>
+#include "frame_decode.h"
+#include "rice_decode.h"
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_STREAM 0x20
+#define STREAM_OFF 0
+#define STREAM_FRAMED 2
+#define STREAM_COMPRESSED 3
+
+#define STREAM_EP 0x82
+#define MAX_PAYLOAD 1008        // Pool block less the header
+#define TRANSFERS 8
+#define TRANSFER_SIZE 16384
+#define TIMEOUT_MS 1000
+
+typedef struct {
+    uint32_t next_seq;
+    uint16_t next_sample;
+    int has_sample;
+    uint64_t samples;
+    uint64_t sample_errors;     // Frames whose samples do not continue the ramp or do not decode
+} ramp_t;
+
+static frame_decoder_t dec;
+static ramp_t ramp;
+static double decode_s;
+static uint64_t transfer_errors;
+static struct libusb_transfer *transfers[TRANSFERS];   // 0 once freed
+static int running;
+static int pending;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_samples(void *ctx, const frame_header_t *header, const uint8_t *payload) {
+    static uint16_t decoded[0x10000];
+    ramp_t *ramp = ctx;
+    long count = header->length / 2;
+    uint16_t sample;
+
+    if (header->flags & FRAME_FLAG_RICE) {
+        count = rice_decode_payload(payload, header->length, decoded, 0x10000);
+        if (count <= 0) {
+            ramp->sample_errors++;
+            return;
+        }
+        payload = (const uint8_t*)decoded;
+    }
+    ramp->samples += count;
+
+    // After a start or lost frames the ramp picks up where this frame is
+    memcpy(&sample, payload, 2);
+    if (!ramp->has_sample || header->flags & FRAME_FLAG_START || header->seq != ramp->next_seq) {
+        ramp->next_sample = sample;
+    }
+    for (int i = 0; i < count; i++, ramp->next_sample++) {
+        memcpy(&sample, payload + 2 * i, 2);
+        if (sample != ramp->next_sample) {
+            ramp->sample_errors++;
+            break;
+        }
+    }
+    memcpy(&sample, payload + 2 * count - 2, 2);
+    ramp->next_sample = sample + 1;
+    ramp->next_seq = header->seq + 1;
+    ramp->has_sample = 1;
+}
+
+static void LIBUSB_CALL transfer_done(struct libusb_transfer *transfer) {
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        double start = now_s();
+        frame_decoder_feed(&dec, transfer->buffer, transfer->actual_length);
+        decode_s += now_s() - start;
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        transfer_errors++;
+    }
+
+    if (running && libusb_submit_transfer(transfer) == 0) return;
+    // libusb frees it on return
+    for (int i = 0; i < TRANSFERS; i++) {
+        if (transfers[i] == transfer) transfers[i] = NULL;
+    }
+    pending--;
+}
+
+int main(int argc, char **argv) {
+    int seconds = 10, format = STREAM_FRAMED;
+    libusb_device_handle *dev;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "ct:")) != -1) {
+        if (opt == 'c') format = STREAM_COMPRESSED;
+        else if (opt == 't') seconds = atoi(optarg);
+        else {
+            printf("Usage: %s [-c] [-t seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 1) {
+        printf("Time must be at least 1 s\n");
+        return 1;
+    }
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+    libusb_set_auto_detach_kernel_driver(dev, 1);
+    if (libusb_claim_interface(dev, 0) < 0) {
+        printf("Cannot claim interface 0\n");
+        return 1;
+    }
+
+    frame_decoder_init(&dec, MAX_PAYLOAD, check_samples, &ramp);
+    ret = libusb_control_transfer(dev, 0x40, VENDOR_STREAM, format, 0, NULL, 0, TIMEOUT_MS);
+    if (ret < 0) {
+        printf("Cannot start the stream: %s\n", libusb_error_name(ret));
+        return 1;
+    }
+    running = 1;
+    for (int i = 0; i < TRANSFERS; i++) {
+        struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+
+        libusb_fill_bulk_transfer(transfer, dev, STREAM_EP, malloc(TRANSFER_SIZE), TRANSFER_SIZE,
+                transfer_done, NULL, 0);
+        transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+        if ((ret = libusb_submit_transfer(transfer)) < 0) {
+            printf("Cannot submit transfer: %s\n", libusb_error_name(ret));
+            libusb_free_transfer(transfer);
+            break;
+        }
+        transfers[i] = transfer;
+        pending++;
+    }
+
+    double start = now_s();
+    while (ret >= 0 && now_s() - start < seconds) {
+        struct timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout(NULL, &tv);
+    }
+    double elapsed = now_s() - start;
+
+    libusb_control_transfer(dev, 0x40, VENDOR_STREAM, STREAM_OFF, 0, NULL, 0, TIMEOUT_MS);
+    running = 0;
+    for (int i = 0; i < TRANSFERS; i++) {
+        if (transfers[i]) libusb_cancel_transfer(transfers[i]);
+    }
+    while (pending > 0) {
+        struct timeval tv = { 0, 100000 };
+        libusb_handle_events_timeout(NULL, &tv);
+    }
+    libusb_release_interface(dev, 0);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    if (ret < 0 || dec.bytes == 0) {
+        printf("No data\n");
+        return 1;
+    }
+
+    printf("%llu frames, %.3f MB/s payload, headers %.2f%% of the bytes\n",
+            (unsigned long long)dec.frames, dec.payload_bytes / elapsed / 1e6,
+            100.0 * (dec.bytes - dec.payload_bytes) / dec.bytes);
+    if (format == STREAM_COMPRESSED) {
+        printf("%.3f Msamples/s, compressed %.2f:1 with the headers\n", ramp.samples / elapsed / 1e6,
+                2.0 * ramp.samples / dec.bytes);
+    }
+    printf("CRC errors %llu, lost %llu, out of order %llu, bytes skipped %llu, ramp errors %llu, "
+            "failed transfers %llu\n",
+            (unsigned long long)dec.crc_errors, (unsigned long long)dec.lost,
+            (unsigned long long)dec.out_of_order, (unsigned long long)dec.skipped,
+            (unsigned long long)ramp.sample_errors, (unsigned long long)transfer_errors);
+    printf("Decoder: %.1f MB/s on this host\n", dec.bytes / decode_s / 1e6);
+
+    // Skipped bytes alone are not an error: a raw stream still queued before the start is skipped too
+    uint64_t errors = dec.crc_errors + dec.lost + dec.out_of_order + ramp.sample_errors + transfer_errors;
+    if (errors) printf("Stream check failed\n");
+    return errors != 0;
+}
@@ -0,0 +1,164 @@
+// CRC of the STM32 CRC unit, see frame_crc.h
+
+#include <string.h>
+#include "frame_crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86 1
+#endif
+
+#define POLY 0x04C11DB7
+
+// table[k][b]: CRC of byte b followed by k zero bytes
+static uint32_t table[8][256];
+
+static void make_table(void) {
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = (uint32_t)b << 24;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x80000000 ? crc << 1 ^ POLY : crc << 1;
+        }
+        table[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            table[k][b] = table[k - 1][b] << 8 ^ table[0][table[k - 1][b] >> 24];
+        }
+    }
+}
+
+static uint32_t load32(const uint8_t *p) {
+    uint32_t word;
+    memcpy(&word, p, 4);
+    return word;
+}
+
+uint32_t frame_crc_bitwise(uint32_t crc, const uint8_t *data, size_t length) {
+    for (; length >= 4; data += 4, length -= 4) {
+        crc ^= load32(data);
+        for (int i = 0; i < 32; i++) {
+            crc = crc & 0x80000000 ? crc << 1 ^ POLY : crc << 1;
+        }
+    }
+    return crc;
+}
+
+uint32_t frame_crc_slice8(uint32_t crc, const uint8_t *data, size_t length) {
+    // Each little-endian word goes in most significant byte first
+    for (; length >= 8; data += 8, length -= 8) {
+        uint32_t high = crc ^ load32(data), low = load32(data + 4);
+        crc = table[7][high >> 24] ^ table[6][high >> 16 & 0xFF] ^
+                table[5][high >> 8 & 0xFF] ^ table[4][high & 0xFF] ^
+                table[3][low >> 24] ^ table[2][low >> 16 & 0xFF] ^
+                table[1][low >> 8 & 0xFF] ^ table[0][low & 0xFF];
+    }
+    if (length >= 4) {
+        uint32_t word = crc ^ load32(data);
+        crc = table[3][word >> 24] ^ table[2][word >> 16 & 0xFF] ^
+                table[1][word >> 8 & 0xFF] ^ table[0][word & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef HAS_X86
+
+// x^n mod P
+static uint64_t xpow_mod(int n) {
+    uint64_t r = 1;
+    while (n--) {
+        r <<= 1;
+        if (r >> 32) r ^= (uint64_t)1 << 32 | POLY;
+    }
+    return r;
+}
+
+// Folding constants: x^(n + 64) mod P high, x^n mod P low
+static __m128i fold_128, fold_512;
+
+__attribute__((target("sse2")))
+static void make_constants(void) {
+    fold_128 = _mm_set_epi64x(xpow_mod(128 + 64), xpow_mod(128));
+    fold_512 = _mm_set_epi64x(xpow_mod(512 + 64), xpow_mod(512));
+}
+
+// 16 bytes as the polynomial the CRC sees: the first word is the high end
+__attribute__((target("sse2")))
+static inline __m128i load128(const uint8_t *p) {
+    return _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)p), 0x1B);
+}
+
+// a * x^n + b, n being the distance of k
+__attribute__((target("pclmul,sse2")))
+static inline __m128i fold(__m128i a, __m128i k, __m128i b) {
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11), _mm_clmulepi64_si128(a, k, 0x00)), b);
+}
+
+__attribute__((target("pclmul,sse2")))
+uint32_t frame_crc_pclmul(uint32_t crc, const uint8_t *data, size_t length) {
+    uint8_t rest[16];
+
+    if (length < 64) return frame_crc_slice8(crc, data, length);
+
+    // Four lanes 64 bytes apart; the CRC so far goes into the first word
+    __m128i x0 = _mm_xor_si128(load128(data), _mm_set_epi32(crc, 0, 0, 0));
+    __m128i x1 = load128(data + 16);
+    __m128i x2 = load128(data + 32);
+    __m128i x3 = load128(data + 48);
+    for (data += 64, length -= 64; length >= 64; data += 64, length -= 64) {
+        x0 = fold(x0, fold_512, load128(data));
+        x1 = fold(x1, fold_512, load128(data + 16));
+        x2 = fold(x2, fold_512, load128(data + 32));
+        x3 = fold(x3, fold_512, load128(data + 48));
+    }
+    x0 = fold(x0, fold_128, x1);
+    x0 = fold(x0, fold_128, x2);
+    x0 = fold(x0, fold_128, x3);
+    for (; length >= 16; data += 16, length -= 16) {
+        x0 = fold(x0, fold_128, load128(data));
+    }
+
+    // What is left is a 128-bit message: its CRC from 0, then the tail
+    _mm_storeu_si128((__m128i*)rest, _mm_shuffle_epi32(x0, 0x1B));
+    crc = frame_crc_slice8(0, rest, sizeof(rest));
+    return frame_crc_slice8(crc, data, length);
+}
+
+int frame_crc_has_pclmul(void) {
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+}
+
+#else
+
+uint32_t frame_crc_pclmul(uint32_t crc, const uint8_t *data, size_t length) {
+    return frame_crc_slice8(crc, data, length);
+}
+
+int frame_crc_has_pclmul(void) {
+    return 0;
+}
+
+#endif
+
+static uint32_t (*best)(uint32_t crc, const uint8_t *data, size_t length);
+
+// Before main, so threads decoding streams never race on the tables
+__attribute__((constructor))
+static void init(void) {
+    make_table();
+    best = frame_crc_slice8;
+#ifdef HAS_X86
+    if (frame_crc_has_pclmul()) {
+        make_constants();
+        best = frame_crc_pclmul;
+    }
+#endif
+}
+
+uint32_t frame_crc(uint32_t crc, const uint8_t *data, size_t length) {
+    return best(crc, data, length);
+}
+
+const char *frame_crc_name(void) {
+    return best == frame_crc_pclmul ? "pclmul" : "slice8";
+}
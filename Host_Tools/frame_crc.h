@@ -0,0 +1,27 @@
+#ifndef FRAME_CRC_H
+#define FRAME_CRC_H
+
+// CRC of the STM32 CRC unit, as in the frames of the firmware stream
+// (Core/Inc/frame.h): polynomial 0x04C11DB7, MSB first, no reflection or
+// final XOR, fed little-endian 32-bit words. Start with crc 0xFFFFFFFF
+// and chain calls to cover pieces; length is a multiple of 4.
+//
+// frame_crc uses the fastest version the CPU has, picked at startup.
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t frame_crc(uint32_t crc, const uint8_t *data, size_t length);
+
+// The versions behind frame_crc, for tests and benchmarks
+uint32_t frame_crc_bitwise(uint32_t crc, const uint8_t *data, size_t length);
+uint32_t frame_crc_slice8(uint32_t crc, const uint8_t *data, size_t length);
+// Carry-less multiply folding (PCLMULQDQ), falls back to slice-by-8 for
+// short data. Only call it if frame_crc_has_pclmul().
+uint32_t frame_crc_pclmul(uint32_t crc, const uint8_t *data, size_t length);
+int frame_crc_has_pclmul(void);
+
+// Name of the version frame_crc uses
+const char *frame_crc_name(void);
+
+#endif /* FRAME_CRC_H */
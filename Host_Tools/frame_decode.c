@@ -0,0 +1,93 @@
+// Decoder for the framed bulk stream, see frame_decode.h
+
+#include <string.h>
+#include "frame_decode.h"
+
+void frame_decoder_init(frame_decoder_t *dec, uint16_t max_length, frame_payload_fn payload, void *ctx) {
+    memset(dec, 0, offsetof(frame_decoder_t, buff));
+    dec->payload = payload;
+    dec->ctx = ctx;
+    dec->max_length = max_length && max_length < FRAME_MAX_PAYLOAD ? max_length : FRAME_MAX_PAYLOAD;
+}
+
+static void accept(frame_decoder_t *dec, const frame_header_t *header, const uint8_t *payload) {
+    int32_t gap = (int32_t)(header->seq - dec->next_seq);
+
+    if (header->flags & FRAME_FLAG_START) dec->restarts++;
+    else if (gap > 0 && dec->frames) dec->lost += gap;
+    else if (gap < 0) dec->out_of_order++;
+    dec->next_seq = header->seq + 1;
+    dec->frames++;
+    dec->payload_bytes += header->length;
+    dec->in_sync = 1;
+    if (dec->payload) dec->payload(dec->ctx, header, payload);
+}
+
+static int is_header(const frame_decoder_t *dec, const frame_header_t *header) {
+    return header->sync == FRAME_SYNC && header->length % 4 == 0 && header->length <= dec->max_length;
+}
+
+// Takes whole frames and bytes that cannot start one from data, stops at
+// a frame that is not complete yet. Returns the bytes used.
+static size_t decode(frame_decoder_t *dec, const uint8_t *data, size_t length) {
+    size_t used = 0;
+
+    while (length - used >= sizeof(frame_header_t)) {
+        const uint8_t *frame = data + used;
+        frame_header_t header;
+
+        memcpy(&header, frame, sizeof(header));
+        if (!is_header(dec, &header)) {
+            used++;
+            dec->skipped++;
+            continue;
+        }
+        size_t total = sizeof(header) + header.length;
+        if (length - used < total) break;
+
+        uint32_t crc = frame_crc(0xFFFFFFFF, frame, offsetof(frame_header_t, crc));
+        if (frame_crc(crc, frame + sizeof(header), header.length) != header.crc) {
+            // Either a damaged frame or a sync word in the middle of data
+            if (dec->in_sync) dec->crc_errors++;
+            dec->in_sync = 0;
+            used++;
+            dec->skipped++;
+            continue;
+        }
+        accept(dec, &header, frame + sizeof(header));
+        used += total;
+    }
+    return used;
+}
+
+void frame_decoder_feed(frame_decoder_t *dec, const uint8_t *data, size_t length) {
+    dec->bytes += length;
+    while (length > 0) {
+        if (dec->filled == 0) {
+            // Straight from the caller's data, only the tail gets copied
+            size_t used = decode(dec, data, length);
+            data += used;
+            length -= used;
+            memcpy(dec->buff, data, length);
+            dec->filled = length;
+            return;
+        }
+
+        // Complete the header, then the frame, in the buffer
+        size_t want = sizeof(frame_header_t);
+        if (dec->filled >= want) {
+            frame_header_t header;
+            memcpy(&header, dec->buff, sizeof(header));
+            if (is_header(dec, &header)) want += header.length;
+        }
+        size_t n = want - dec->filled < length ? want - dec->filled : length;
+        memcpy(dec->buff + dec->filled, data, n);
+        dec->filled += n;
+        data += n;
+        length -= n;
+
+        size_t used = decode(dec, dec->buff, dec->filled);
+        memmove(dec->buff, dec->buff + used, dec->filled - used);
+        dec->filled -= used;
+    }
+}
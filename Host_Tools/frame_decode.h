@@ -0,0 +1,53 @@
+#ifndef FRAME_DECODE_H
+#define FRAME_DECODE_H
+
+// Decoder for the framed bulk stream of the firmware (Core/Inc/frame.h).
+// Takes the stream in pieces of any size, checks the CRC of every frame
+// and follows the sequence numbers. Damaged frames are dropped: the
+// decoder looks for the next sync word whose frame has a good CRC.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "frame_crc.h"
+
+#define FRAME_SYNC 0xF7A5
+#define FRAME_FLAG_START 0x0001
+#define FRAME_FLAG_RICE 0x0002     // Payload is Rice coded samples (rice_decode.h)
+#define FRAME_MAX_PAYLOAD 65532
+
+// Same layout as frame_header_t in the firmware
+typedef struct {
+    uint16_t sync;
+    uint16_t length;
+    uint32_t seq;
+    uint16_t usb_frame;
+    uint16_t flags;
+    uint32_t crc;
+} frame_header_t;
+
+// Gets every good frame, the payload in place and only valid during the call
+typedef void (*frame_payload_fn)(void *ctx, const frame_header_t *header, const uint8_t *payload);
+
+typedef struct {
+    frame_payload_fn payload;
+    void *ctx;
+    uint16_t max_length;    // Longer payloads are taken as damage
+    uint64_t bytes;         // Fed in
+    uint64_t frames;        // With a good CRC
+    uint64_t payload_bytes;
+    uint64_t crc_errors;    // Frames dropped for their CRC, once in sync
+    uint64_t lost;          // Frames missing from the sequence
+    uint64_t out_of_order;  // Frames with an older sequence number
+    uint64_t skipped;       // Bytes dropped looking for a frame
+    uint64_t restarts;      // Frames with FRAME_FLAG_START
+    uint32_t next_seq;
+    int in_sync;
+    size_t filled;
+    uint8_t buff[sizeof(frame_header_t) + FRAME_MAX_PAYLOAD];
+} frame_decoder_t;
+
+// max_length is the largest payload the device sends, 0 for FRAME_MAX_PAYLOAD
+void frame_decoder_init(frame_decoder_t *dec, uint16_t max_length, frame_payload_fn payload, void *ctx);
+void frame_decoder_feed(frame_decoder_t *dec, const uint8_t *data, size_t length);
+
+#endif /* FRAME_DECODE_H */
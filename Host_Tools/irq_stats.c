@@ -0,0 +1,82 @@
+// Reads the OTG_FS interrupt cycle counts from the board.
+//
+// The firmware times every OTG_FS interrupt with the DWT cycle counter and
+// books it on the interrupt source that was pending (Core/Inc/irq_stats.h).
+// This tool fetches that block with a vendor request and prints it.
+//
+// Usage: irq_stats [-r]
+//   -r  clear the counters on the device after reading them
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <libusb.h>
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_IRQ_STATS 0x10
+#define IRQ_STATS_VERSION 1
+#define TIMEOUT_MS 1000
+
+static const char *source_names[] = { "reset", "rxflvl", "oepint", "iepint", "sof", "other" };
+#define NUM_SOURCES (sizeof(source_names) / sizeof(source_names[0]))
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 24
+
+static uint32_t get32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+int main(int argc, char **argv) {
+    unsigned char buff[HEADER_SIZE + ENTRY_SIZE * NUM_SOURCES];
+    int reset = argc > 1 && strcmp(argv[1], "-r") == 0;
+    libusb_device_handle *dev;
+    int ret;
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+
+    ret = libusb_control_transfer(dev, 0xC0, VENDOR_IRQ_STATS, reset, 0, buff, sizeof(buff), TIMEOUT_MS);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    if (ret < 0) {
+        printf("Request failed: %s\n", libusb_error_name(ret));
+        return 1;
+    }
+    if (ret != sizeof(buff) || buff[0] != IRQ_STATS_VERSION || buff[1] != NUM_SOURCES || buff[2] != ENTRY_SIZE) {
+        printf("Unexpected block: %i bytes, version %i, %i sources of %i bytes\n", ret, buff[0], buff[1], buff[2]);
+        return 1;
+    }
+
+    double cpu_mhz = get32(buff + 4) / 1e6;
+    printf("HCLK %.0f MHz, measurement overhead %u cycles, %u interrupts with several bits pending\n",
+            cpu_mhz, get32(buff + 12), get32(buff + 8));
+    printf("%-8s %10s %10s %10s %10s %10s %12s\n", "source", "count", "min", "avg", "max", "last", "total us");
+    for (unsigned i = 0; i < NUM_SOURCES; i++) {
+        const unsigned char *entry = buff + HEADER_SIZE + i * ENTRY_SIZE;
+        uint64_t total = get64(entry);
+        uint32_t count = get32(entry + 8);
+
+        if (count == 0) {
+            printf("%-8s %10u %10s %10s %10s %10s %12s\n", source_names[i], 0, "-", "-", "-", "-", "-");
+            continue;
+        }
+        printf("%-8s %10u %10u %10.0f %10u %10u %12.1f\n", source_names[i], count, get32(entry + 12),
+                (double)total / count, get32(entry + 16), get32(entry + 20), total / cpu_mhz);
+    }
+    if (reset) printf("Counters cleared\n");
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Measures round-trip latency to the board through the control, interrupt
+// and bulk paths, and writes the distributions as JSON.
+//
+//   control    vendor IN request (SETUP, data and status stage)
+//   interrupt  packet on interrupt OUT 0x01, echo read from interrupt IN 0x81
+//   bulk       packet on interrupt OUT 0x01, echo read from bulk IN 0x82
+//
+// The echo comes from the firmware loopback mode (Core/Inc/loopback.h),
+// which this tool switches on and off. Every echo is checked against the
+// packet sent. The firmware stamps each echo with the USB frame number, so
+// the JSON also has the frames between consecutive echoes: with one packet
+// in flight that is the round trip as the device sees it.
+//
+// Usage: loop_latency [-n count] [-s payload] [-o file.json]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <libusb.h>
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_READ_BACK 0x12
+#define VENDOR_STREAM 0x20
+#define VENDOR_LOOPBACK 0x21
+#define LOOPBACK_OFF 0
+#define LOOPBACK_INTR 1
+#define LOOPBACK_BULK 2
+
+#define OUT_EP 0x01
+#define INTR_IN_EP 0x81
+#define BULK_IN_EP 0x82
+#define HEADER_SIZE 8
+#define MAX_PAYLOAD 48
+#define TIMEOUT_MS 1000
+
+typedef struct {
+    const char *name;
+    double *us;         // Round trip per iteration
+    double *frames;     // Device frames between echoes, 0 for control
+    int count;
+    int errors;
+} path_t;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest rank on sorted values
+static double percentile(const double *sorted, int count, double p) {
+    int rank = (int)(p / 100 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+static int control_round_trip(libusb_device_handle *dev, unsigned char *buff, int payload) {
+    int ret = libusb_control_transfer(dev, 0xC0, VENDOR_READ_BACK, 0, 0, buff, payload, TIMEOUT_MS);
+    return ret < 0 ? ret : 0;
+}
+
+// Sends one packet, waits for its echo. Returns the device frame of the echo, or a libusb error.
+static int echo_round_trip(libusb_device_handle *dev, unsigned char in_ep, int is_bulk,
+        unsigned char *packet, int payload, int *mismatch) {
+    unsigned char echo[64];
+    int length, ret;
+
+    ret = libusb_interrupt_transfer(dev, OUT_EP, packet, payload, &length, TIMEOUT_MS);
+    if (ret < 0) return ret;
+    if (is_bulk) ret = libusb_bulk_transfer(dev, in_ep, echo, sizeof(echo), &length, TIMEOUT_MS);
+    else ret = libusb_interrupt_transfer(dev, in_ep, echo, sizeof(echo), &length, TIMEOUT_MS);
+    if (ret < 0) return ret;
+
+    int echo_length = echo[6] | echo[7] << 8;
+    *mismatch = length != HEADER_SIZE + payload || echo_length != payload ||
+            memcmp(echo + HEADER_SIZE, packet, payload) != 0;
+    return echo[4] | echo[5] << 8;
+}
+
+// Reads and drops what the bulk endpoint still has, stream data included
+static void drain(libusb_device_handle *dev, unsigned char ep) {
+    unsigned char buff[4096];
+    int length;
+
+    while (libusb_bulk_transfer(dev, ep, buff, sizeof(buff), &length, 50) == 0);
+}
+
+static int measure(libusb_device_handle *dev, path_t *path, int mode, int count, int payload) {
+    unsigned char packet[MAX_PAYLOAD];
+    int last_frame = -1;
+    int ret;
+
+    if (mode != LOOPBACK_OFF) {
+        if (mode == LOOPBACK_BULK) {
+            libusb_control_transfer(dev, 0x40, VENDOR_STREAM, 0, 0, NULL, 0, TIMEOUT_MS);
+            drain(dev, BULK_IN_EP);
+        }
+        ret = libusb_control_transfer(dev, 0x40, VENDOR_LOOPBACK, mode, 0, NULL, 0, TIMEOUT_MS);
+        if (ret < 0) return ret;
+    }
+    for (int i = 0; i < count; i++) {
+        double start = now_us();
+        int mismatch = 0;
+
+        memset(packet, i, payload);
+        packet[0] = i >> 8;
+        if (mode == LOOPBACK_OFF) {
+            ret = control_round_trip(dev, packet, payload);
+        } else {
+            ret = echo_round_trip(dev, mode == LOOPBACK_BULK ? BULK_IN_EP : INTR_IN_EP,
+                    mode == LOOPBACK_BULK, packet, payload, &mismatch);
+        }
+        if (ret < 0) {
+            printf("%s: %s after %d round trips\n", path->name, libusb_error_name(ret), i);
+            return ret;
+        }
+        path->us[path->count] = now_us() - start;
+        path->frames[path->count] = mode == LOOPBACK_OFF || last_frame < 0 ? 0 : (ret - last_frame) & 0x3FFF;
+        if (mode != LOOPBACK_OFF) last_frame = ret;
+        path->count++;
+        path->errors += mismatch;
+    }
+    if (mode != LOOPBACK_OFF) {
+        libusb_control_transfer(dev, 0x40, VENDOR_LOOPBACK, LOOPBACK_OFF, 0, NULL, 0, TIMEOUT_MS);
+    }
+    return 0;
+}
+
+static void print_path(FILE *out, const path_t *path, int last) {
+    double sum = 0;
+
+    qsort(path->us, path->count, sizeof(double), compare);
+    qsort(path->frames, path->count, sizeof(double), compare);
+    for (int i = 0; i < path->count; i++) {
+        sum += path->us[i];
+    }
+    fprintf(out, "    \"%s\": {\"count\": %d, \"errors\": %d, \"min_us\": %.1f, \"mean_us\": %.1f, "
+            "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f, \"frames_p50\": %.0f}%s\n",
+            path->name, path->count, path->errors, path->us[0], sum / path->count,
+            percentile(path->us, path->count, 50), percentile(path->us, path->count, 99),
+            percentile(path->us, path->count, 99.9), path->us[path->count - 1],
+            percentile(path->frames, path->count, 50), last ? "" : ",");
+}
+
+int main(int argc, char **argv) {
+    int count = 10000, payload = 8;
+    const char *file = NULL;
+    path_t paths[] = { { "control" }, { "interrupt" }, { "bulk" } };
+    const int modes[] = { LOOPBACK_OFF, LOOPBACK_INTR, LOOPBACK_BULK };
+    struct libusb_device_descriptor desc;
+    const struct libusb_version *version = libusb_get_version();
+    struct utsname system;
+    libusb_device_handle *dev;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        if (opt == 'n') count = atoi(optarg);
+        else if (opt == 's') payload = atoi(optarg);
+        else if (opt == 'o') file = optarg;
+        else {
+            printf("Usage: %s [-n count] [-s payload] [-o file.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count < 1 || payload < 1 || payload > MAX_PAYLOAD) {
+        printf("Count must be positive, payload 1..%d bytes\n", MAX_PAYLOAD);
+        return 1;
+    }
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+    libusb_set_auto_detach_kernel_driver(dev, 1);
+    if (libusb_claim_interface(dev, 0) < 0) {
+        printf("Cannot claim interface 0\n");
+        return 1;
+    }
+    libusb_get_device_descriptor(libusb_get_device(dev), &desc);
+
+    for (int i = 0; i < 3 && ret == 0; i++) {
+        paths[i].us = malloc(count * sizeof(double));
+        paths[i].frames = malloc(count * sizeof(double));
+        ret = measure(dev, &paths[i], modes[i], count, payload);
+    }
+    libusb_release_interface(dev, 0);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    if (ret < 0) return 1;
+
+    FILE *out = file ? fopen(file, "w") : stdout;
+    if (!out) {
+        printf("Cannot write %s\n", file);
+        return 1;
+    }
+    uname(&system);
+    fprintf(out, "{\n");
+    fprintf(out, "  \"device\": \"%04x:%04x\", \"bcdDevice\": \"%x.%02x\",\n", desc.idVendor, desc.idProduct,
+            desc.bcdDevice >> 8, desc.bcdDevice & 0xff);
+    fprintf(out, "  \"kernel\": \"%s\", \"libusb\": \"%d.%d.%d\",\n", system.release,
+            version->major, version->minor, version->micro);
+    fprintf(out, "  \"payload\": %d,\n  \"paths\": {\n", payload);
+    for (int i = 0; i < 3; i++) {
+        print_path(out, &paths[i], i == 2);
+    }
+    fprintf(out, "  }\n}\n");
+    if (file) fclose(out);
+
+    int errors = paths[0].errors + paths[1].errors + paths[2].errors;
+    if (errors) printf("%d echoes did not match\n", errors);
+    return errors != 0;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Shows where the USB interrupt path and its data ended up after linking.
+# Reads the map file written by STM32CubeIDE (-Wl,-Map) and prints, for each
+# input section of interest, its memory region, address and size.
+#
+#   ./map_report.sh [../Device_M4/Debug/Device_M4.map]
+#
+# Everything the OTG_FS interrupt runs or touches should be in RAM or CCMRAM;
+# a FLASH entry means a function was renamed or a new one joined the path and
+# the list in STM32F407VETX_FLASH.ld needs updating.
+#
+# It also lists newlib stdio and heap members that got linked in: the firmware
+# formats with fmt.c and does not use malloc, so any of them means a call to
+# printf, sprintf, puts or malloc slipped back in.
+
+MAP=${1:-../Device_M4/Debug/Device_M4.map}
+
+if [ ! -r "$MAP" ]; then
+	echo "Cannot read $MAP, build the Debug configuration first" >&2
+	exit 1
+fi
+
+awk '
+function region(addr) {
+	addr = tolower(addr)
+	sub(/^0x0*/, "", addr)
+	if (length(addr) == 7 && addr ~ /^8/) return "FLASH"		# 0x08000000
+	if (length(addr) == 8 && addr ~ /^2/) return "RAM"		# 0x20000000
+	if (length(addr) == 8 && addr ~ /^1000/) return "CCMRAM"	# 0x10000000
+	return "?"
+}
+function report(name, addr, size) {
+	if (name !~ want || size == "0x0") return
+	printf "%-8s %s %7s  %s\n", region(addr), addr, size, name
+	if (name ~ /^\.text\./ && region(addr) == "FLASH") slow++
+}
+BEGIN {
+	want = "^\\.(text\\.(OTG_FS_IRQHandler|HAL_PCD_IRQHandler|PCD_|HAL_PCD_EP_(Transmit|Receive|GetRxCount|Abort)|" \
+		"USB_(GetMode|ReadInterrupts|ReadDev|ReadPacket|WritePacket|EPStartXfer|EP0_OutStart|EPStopXfer|FlushTxFifo)|" \
+		"HAL_PCD_(Setup|DataIn|DataOut)StageCallback)|RamFunc|ccmram|ccmbss|bss\\.hpcd_USB_OTG_FS)"
+	started = 0
+}
+/^Linker script and memory map/ { started = 1; next }
+# Archive members, listed before the memory map: "/path/libc_nano.a(libc_a-vfprintf.o)"
+!started && /\.a\((lib_a-|libc_a-)?[a-z_-]*(printf|puts|putchar|malloc|sbrk)[a-z_-]*\.o\)/ {
+	member = $1
+	sub(/^.*\(/, "", member)
+	sub(/\)$/, "", member)
+	printf "newlib   %s\n", member
+	libc++
+}
+!started { next }
+# Input section on one line: " .text.foo  0x08001234  0x40 file.o"
+/^ \.[^ ]+ +0x[0-9a-f]+ +0x[0-9a-f]+/ { report($1, $2, $3); next }
+# Long names wrap: the address and size follow on the next line
+/^ \.[^ ]+$/ { pending = $1; next }
+pending != "" && /^ +0x[0-9a-f]+ +0x[0-9a-f]+/ { report(pending, $1, $2) }
+{ pending = "" }
+END {
+	if (slow) printf "%d interrupt path function(s) still in FLASH\n", slow
+	if (libc) printf "%d newlib stdio/heap member(s) linked in\n", libc
+	if (slow || libc) exit 1
+}
+' "$MAP"
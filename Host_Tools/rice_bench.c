@@ -0,0 +1,91 @@
+// Compression ratio and speed of the firmware Rice coder (Device_M4/Core/
+// Src/rice.c) and the host decoder (rice_decode.c) on typical signals.
+//
+// The encoder is the firmware file built for the host, without the
+// SIMD32 path: its ns per sample here only compares signals. The cycles
+// per sample on the Cortex-M4 come from Bench_M4 (rice_* cases). The
+// ratio counts the Rice blocks only; the frame and rice_header_t add 20
+// bytes per frame on top. Every signal is decoded and compared first.
+//
+// Usage: rice_bench [blocks]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "rice.h"
+#include "rice_decode.h"
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Uniform in -range..range
+static int noise(int range) {
+    return rand() % (2 * range + 1) - range;
+}
+
+static uint16_t ramp(long i) { return i; }
+static uint16_t sine(long i) { return 2048 + 1800 * sin(i * 0.01); }
+static uint16_t sine_noise(long i) { return sine(i) + noise(8); }
+static uint16_t walk(long i) { static int level = 2048; return level += noise(16); }
+static uint16_t noise12(long i) { return rand() & 0xFFF; }
+static uint16_t noise16(long i) { return rand(); }
+
+static const struct {
+    const char *name;
+    uint16_t (*sample)(long i);
+} signals[] = {
+    { "ramp", ramp },               // The board's test stream
+    { "sine", sine },               // 12-bit ADC, slow tone
+    { "sine_noise", sine_noise },   // Same with 3 bits of noise
+    { "walk", walk },               // Random walk, 16 codes per step
+    { "noise12", noise12 },         // 12-bit white noise
+    { "noise16", noise16 },         // Nothing to gain: raw blocks
+};
+
+int main(int argc, char **argv) {
+    long blocks = argc > 1 ? atol(argv[1]) : 100000;
+    long count = blocks * RICE_BLOCK;
+    uint16_t *samples = aligned_alloc(4, count * 2);
+    uint16_t *decoded = malloc(count * 2);
+    uint8_t *coded = malloc(blocks * RICE_MAX_BYTES);
+    size_t *offsets = malloc((blocks + 1) * sizeof(size_t));
+
+    printf("%-11s %7s %12s %12s %14s\n", "signal", "ratio", "encode ns", "decode ns", "decode Ms/s");
+    for (int s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+        for (long i = 0; i < count; i++) {
+            samples[i] = signals[s].sample(i);
+        }
+
+        uint16_t prev = 0;
+        offsets[0] = 0;
+        double start = now_ns();
+        for (long b = 0; b < blocks; b++) {
+            offsets[b + 1] = offsets[b] + rice_encode_block(samples + b * RICE_BLOCK, prev, coded + offsets[b]);
+            prev = samples[b * RICE_BLOCK + RICE_BLOCK - 1];
+        }
+        double encode = (now_ns() - start) / count;
+
+        prev = 0;
+        start = now_ns();
+        for (long b = 0; b < blocks; b++) {
+            if (!rice_decode_block(coded + offsets[b], offsets[b + 1] - offsets[b], &prev, decoded + b * RICE_BLOCK)) {
+                printf("%s: block %ld does not decode\n", signals[s].name, b);
+                return 1;
+            }
+        }
+        double decode = (now_ns() - start) / count;
+        if (memcmp(samples, decoded, count * 2)) {
+            printf("%s: MISMATCH\n", signals[s].name);
+            return 1;
+        }
+
+        printf("%-11s %7.2f %12.2f %12.2f %14.1f\n", signals[s].name, 2.0 * count / offsets[blocks],
+                encode, decode, 1e3 / decode);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Decoder for delta + Rice coded samples, see rice_decode.h
+
+#include "rice_decode.h"
+
+static inline uint16_t unzigzag(uint32_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+// k bits at bit offset in the low bits of a block, which are 4k bytes
+static uint32_t get_low(const uint8_t *low, uint32_t k, uint32_t offset) {
+    uint32_t byte = offset / 8, end = 4 * k;
+    uint32_t window = low[byte];
+
+    if (byte + 1 < end) window |= low[byte + 1] << 8;
+    if (byte + 2 < end) window |= low[byte + 2] << 16;
+    return (window >> offset % 8) & ((1 << k) - 1);
+}
+
+size_t rice_decode_block(const uint8_t *in, size_t length, uint16_t *prev, uint16_t *out) {
+    uint16_t sample = *prev;
+
+    if (length < 1) return 0;
+    uint32_t k = in[0];
+    if (k == RICE_RAW) {
+        if (length < RICE_MAX_BYTES) return 0;
+        for (int i = 0; i < RICE_BLOCK; i++) {
+            sample += unzigzag(in[1 + 2 * i] | in[2 + 2 * i] << 8);
+            out[i] = sample;
+        }
+        *prev = sample;
+        return RICE_MAX_BYTES;
+    }
+    if (k > RICE_MAX_K || 1 + 4 * k > length) return 0;
+
+    const uint8_t *low = in + 1;
+    const uint8_t *unary = low + 4 * k;
+    size_t unary_bytes = length - 1 - 4 * k;
+    size_t pos = 0;     // Bit in the unary parts
+    for (int i = 0; i < RICE_BLOCK; i++) {
+        uint32_t high = 0;
+
+        for (;;) {
+            if (pos / 8 >= unary_bytes) return 0;
+            uint32_t bits = unary[pos / 8] >> pos % 8;
+            if (bits) {
+                uint32_t zeros = __builtin_ctz(bits);
+                high += zeros;
+                pos += zeros + 1;
+                break;
+            }
+            high += 8 - pos % 8;
+            pos += 8 - pos % 8;
+        }
+        if (high > 0xFFFF >> k) return 0;
+        uint32_t value = high << k | (k ? get_low(low, k, i * k) : 0);
+        sample += unzigzag(value);
+        out[i] = sample;
+    }
+    *prev = sample;
+    return 1 + 4 * k + (pos + 7) / 8;
+}
+
+long rice_decode_payload(const uint8_t *payload, size_t length, uint16_t *out, size_t max) {
+    if (length < 4) return -1;
+    size_t count = payload[0] | payload[1] << 8;
+    uint16_t prev = payload[2] | payload[3] << 8;
+    size_t used = 4;
+
+    if (count % RICE_BLOCK || count > max) return -1;
+    for (size_t i = 0; i < count; i += RICE_BLOCK) {
+        size_t n = rice_decode_block(payload + used, length - used, &prev, out + i);
+        if (!n) return -1;
+        used += n;
+    }
+    // Padding to the word the frame CRC needs
+    if (length - used >= 4) return -1;
+    return count;
+}
@@ -0,0 +1,25 @@
+#ifndef RICE_DECODE_H
+#define RICE_DECODE_H
+
+// Decoder for the delta + Rice coded samples of the firmware
+// (Core/Inc/rice.h), as carried by frames with FRAME_FLAG_RICE.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RICE_BLOCK 32
+#define RICE_MAX_K 15
+#define RICE_RAW 0xFF
+#define RICE_MAX_BYTES (1 + RICE_BLOCK * 2)
+
+// Decodes one block of RICE_BLOCK samples following *prev into out and
+// moves *prev to the last one. Returns the bytes used, 0 if the block is
+// damaged or runs past length.
+size_t rice_decode_block(const uint8_t *in, size_t length, uint16_t *prev, uint16_t *out);
+
+// Decodes the payload of a FRAME_FLAG_RICE frame: the count and base
+// sample, then the blocks. Returns the samples written to out, or -1 if
+// the payload is damaged or holds more than max samples.
+long rice_decode_payload(const uint8_t *payload, size_t length, uint16_t *out, size_t max);
+
+#endif /* RICE_DECODE_H */
@@ -0,0 +1,215 @@
+// Speed of the sample decoder (sample_decode.c) at each level the CPU
+// has, to int16 and to float, in Msamples/s on one core of this host.
+//
+// The Rice streams are signals of rice_bench coded by the firmware file
+// (Device_M4/Core/Src/rice.c) built for the host; packed12 and word12
+// are 12-bit noise, word12 with junk in the top 4 bits and word12s sign
+// extended two's complement. Before timing, every level and format is
+// checked against the reference decoder (rice_decode.c) and a plain
+// unpacking, once on the whole stream and once fed in odd-sized pieces,
+// the undecoded rest of a piece handed in again with the next one. A board sends at most about
+// 0.6 Msamples/s raw (Host_Sim throughput); the compressed stream more
+// with the signal.
+//
+// Usage: sample_bench [blocks]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "rice.h"
+#include "sample_decode.h"
+#include "rice_decode.h"
+
+#define OFFSET 2048             // Mid-scale of the 12-bit ADC
+#define SCALE (1.0f / 2048)
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int noise(int range) {
+    return rand() % (2 * range + 1) - range;
+}
+
+static uint16_t sine_noise(long i) { return 2048 + 1800 * sin(i * 0.01) + noise(8); }
+static uint16_t walk(long i) { static int level = 2048; return level += noise(16); }
+static uint16_t noise16(long i) { return rand(); }
+
+static const struct {
+    const char *name;
+    uint16_t (*sample)(long i);
+} signals[] = {
+    { "sine_noise", sine_noise },   // 12-bit ADC, tone with noise, k about 3
+    { "walk", walk },               // Random walk, k about 4
+    { "noise16", noise16 },         // Raw blocks
+};
+
+typedef enum {
+    RICE,
+    PACKED12,
+    WORD12,
+    WORD12_SIGNED,      // expect holds the samples as int16
+} layout_t;
+
+typedef struct {
+    const char *name;
+    const uint8_t *in;
+    size_t length;
+    long count;
+    const uint16_t *expect;
+    layout_t layout;
+} stream_t;
+
+static long decode(sample_decoder_t *dec, const stream_t *s, const uint8_t *in, size_t length,
+        size_t *used, void *out, size_t max) {
+    if (s->layout == PACKED12) return sample_decode_packed12(dec, in, length, used, out, max);
+    if (s->layout != RICE) return sample_decode_word12(dec, in, length, used, out, max, s->layout == WORD12_SIGNED);
+    return sample_decode_rice(dec, in, length, used, out, max);
+}
+
+// Whole stream, then in pieces of 1 to 200 bytes
+static int check(const stream_t *s, sample_level_t level, sample_format_t format, void *out) {
+    sample_decoder_t dec;
+    size_t used;
+
+    for (int pieces = 0; pieces < 2; pieces++) {
+        size_t size = format == SAMPLE_FLOAT ? 4 : 2, pos = 0, end = 0;
+        long count = 0;
+
+        sample_decoder_init(&dec, format, OFFSET, SCALE);
+        sample_decoder_set_level(&dec, level);
+        memset(out, 0, s->count * size);
+        while (pos < s->length) {
+            end = pieces ? end + 1 + rand() % 200 : s->length;
+            if (end > s->length) end = s->length;
+            long n = decode(&dec, s, s->in + pos, end - pos, &used, (uint8_t*)out + count * size, s->count - count);
+            if (n < 0) return -1;
+            pos += used;
+            count += n;
+            if (end == s->length && !n) break;
+        }
+        if (count != s->count) return -1;
+
+        for (long i = 0; i < count; i++) {
+            int32_t sample = s->layout == WORD12_SIGNED ? (int16_t)s->expect[i] : s->expect[i];
+
+            if (format == SAMPLE_FLOAT) {
+                if (((float*)out)[i] != (sample - OFFSET) * SCALE) return -1;
+            } else if (((int16_t*)out)[i] != (int16_t)(s->expect[i] - OFFSET)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Decodes the stream in 16 kB pieces as a bulk transfer would bring it
+static double time_decode(const stream_t *s, sample_level_t level, sample_format_t format, void *out, int rounds) {
+    size_t size = format == SAMPLE_FLOAT ? 4 : 2, used;
+    sample_decoder_t dec;
+
+    sample_decoder_init(&dec, format, OFFSET, SCALE);
+    sample_decoder_set_level(&dec, level);
+    double start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        size_t pos = 0;
+        long count = 0;
+
+        dec.prev = 0;
+        while (pos < s->length) {
+            size_t end = pos + 16384 < s->length ? pos + 16384 : s->length;
+            count += decode(&dec, s, s->in + pos, end - pos, &used, (uint8_t*)out + count * size, s->count - count);
+            pos += used;
+        }
+    }
+    return (double)rounds * s->count / (now_ns() - start) * 1e3;
+}
+
+int main(int argc, char **argv) {
+    long blocks = argc > 1 ? atol(argv[1]) : 20000;
+    long count = blocks * RICE_BLOCK;
+    int nsignals = sizeof(signals) / sizeof(signals[0]), nstreams = nsignals + 3;
+    stream_t streams[nstreams];
+    float *out = malloc(count * sizeof(float));
+
+    for (int s = 0; s < nsignals; s++) {
+        uint16_t *samples = aligned_alloc(4, count * 2);
+        uint8_t *coded = malloc(blocks * RICE_MAX_BYTES);
+        size_t length = 0;
+        uint16_t prev = 0;
+
+        for (long i = 0; i < count; i++) {
+            samples[i] = signals[s].sample(i);
+        }
+        for (long b = 0; b < blocks; b++) {
+            length += rice_encode_block(samples + b * RICE_BLOCK, prev, coded + length);
+            prev = samples[b * RICE_BLOCK + RICE_BLOCK - 1];
+        }
+
+        // The reference decoder must agree with the encoder first
+        uint16_t *expect = malloc(count * 2);
+        prev = 0;
+        for (size_t b = 0, pos = 0; b < blocks; b++) {
+            pos += rice_decode_block(coded + pos, length - pos, &prev, expect + b * RICE_BLOCK);
+        }
+        if (memcmp(samples, expect, count * 2)) {
+            printf("%s: reference decoder MISMATCH\n", signals[s].name);
+            return 1;
+        }
+        streams[s] = (stream_t){ signals[s].name, coded, length, count, expect, RICE };
+    }
+
+    uint16_t *expect = malloc(count * 2);
+    uint8_t *packed = malloc(count / 2 * 3);
+    for (long i = 0; i < count; i += 2) {
+        expect[i] = rand() & 0xFFF;
+        expect[i + 1] = rand() & 0xFFF;
+        packed[i / 2 * 3] = expect[i];
+        packed[i / 2 * 3 + 1] = expect[i] >> 8 | expect[i + 1] << 4;
+        packed[i / 2 * 3 + 2] = expect[i + 1] >> 4;
+    }
+    streams[nsignals] = (stream_t){ "packed12", packed, count / 2 * 3, count, expect, PACKED12 };
+
+    for (layout_t layout = WORD12; layout <= WORD12_SIGNED; layout++) {
+        uint16_t *samples = malloc(count * 2);
+        uint8_t *words = malloc(count * 2);
+
+        for (long i = 0; i < count; i++) {
+            uint16_t word;
+
+            if (layout == WORD12) {
+                samples[i] = rand() & 0xFFF;
+                word = samples[i] | (rand() & 0xF) << 12;
+            } else {
+                samples[i] = word = noise(2047);
+            }
+            words[2 * i] = word;
+            words[2 * i + 1] = word >> 8;
+        }
+        streams[nsignals + 1 + layout - WORD12] = (stream_t){ layout == WORD12 ? "word12" : "word12s",
+                words, count * 2, count, samples, layout };
+    }
+
+    printf("Best level: %s\n", sample_level_name(sample_best_level()));
+    printf("%-11s %7s %7s %14s %14s\n", "stream", "ratio", "level", "int16 Ms/s", "float Ms/s");
+    for (int s = 0; s < nstreams; s++) {
+        for (sample_level_t level = SAMPLE_SCALAR; level <= SAMPLE_AVX2; level++) {
+            sample_decoder_t dec;
+            if (sample_decoder_set_level(&dec, level) < 0) continue;
+
+            if (check(&streams[s], level, SAMPLE_INT16, out) || check(&streams[s], level, SAMPLE_FLOAT, out)) {
+                printf("%s: %s MISMATCH\n", streams[s].name, sample_level_name(level));
+                return 1;
+            }
+            int rounds = 200000000 / count + 1;
+            printf("%-11s %7.2f %7s %14.1f %14.1f\n", streams[s].name, 2.0 * count / streams[s].length,
+                    sample_level_name(level), time_decode(&streams[s], level, SAMPLE_INT16, out, rounds),
+                    time_decode(&streams[s], level, SAMPLE_FLOAT, out, rounds));
+        }
+    }
+    return 0;
+}
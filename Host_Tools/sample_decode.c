@@ -0,0 +1,464 @@
+// Fast decoder for Rice, packed12 and word12 sample streams, see sample_decode.h
+
+#include <string.h>
+#include "sample_decode.h"
+#include "rice_decode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86 1
+#endif
+
+// What read_unary returns besides the bytes used
+#define CUT_OFF 0
+#define DAMAGED ((size_t)-1)
+
+typedef struct {
+    // values = values << k | the low bits, for the 32 values of a block
+    void (*join)(const uint8_t *low, uint32_t k, uint16_t *values);
+    // Zigzag values to samples following dec->prev, converted into out
+    void (*finish)(sample_decoder_t *dec, const uint16_t *values, void *out);
+    // Decodes up to pairs packed12 pairs, returns how many it did
+    size_t (*packed)(const sample_decoder_t *dec, const uint8_t *in, size_t length, size_t pairs, void *out);
+    // Decodes up to count word12 samples, (word ^ flip) & 0xFFF, returns how many it did
+    size_t (*words)(const sample_decoder_t *dec, const uint8_t *in, size_t count, uint16_t flip, void *out);
+} kernels_t;
+
+static const char *const names[] = { "scalar", "sse4", "avx2" };
+
+static void *out_at(const sample_decoder_t *dec, void *out, size_t i) {
+    return dec->format == SAMPLE_FLOAT ? (void*)((float*)out + i) : (void*)((int16_t*)out + i);
+}
+
+static inline void store_scalar(const sample_decoder_t *dec, void *out, int i, uint16_t sample) {
+    if (dec->format == SAMPLE_FLOAT) {
+        ((float*)out)[i] = ((int32_t)sample - dec->offset) * dec->scale;
+    } else {
+        ((int16_t*)out)[i] = sample - dec->offset;
+    }
+}
+
+// The high parts of a block, value >> k, from its unary code. Returns the
+// bytes used, CUT_OFF if the code runs past length or DAMAGED if a value
+// would not fit in 16 bits.
+static size_t read_unary(const uint8_t *unary, size_t length, uint32_t k, uint16_t *high) {
+    uint32_t max = 0xFFFF >> k, run = 0;
+    size_t pos = 0;     // Bit in the unary code
+    int i = 0;
+
+    while (i < RICE_BLOCK) {
+        if (pos >= 8 * length) return CUT_OFF;
+        // 56 bits a round: what is left of a 64-bit load after the shift
+        size_t byte = pos / 8;
+        uint64_t bits = 0;
+        memcpy(&bits, unary + byte, byte + 8 <= length ? 8 : length - byte);
+        bits = bits >> pos % 8 & 0xFFFFFFFFFFFFFF;
+        int left = 56;
+
+        while (i < RICE_BLOCK && bits) {
+            int zeros = __builtin_ctzll(bits);
+            run += zeros;
+            if (run > max) return DAMAGED;
+            high[i++] = run;
+            run = 0;
+            bits >>= zeros + 1;
+            pos += zeros + 1;
+            left -= zeros + 1;
+        }
+        if (i < RICE_BLOCK) {
+            run += left;
+            pos += left;
+            if (pos >= 8 * length) return CUT_OFF;
+            if (run > max) return DAMAGED;
+        }
+    }
+    return (pos + 7) / 8;
+}
+
+// Needs 3 bytes past the low bits, which the unary code always has
+static void join_scalar(const uint8_t *low, uint32_t k, uint16_t *values) {
+    uint32_t mask = (1 << k) - 1;
+
+    for (int i = 0; i < RICE_BLOCK; i++) {
+        uint32_t window;
+        memcpy(&window, low + i * k / 8, 4);
+        values[i] = values[i] << k | (window >> i * k % 8 & mask);
+    }
+}
+
+static void finish_scalar(sample_decoder_t *dec, const uint16_t *values, void *out) {
+    uint16_t sample = dec->prev;
+
+    for (int i = 0; i < RICE_BLOCK; i++) {
+        sample += (values[i] >> 1) ^ -(values[i] & 1);
+        store_scalar(dec, out, i, sample);
+    }
+    dec->prev = sample;
+}
+
+static size_t packed_scalar(const sample_decoder_t *dec, const uint8_t *in, size_t length, size_t pairs, void *out) {
+    for (size_t i = 0; i < pairs; i++, in += 3) {
+        store_scalar(dec, out, 2 * i, in[0] | (in[1] & 0x0F) << 8);
+        store_scalar(dec, out, 2 * i + 1, in[1] >> 4 | in[2] << 4);
+    }
+    return pairs;
+}
+
+static size_t words_scalar(const sample_decoder_t *dec, const uint8_t *in, size_t count, uint16_t flip, void *out) {
+    for (size_t i = 0; i < count; i++, in += 2) {
+        store_scalar(dec, out, i, ((in[0] | in[1] << 8) ^ flip) & 0x0FFF);
+    }
+    return count;
+}
+
+#ifdef HAS_X86
+
+// The low bits of each group of values in one vector. The bytes holding
+// each value go into a 32-bit lane by a shuffle, then down by the bit
+// offset: SSE4.1 has no shift per lane, so it multiplies up by
+// 2^(7 - offset) and shifts down by 7, the 24 bits never reaching the top.
+static struct {
+    uint8_t base;           // First byte of the group in the low bits
+    uint8_t shuffle[16];
+    uint32_t multiply[4];
+} sse_groups[RICE_MAX_K + 1][RICE_BLOCK / 4];
+
+// AVX2: both 128-bit lanes hold the same 16 bytes, the group starting at
+// byte g * k, and each shuffles out 4 of the 8 values
+static struct {
+    uint8_t shuffle[32];
+    uint32_t shift[8];
+} avx_groups[RICE_MAX_K + 1][RICE_BLOCK / 8];
+
+static void make_groups(void) {
+    for (uint32_t k = 1; k <= RICE_MAX_K; k++) {
+        for (int g = 0; g < RICE_BLOCK / 4; g++) {
+            uint32_t base = 4 * g * k / 8;
+            sse_groups[k][g].base = base;
+            for (int j = 0; j < 4; j++) {
+                uint32_t bit = (4 * g + j) * k - 8 * base;
+                for (int b = 0; b < 4; b++) {
+                    sse_groups[k][g].shuffle[4 * j + b] = b < 3 ? bit / 8 + b : 0x80;
+                }
+                sse_groups[k][g].multiply[j] = 1 << (7 - bit % 8);
+            }
+        }
+        for (int g = 0; g < RICE_BLOCK / 8; g++) {
+            for (int j = 0; j < 8; j++) {
+                uint32_t bit = j * k;
+                for (int b = 0; b < 4; b++) {
+                    avx_groups[k][g].shuffle[16 * (j / 4) + 4 * (j % 4) + b] = b < 3 ? bit / 8 + b : 0x80;
+                }
+                avx_groups[k][g].shift[j] = bit % 8;
+            }
+        }
+    }
+}
+
+// Byte pairs of 8 packed12 samples out of 12 bytes: even samples are the
+// low 12 bits of theirs, odd ones the high 12
+#define PACKED_SHUFFLE 0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11
+
+__attribute__((target("sse4.1")))
+static inline void store_sse4(const sample_decoder_t *dec, __m128i samples, void *out, int i) {
+    if (dec->format == SAMPLE_FLOAT) {
+        const __m128i offset = _mm_set1_epi32(dec->offset);
+        const __m128 scale = _mm_set1_ps(dec->scale);
+        __m128i low = _mm_sub_epi32(_mm_cvtepu16_epi32(samples), offset);
+        __m128i high = _mm_sub_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(samples, 8)), offset);
+        _mm_storeu_ps((float*)out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps((float*)out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    } else {
+        _mm_storeu_si128((__m128i*)((int16_t*)out + i), _mm_sub_epi16(samples, _mm_set1_epi16(dec->offset)));
+    }
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i low_sse4(const uint8_t *low, uint32_t k, int g, __m128i mask) {
+    __m128i w = _mm_loadu_si128((const __m128i*)(low + sse_groups[k][g].base));
+    w = _mm_shuffle_epi8(w, _mm_loadu_si128((const __m128i*)sse_groups[k][g].shuffle));
+    w = _mm_mullo_epi32(w, _mm_loadu_si128((const __m128i*)sse_groups[k][g].multiply));
+    return _mm_and_si128(_mm_srli_epi32(w, 7), mask);
+}
+
+// Reads 16 bytes from the first byte of each group on
+__attribute__((target("sse4.1")))
+static void join_sse4(const uint8_t *low, uint32_t k, uint16_t *values) {
+    const __m128i mask = _mm_set1_epi32((1 << k) - 1);
+    const __m128i shift = _mm_cvtsi32_si128(k);
+
+    for (int g = 0; g < RICE_BLOCK / 4; g += 2) {
+        __m128i bits = _mm_packus_epi32(low_sse4(low, k, g, mask), low_sse4(low, k, g + 1, mask));
+        __m128i high = _mm_loadu_si128((const __m128i*)(values + 4 * g));
+        _mm_storeu_si128((__m128i*)(values + 4 * g), _mm_or_si128(_mm_sll_epi16(high, shift), bits));
+    }
+}
+
+// Unzigzag, then the deltas summed up in 3 steps of shift and add
+__attribute__((target("sse4.1")))
+static void finish_sse4(sample_decoder_t *dec, const uint16_t *values, void *out) {
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i last = _mm_set1_epi16(0x0F0E);    // Shuffle spreading the last sample
+    __m128i carry = _mm_set1_epi16(dec->prev);
+
+    for (int i = 0; i < RICE_BLOCK; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        v = _mm_xor_si128(_mm_srli_epi16(v, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one)));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi16(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi16(v, carry);
+        carry = _mm_shuffle_epi8(v, last);
+        store_sse4(dec, v, out, i);
+    }
+    dec->prev = _mm_extract_epi16(carry, 0);
+}
+
+// 8 samples from 12 bytes, reading 16
+__attribute__((target("sse4.1")))
+static size_t packed_sse4(const sample_decoder_t *dec, const uint8_t *in, size_t length, size_t pairs, void *out) {
+    const __m128i shuffle = _mm_setr_epi8(PACKED_SHUFFLE);
+    const __m128i mask = _mm_set1_epi16(0x0FFF);
+    size_t i = 0;
+
+    for (; i + 4 <= pairs && 3 * i + 16 <= length; i += 4) {
+        __m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 3 * i)), shuffle);
+        store_sse4(dec, _mm_blend_epi16(_mm_and_si128(w, mask), _mm_srli_epi16(w, 4), 0xAA), out, 2 * i);
+    }
+    return i;
+}
+
+// 8 samples from 16 bytes
+__attribute__((target("sse4.1")))
+static size_t words_sse4(const sample_decoder_t *dec, const uint8_t *in, size_t count, uint16_t flip, void *out) {
+    const __m128i sign = _mm_set1_epi16(flip);
+    const __m128i mask = _mm_set1_epi16(0x0FFF);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i w = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+        store_sse4(dec, _mm_and_si128(_mm_xor_si128(w, sign), mask), out, i);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline void store_avx2(const sample_decoder_t *dec, __m256i samples, void *out, int i) {
+    if (dec->format == SAMPLE_FLOAT) {
+        const __m256i offset = _mm256_set1_epi32(dec->offset);
+        const __m256 scale = _mm256_set1_ps(dec->scale);
+        __m256i low = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(samples)), offset);
+        __m256i high = _mm256_sub_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(samples, 1)), offset);
+        _mm256_storeu_ps((float*)out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+        _mm256_storeu_ps((float*)out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+    } else {
+        _mm256_storeu_si256((__m256i*)((int16_t*)out + i), _mm256_sub_epi16(samples, _mm256_set1_epi16(dec->offset)));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i low_avx2(const uint8_t *low, uint32_t k, int g, __m256i mask) {
+    __m256i w = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(low + g * k)));
+    w = _mm256_shuffle_epi8(w, _mm256_loadu_si256((const __m256i*)avx_groups[k][g].shuffle));
+    w = _mm256_srlv_epi32(w, _mm256_loadu_si256((const __m256i*)avx_groups[k][g].shift));
+    return _mm256_and_si256(w, mask);
+}
+
+__attribute__((target("avx2")))
+static void join_avx2(const uint8_t *low, uint32_t k, uint16_t *values) {
+    const __m256i mask = _mm256_set1_epi32((1 << k) - 1);
+    const __m128i shift = _mm_cvtsi32_si128(k);
+
+    for (int g = 0; g < RICE_BLOCK / 8; g += 2) {
+        // The pack works per 128-bit lane, the permute puts the values back in order
+        __m256i bits = _mm256_packus_epi32(low_avx2(low, k, g, mask), low_avx2(low, k, g + 1, mask));
+        bits = _mm256_permute4x64_epi64(bits, 0xD8);
+        __m256i high = _mm256_loadu_si256((const __m256i*)(values + 8 * g));
+        _mm256_storeu_si256((__m256i*)(values + 8 * g), _mm256_or_si256(_mm256_sll_epi16(high, shift), bits));
+    }
+}
+
+// As finish_sse4 in each 128-bit lane, then the low lane's sum goes into the high one
+__attribute__((target("avx2")))
+static void finish_avx2(sample_decoder_t *dec, const uint16_t *values, void *out) {
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i last = _mm256_set1_epi16(0x0F0E);
+    __m256i carry = _mm256_set1_epi16(dec->prev);
+
+    for (int i = 0; i < RICE_BLOCK; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        v = _mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_and_si256(v, one)));
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2));
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+        __m256i t = _mm256_shuffle_epi8(v, last);
+        v = _mm256_add_epi16(v, _mm256_permute2x128_si256(t, t, 0x08));
+        v = _mm256_add_epi16(v, carry);
+        t = _mm256_shuffle_epi8(v, last);
+        carry = _mm256_permute2x128_si256(t, t, 0x11);
+        store_avx2(dec, v, out, i);
+    }
+    dec->prev = _mm256_extract_epi16(carry, 0);
+}
+
+// 16 samples from 24 bytes, reading 28
+__attribute__((target("avx2")))
+static size_t packed_avx2(const sample_decoder_t *dec, const uint8_t *in, size_t length, size_t pairs, void *out) {
+    const __m256i shuffle = _mm256_setr_epi8(PACKED_SHUFFLE, PACKED_SHUFFLE);
+    const __m256i mask = _mm256_set1_epi16(0x0FFF);
+    size_t i = 0;
+
+    for (; i + 8 <= pairs && 3 * i + 28 <= length; i += 8) {
+        const uint8_t *p = in + 3 * i;
+        __m256i w = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+                _mm_loadu_si128((const __m128i*)(p + 12)), 1);
+        w = _mm256_shuffle_epi8(w, shuffle);
+        store_avx2(dec, _mm256_blend_epi16(_mm256_and_si256(w, mask), _mm256_srli_epi16(w, 4), 0xAA), out, 2 * i);
+    }
+    return i;
+}
+
+// 16 samples from 32 bytes
+__attribute__((target("avx2")))
+static size_t words_avx2(const sample_decoder_t *dec, const uint8_t *in, size_t count, uint16_t flip, void *out) {
+    const __m256i sign = _mm256_set1_epi16(flip);
+    const __m256i mask = _mm256_set1_epi16(0x0FFF);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i w = _mm256_loadu_si256((const __m256i*)(in + 2 * i));
+        store_avx2(dec, _mm256_and_si256(_mm256_xor_si256(w, sign), mask), out, i);
+    }
+    return i;
+}
+
+static const kernels_t kernels[] = {
+    { join_scalar, finish_scalar, packed_scalar, words_scalar },
+    { join_sse4, finish_sse4, packed_sse4, words_sse4 },
+    { join_avx2, finish_avx2, packed_avx2, words_avx2 },
+};
+
+static int has_level(sample_level_t level) {
+    if (level == SAMPLE_AVX2) return __builtin_cpu_supports("avx2");
+    if (level == SAMPLE_SSE4) return __builtin_cpu_supports("sse4.1");
+    return level == SAMPLE_SCALAR;
+}
+
+#else
+
+static const kernels_t kernels[] = {
+    { join_scalar, finish_scalar, packed_scalar, words_scalar },
+};
+
+static int has_level(sample_level_t level) {
+    return level == SAMPLE_SCALAR;
+}
+
+#endif
+
+static sample_level_t best;
+
+// Before main, as in frame_crc.c: threads never race on the tables
+__attribute__((constructor))
+static void init(void) {
+#ifdef HAS_X86
+    make_groups();
+#endif
+    best = has_level(SAMPLE_AVX2) ? SAMPLE_AVX2 : has_level(SAMPLE_SSE4) ? SAMPLE_SSE4 : SAMPLE_SCALAR;
+}
+
+sample_level_t sample_best_level(void) {
+    return best;
+}
+
+const char *sample_level_name(sample_level_t level) {
+    return names[level];
+}
+
+void sample_decoder_init(sample_decoder_t *dec, sample_format_t format, uint16_t offset, float scale) {
+    dec->format = format;
+    dec->level = best;
+    dec->offset = offset;
+    dec->scale = scale;
+    dec->prev = 0;
+}
+
+int sample_decoder_set_level(sample_decoder_t *dec, sample_level_t level) {
+    if (!has_level(level)) return -1;
+    dec->level = level;
+    return 0;
+}
+
+long sample_decode_rice(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max) {
+    const kernels_t *kernel = &kernels[dec->level];
+    uint16_t values[RICE_BLOCK];
+    size_t pos = 0, count = 0;
+
+    for (; count + RICE_BLOCK <= max && pos < length; count += RICE_BLOCK) {
+        const uint8_t *block = in + pos;
+        size_t left = length - pos, n;
+        uint32_t k = block[0];
+
+        if (k == RICE_RAW) {
+            if (left < RICE_MAX_BYTES) break;
+            memcpy(values, block + 1, sizeof(values));
+            n = RICE_MAX_BYTES;
+        } else {
+            if (left < 1 + 4 * k) break;
+            n = k > RICE_MAX_K ? DAMAGED : read_unary(block + 1 + 4 * k, left - 1 - 4 * k, k, values);
+            if (n == CUT_OFF) break;
+            if (n == DAMAGED) {
+                *used = pos;
+                return -1;
+            }
+            // The vector loads run up to 16 bytes past the start of the
+            // last group; a block at the end of in goes the scalar way
+            if (k) (left >= 1 + 4 * k + 16 ? kernel->join : join_scalar)(block + 1, k, values);
+            n += 1 + 4 * k;
+        }
+        kernel->finish(dec, values, out_at(dec, out, count));
+        pos += n;
+    }
+    *used = pos;
+    return count;
+}
+
+long sample_decode_rice_payload(sample_decoder_t *dec, const uint8_t *payload, size_t length,
+        void *out, size_t max) {
+    if (length < 4) return -1;
+    size_t count = payload[0] | payload[1] << 8, used;
+
+    if (count % RICE_BLOCK || count > max) return -1;
+    dec->prev = payload[2] | payload[3] << 8;
+    if (sample_decode_rice(dec, payload + 4, length - 4, &used, out, count) != count) return -1;
+    // Padding to the word the frame CRC needs
+    if (length - 4 - used >= 4) return -1;
+    return count;
+}
+
+long sample_decode_packed12(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max) {
+    size_t pairs = length / 3 < max / 2 ? length / 3 : max / 2;
+    size_t done = kernels[dec->level].packed(dec, in, length, pairs, out);
+
+    packed_scalar(dec, in + 3 * done, length - 3 * done, pairs - done, out_at(dec, out, 2 * done));
+    *used = 3 * pairs;
+    return 2 * pairs;
+}
+
+long sample_decode_word12(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max, int is_signed) {
+    size_t count = length / 2 < max ? length / 2 : max;
+    // Flipping the sign bit turns two's complement codes into offset
+    // binary, 2048 up: the offset takes the 2048 back out
+    uint16_t flip = is_signed ? 0x800 : 0;
+    sample_decoder_t biased = *dec;
+
+    biased.offset += flip;
+    size_t done = kernels[dec->level].words(&biased, in, count, flip, out);
+
+    words_scalar(&biased, in + 2 * done, count - done, flip, out_at(dec, out, done));
+    *used = 2 * count;
+    return count;
+}
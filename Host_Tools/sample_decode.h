@@ -0,0 +1,82 @@
+#ifndef SAMPLE_DECODE_H
+#define SAMPLE_DECODE_H
+
+// Fast decoder for sample streams from the board, for hosts that take in
+// many boards at once:
+//
+//   Rice       delta + Rice coded blocks (Core/Inc/rice.h), as in frames
+//              with FRAME_FLAG_RICE
+//   packed12   12-bit samples, two in 3 bytes: the low 8 bits of the
+//              first, its high 4 bits with the low 4 of the second, then
+//              the high 8 of the second
+//   word12     12-bit samples in the low bits of little-endian 16-bit
+//              words, as ADCs and DMA leave them. The top 4 bits are
+//              dropped: unsigned codes are masked, signed ones sign
+//              extended from bit 11.
+//
+// The samples come out as int16 or float, (sample - offset) or
+// (sample - offset) * scale, written straight into the caller's buffer.
+// Input is read where it lies, nothing is copied or kept between calls:
+// a call takes whole blocks or sample pairs and reports how many bytes
+// it used, the caller hands the rest in again with the data that
+// follows. Rice decoding keeps the last sample in the decoder, as the
+// base of the next delta.
+//
+// The work is done with AVX2, SSE4.1 or plain C, the best the CPU has.
+// The unary part of the Rice code stays scalar; the low bits, the deltas
+// and the conversion run in SIMD. rice_decode.c is the reference.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    SAMPLE_INT16,
+    SAMPLE_FLOAT,
+} sample_format_t;
+
+typedef enum {
+    SAMPLE_SCALAR,
+    SAMPLE_SSE4,
+    SAMPLE_AVX2,
+} sample_level_t;
+
+typedef struct {
+    sample_format_t format;
+    sample_level_t level;
+    uint16_t offset;        // Mid-scale of the ADC, 0 to keep the codes
+    float scale;            // For SAMPLE_FLOAT
+    uint16_t prev;          // Last Rice sample, the base of the next delta
+} sample_decoder_t;
+
+void sample_decoder_init(sample_decoder_t *dec, sample_format_t format, uint16_t offset, float scale);
+
+// Best level this CPU has, which sample_decoder_init picks
+sample_level_t sample_best_level(void);
+const char *sample_level_name(sample_level_t level);
+// Another level for the decoder, to compare them. -1 if the CPU lacks it.
+int sample_decoder_set_level(sample_decoder_t *dec, sample_level_t level);
+
+// Rice blocks from in into out, which takes max samples. Stops at the end
+// of out, or at a block cut off by the end of in. *used gets the bytes
+// taken. Returns the samples written, or -1 at a damaged block.
+long sample_decode_rice(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max);
+
+// The payload of a FRAME_FLAG_RICE frame: sets the base from its header,
+// then decodes all its blocks. Returns the samples, or -1 if the payload
+// is damaged or holds more than max.
+long sample_decode_rice_payload(sample_decoder_t *dec, const uint8_t *payload, size_t length,
+        void *out, size_t max);
+
+// packed12 samples from in into out, a whole number of pairs. *used gets
+// the bytes taken (3 per pair). Returns the samples written.
+long sample_decode_packed12(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max);
+
+// word12 samples from in into out. *used gets the bytes taken (2 per
+// sample). With is_signed the codes are two's complement, -2048..2047,
+// and offset is usually 0. Returns the samples written.
+long sample_decode_word12(sample_decoder_t *dec, const uint8_t *in, size_t length, size_t *used,
+        void *out, size_t max, int is_signed);
+
+#endif /* SAMPLE_DECODE_H */
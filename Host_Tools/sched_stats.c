@@ -0,0 +1,92 @@
+// Reads the run time of the firmware main loop tasks from the board.
+//
+// The firmware books every main loop cycle on the task that ran, on idle
+// (WFI), or on neither: interrupts between tasks and the scheduler itself
+// (Core/Inc/sched.h). This tool fetches that block with a vendor request
+// and prints the share of each.
+//
+// Usage: sched_stats [-r]
+//   -r  clear the counters on the device after reading them
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <libusb.h>
+
+#define VENDOR_ID 0x0483
+#define PRODUCT_ID 0x1255
+
+#define VENDOR_SCHED_STATS 0x13
+#define SCHED_STATS_VERSION 1
+#define TIMEOUT_MS 1000
+
+#define MAX_TASKS 8
+#define NAME_LENGTH 8
+#define HEADER_SIZE 24
+#define ENTRY_SIZE 24
+
+static uint32_t get32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+int main(int argc, char **argv) {
+    unsigned char buff[HEADER_SIZE + ENTRY_SIZE * MAX_TASKS];
+    int reset = argc > 1 && strcmp(argv[1], "-r") == 0;
+    libusb_device_handle *dev;
+    int ret;
+
+    if (libusb_init(NULL) < 0) {
+        printf("Cannot initialize libusb\n");
+        return 1;
+    }
+    dev = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+    if (!dev) {
+        printf("Device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+        return 1;
+    }
+
+    ret = libusb_control_transfer(dev, 0xC0, VENDOR_SCHED_STATS, reset, 0, buff, sizeof(buff), TIMEOUT_MS);
+    libusb_close(dev);
+    libusb_exit(NULL);
+    if (ret < 0) {
+        printf("Request failed: %s\n", libusb_error_name(ret));
+        return 1;
+    }
+    if (ret != sizeof(buff) || buff[0] != SCHED_STATS_VERSION || buff[1] > MAX_TASKS || buff[2] != ENTRY_SIZE) {
+        printf("Unexpected block: %i bytes, version %i, %i tasks of %i bytes\n", ret, buff[0], buff[1], buff[2]);
+        return 1;
+    }
+
+    double cpu_mhz = get32(buff + 4) / 1e6;
+    uint64_t elapsed = get64(buff + 8);
+    uint64_t idle = get64(buff + 16);
+    uint64_t booked = idle;
+
+    if (elapsed == 0) {
+        printf("Nothing measured yet\n");
+        return 0;
+    }
+    printf("HCLK %.0f MHz, %.1f ms measured\n", cpu_mhz, elapsed / cpu_mhz / 1000);
+    printf("%-8s %10s %10s %10s %12s %7s\n", "task", "runs", "avg", "max", "total us", "share");
+    for (int i = 0; i < buff[1]; i++) {
+        const unsigned char *entry = buff + HEADER_SIZE + i * ENTRY_SIZE;
+        char name[NAME_LENGTH + 1] = { 0 };
+        uint64_t cycles = get64(entry + NAME_LENGTH);
+        uint32_t runs = get32(entry + 16);
+
+        memcpy(name, entry, NAME_LENGTH);
+        booked += cycles;
+        printf("%-8s %10u %10.0f %10u %12.1f %6.2f%%\n", name, runs, runs ? (double)cycles / runs : 0.0,
+                get32(entry + 20), cycles / cpu_mhz, 100.0 * cycles / elapsed);
+    }
+    printf("%-8s %10s %10s %10s %12.1f %6.2f%%\n", "idle", "-", "-", "-", idle / cpu_mhz, 100.0 * idle / elapsed);
+    // Interrupts taken outside of tasks, and the scheduler itself
+    printf("%-8s %10s %10s %10s %12.1f %6.2f%%\n", "other", "-", "-", "-", (elapsed - booked) / cpu_mhz,
+            100.0 * (elapsed - booked) / elapsed);
+    if (reset) printf("Counters cleared\n");
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Prints the device-side USB counters through the kernel driver.
+//
+// The firmware counts transfers, packets and bytes per endpoint, NAKed IN
+// tokens, Tx FIFO empty interrupts, incomplete iso frames, SETUP packets
+// and bus resets (Core/Inc/usb_stats.h). The driver fetches the block with
+// a vendor request on USB_DRV_IOC_GET_STATS. Comparing the byte counts with
+// what a host tool received shows where data got lost.
+//
+// Usage: usb_stats [-r] [device]
+//   -r      clear the counters on the device after reading them
+//   device  defaults to /dev/usbdrv_0
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "usb_drv_ioctl.h"
+
+#define DEFAULT_DEVICE "/dev/usbdrv_0"
+
+static void print_ep(const char *dir, int ep, const struct usb_drv_ep_stats *stat, int is_in) {
+    if (!stat->transfers && !stat->naks && !stat->fifo_empty) return;
+    printf("%-3s %2d %10u %10u %12u", dir, ep, stat->transfers, stat->packets, stat->bytes);
+    if (is_in) printf(" %10u %10u", stat->naks, stat->fifo_empty);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    const char *path = DEFAULT_DEVICE;
+    int clear = 0;
+    struct usb_drv_stats stats;
+    int fd;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) clear = 1;
+        else path = argv[i];
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    if (ioctl(fd, clear ? USB_DRV_IOC_GET_CLEAR_STATS : USB_DRV_IOC_GET_STATS, &stats) < 0) {
+        perror("Reading statistics");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    printf("Frame %u, bus resets %u\n", stats.frame, stats.bus_resets);
+    printf("SETUP packets: standard %u, class %u, vendor %u, reserved %u\n",
+            stats.setup[0], stats.setup[1], stats.setup[2], stats.setup[3]);
+    printf("Incomplete iso frames: IN %u, OUT %u\n", stats.iso_in_incomplete, stats.iso_out_incomplete);
+    printf("%-3s %2s %10s %10s %12s %10s %10s\n", "dir", "ep", "transfers", "packets", "bytes", "naks", "fifo empty");
+    for (int ep = 0; ep < USB_DRV_STATS_EPS; ep++) {
+        print_ep("IN", ep, &stats.in[ep], 1);
+        print_ep("OUT", ep, &stats.out[ep], 0);
+    }
+    if (clear) printf("Counters cleared\n");
+    return 0;
+}